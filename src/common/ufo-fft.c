@@ -21,80 +21,425 @@
 
 #include <string.h>
 
-#ifdef HAVE_AMD
+#if defined(HAVE_AMD)
 #include <clFFT.h>
+#elif defined(HAVE_FFTW)
+#include <fftw3.h>
 #else
 #include "oclFFT.h"
 #endif
 
 #include "ufo-fft.h"
 
-struct _UfoFft {
-    UfoFftParameter seen;
+/*
+ * Plans are shared between the UfoFft objects of a plugin that use the same
+ * context, device and transform parameters. OpenCL plans hold kernels of their
+ * context and cannot move to another one. Unused plans are kept in least
+ * recently used order up to a fixed bound while another UfoFft still uses
+ * their context, the plans of a context are destroyed when its last UfoFft is
+ * destroyed or moves to another context. Baking plans for new contexts is sped
+ * up by the kernel binaries clFFT stores in UFO_FFT_PLAN_CACHE_DIR.
+ */
+#define PLAN_CACHE_DEFAULT_SIZE 8
 
-#ifdef HAVE_AMD
+#define FFTW_WISDOM_ENV         "UFO_FFT_WISDOM"
+#define FFTW_THREADS_ENV        "UFO_FFT_THREADS"
+
+typedef struct {
+    cl_context context;
+    cl_device_id device;
+    UfoFftParameter param;
+    guint refcount;
+    GMutex execute_lock;
+
+#if defined(HAVE_AMD)
     clfftPlanHandle amd_plan;
-    clfftSetupData amd_setup;
+    clfftPlanHandle amd_inverse_plan;   /* complex-to-real for real plans */
+#elif defined(HAVE_FFTW)
+    /* indexed by direction, in-place and unaligned, created on first use */
+    fftwf_plan fftw_plans[2][2][2];
 #else
     clFFT_Plan apple_plan;
 #endif
+} Plan;
+
+typedef struct {
+    GMutex lock;
+    GList *plans;       /* most recently used first */
+    guint n_users;
+    guint max_unused;
+
+#if defined(HAVE_AMD)
+    gboolean amd_ready;
+    clfftSetupData amd_setup;
+#elif defined(HAVE_FFTW)
+    GMutex planner_lock;    /* wisdom export and plans of this plugin */
+#endif
+} PlanCache;
+
+struct _UfoFft {
+    UfoFftParameter seen;
+    PlanCache *cache;
+    Plan *plan;
 };
 
-#ifdef HAVE_AMD
-static GMutex amd_mutex;
-static GList *ffts_created = NULL;
+
+static PlanCache *
+create_plan_cache (void)
+{
+    PlanCache *cache;
+    const gchar *size;
+    const gchar *dir;
+#ifdef HAVE_FFTW
+    const gchar *wisdom;
+    const gchar *threads;
 #endif
 
+    cache = g_malloc0 (sizeof (PlanCache));
+    g_mutex_init (&cache->lock);
 
-UfoFft *
-ufo_fft_new (void)
+    size = g_getenv ("UFO_FFT_PLAN_CACHE_SIZE");
+    cache->max_unused = size != NULL ? (guint) g_ascii_strtoull (size, NULL, 10) : PLAN_CACHE_DEFAULT_SIZE;
+
+    /* clFFT stores baked kernel binaries in CLFFT_CACHE_PATH */
+    dir = g_getenv ("UFO_FFT_PLAN_CACHE_DIR");
+
+    if (dir != NULL && g_getenv ("CLFFT_CACHE_PATH") == NULL) {
+        if (g_mkdir_with_parents (dir, 0755) == 0)
+            g_setenv ("CLFFT_CACHE_PATH", dir, FALSE);
+        else
+            g_warning ("Could not create FFT plan cache directory `%s'", dir);
+    }
+
+#ifdef HAVE_FFTW
+    g_mutex_init (&cache->planner_lock);
+    fftwf_init_threads ();
+
+    /* planner_lock only serializes the planners of this plugin */
+    fftwf_make_planner_thread_safe ();
+
+    /* Tasks already run in parallel, one thread per transform by default */
+    threads = g_getenv (FFTW_THREADS_ENV);
+    fftwf_plan_with_nthreads (threads != NULL ? (int) MAX (1, g_ascii_strtoull (threads, NULL, 10)) : 1);
+
+    wisdom = g_getenv (FFTW_WISDOM_ENV);
+
+    if (wisdom != NULL && g_file_test (wisdom, G_FILE_TEST_EXISTS) &&
+        !fftwf_import_wisdom_from_filename (wisdom))
+        g_warning ("Could not import FFTW wisdom from `%s'", wisdom);
+#endif
+
+    return cache;
+}
+
+static PlanCache *
+get_plan_cache (void)
 {
-    UfoFft *fft;
+    static PlanCache *cache = NULL;
 
-    fft = g_malloc0 (sizeof (UfoFft));
+    if (g_once_init_enter (&cache))
+        g_once_init_leave (&cache, create_plan_cache ());
+
+    return cache;
+}
+
+static gboolean
+plan_matches (Plan *plan, cl_context context, cl_device_id device, UfoFftParameter *param)
+{
+    return plan->context == context &&
+           plan->device == device &&
+           plan->param.dimensions == param->dimensions &&
+           plan->param.size[0] == param->size[0] &&
+           plan->param.size[1] == param->size[1] &&
+           plan->param.size[2] == param->size[2] &&
+           plan->param.batch == param->batch &&
+           plan->param.zeropad == param->zeropad &&
+           plan->param.real == param->real;
+}
 
 #ifdef HAVE_AMD
-    UFO_RESOURCES_CHECK_CLERR (clfftSetup (&fft->amd_setup));
+static clfftPlanHandle
+create_amd_plan (cl_context context, cl_command_queue queue, UfoFftParameter *param,
+                 clfftLayout in_layout, clfftLayout out_layout)
+{
+    /* we use param->dimension to index into this array! */
+    clfftDim dimension[4] = { 0, CLFFT_1D, CLFFT_2D, CLFFT_3D };
+    clfftPlanHandle handle;
+
+    UFO_RESOURCES_CHECK_CLERR (clfftCreateDefaultPlan (&handle, context, dimension[param->dimensions], param->size));
+    UFO_RESOURCES_CHECK_CLERR (clfftSetPlanBatchSize (handle, param->batch));
+    UFO_RESOURCES_CHECK_CLERR (clfftSetPlanPrecision (handle, CLFFT_SINGLE));
+    UFO_RESOURCES_CHECK_CLERR (clfftSetLayout (handle, in_layout, out_layout));
+
+    if (param->real) {
+        const guint last = param->dimensions - 1;
+        gsize real_sizes[3] = { param->size[0], param->size[1], param->size[2] };
+        gsize half_sizes[3] = { param->size[0] / 2 + 1, param->size[1], param->size[2] };
+        gsize real_strides[3] = { 1, 0, 0 };
+        gsize half_strides[3] = { 1, 0, 0 };
+        gsize real_distance;
+        gsize half_distance;
 
-    g_mutex_lock (&amd_mutex);
-    ffts_created = g_list_append (ffts_created, fft);
-    g_mutex_unlock (&amd_mutex);
+        /* Rows are stored densely, the hermitian side only keeps the
+         * non-redundant size[0] / 2 + 1 values of each row */
+        for (guint i = 1; i < 3; i++) {
+            real_strides[i] = real_strides[i - 1] * real_sizes[i - 1];
+            half_strides[i] = half_strides[i - 1] * half_sizes[i - 1];
+        }
+
+        real_distance = real_strides[last] * real_sizes[last];
+        half_distance = half_strides[last] * half_sizes[last];
+
+        if (in_layout == CLFFT_REAL) {
+            UFO_RESOURCES_CHECK_CLERR (clfftSetPlanInStride (handle, dimension[param->dimensions], real_strides));
+            UFO_RESOURCES_CHECK_CLERR (clfftSetPlanOutStride (handle, dimension[param->dimensions], half_strides));
+            UFO_RESOURCES_CHECK_CLERR (clfftSetPlanDistance (handle, real_distance, half_distance));
+        }
+        else {
+            UFO_RESOURCES_CHECK_CLERR (clfftSetPlanInStride (handle, dimension[param->dimensions], half_strides));
+            UFO_RESOURCES_CHECK_CLERR (clfftSetPlanOutStride (handle, dimension[param->dimensions], real_strides));
+            UFO_RESOURCES_CHECK_CLERR (clfftSetPlanDistance (handle, half_distance, real_distance));
+        }
+
+        UFO_RESOURCES_CHECK_CLERR (clfftSetResultLocation (handle, CLFFT_OUTOFPLACE));
+    }
+    else {
+        UFO_RESOURCES_CHECK_CLERR (clfftSetResultLocation (handle, param->zeropad ? CLFFT_INPLACE : CLFFT_OUTOFPLACE));
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clfftBakePlan (handle, 1, &queue, NULL, NULL));
+
+    return handle;
+}
 #endif
 
-    return fft;
+#ifdef HAVE_FFTW
+/*
+ * Number of real values of the real side and number of complex values of the
+ * complex side of one transform.
+ */
+static void
+get_fftw_sizes (UfoFftParameter *param, gsize *real_size, gsize *complex_size)
+{
+    *real_size = param->size[0];
+    *complex_size = param->real ? param->size[0] / 2 + 1 : param->size[0];
+
+    for (guint i = 1; i < (guint) param->dimensions; i++) {
+        *real_size *= param->size[i];
+        *complex_size *= param->size[i];
+    }
 }
 
-cl_int
-ufo_fft_update (UfoFft *fft, cl_context context, cl_command_queue queue, UfoFftParameter *param)
+/* Number of floats read and written by one execution */
+static void
+get_fftw_buffer_sizes (UfoFftParameter *param, UfoFftDirection direction,
+                       gsize *in_floats, gsize *out_floats)
 {
-    gboolean changed;
+    gsize real_size;
+    gsize complex_size;
+
+    get_fftw_sizes (param, &real_size, &complex_size);
+
+    if (!param->real) {
+        *in_floats = *out_floats = 2 * complex_size * param->batch;
+    }
+    else if (direction == UFO_FFT_FORWARD) {
+        *in_floats = real_size * param->batch;
+        *out_floats = 2 * complex_size * param->batch;
+    }
+    else {
+        *in_floats = 2 * complex_size * param->batch;
+        *out_floats = real_size * param->batch;
+    }
+}
+
+/* Must be called with cache->planner_lock held */
+static fftwf_plan
+create_fftw_plan (UfoFftParameter *param, UfoFftDirection direction,
+                  gboolean in_place, gboolean unaligned)
+{
+    fftwf_plan handle;
+    gfloat *in;
+    gfloat *out;
+    gsize real_size;
+    gsize complex_size;
+    gsize in_floats;
+    gsize out_floats;
+    int n[3];
+    int rank;
+    unsigned flags;
+
+    get_fftw_sizes (param, &real_size, &complex_size);
+    get_fftw_buffer_sizes (param, direction, &in_floats, &out_floats);
+
+    /* FFTW expects the slowest varying dimension first */
+    rank = (int) param->dimensions;
+
+    for (int i = 0; i < rank; i++)
+        n[i] = (int) param->size[rank - 1 - i];
+
+    flags = FFTW_MEASURE | (unaligned ? FFTW_UNALIGNED : 0);
+
+    /* Planning with FFTW_MEASURE overwrites the arrays */
+    in = fftwf_malloc (MAX (in_floats, out_floats) * sizeof (gfloat));
+    out = in_place ? in : fftwf_malloc (out_floats * sizeof (gfloat));
+
+    if (!param->real) {
+        handle = fftwf_plan_many_dft (rank, n, (int) param->batch,
+                                      (fftwf_complex *) in, NULL, 1, (int) complex_size,
+                                      (fftwf_complex *) out, NULL, 1, (int) complex_size,
+                                      direction == UFO_FFT_FORWARD ? FFTW_FORWARD : FFTW_BACKWARD,
+                                      flags);
+    }
+    else if (direction == UFO_FFT_FORWARD) {
+        handle = fftwf_plan_many_dft_r2c (rank, n, (int) param->batch,
+                                          in, NULL, 1, (int) real_size,
+                                          (fftwf_complex *) out, NULL, 1, (int) complex_size,
+                                          flags);
+    }
+    else {
+        handle = fftwf_plan_many_dft_c2r (rank, n, (int) param->batch,
+                                          (fftwf_complex *) in, NULL, 1, (int) complex_size,
+                                          out, NULL, 1, (int) real_size,
+                                          flags);
+    }
+
+    if (!in_place)
+        fftwf_free (out);
+
+    fftwf_free (in);
+
+    return handle;
+}
+
+static cl_int
+execute_fftw (PlanCache *cache, Plan *plan, UfoFftParameter *param,
+              gfloat *in, gfloat *out, UfoFftDirection direction)
+{
+    fftwf_plan *handle;
+    gboolean in_place;
+    gboolean unaligned;
+    gboolean created = FALSE;
+
+    in_place = in == out;
+
+    /* Real transforms use dense rows which do not fit in-place */
+    if (param->real && in_place)
+        return CL_INVALID_OPERATION;
+
+    unaligned = fftwf_alignment_of (in) != 0 || fftwf_alignment_of (out) != 0;
+    handle = &plan->fftw_plans[direction == UFO_FFT_FORWARD ? 0 : 1][in_place][unaligned];
+
+    if (*handle == NULL) {
+        g_mutex_lock (&cache->planner_lock);
+        *handle = create_fftw_plan (param, direction, in_place, unaligned);
+        g_mutex_unlock (&cache->planner_lock);
+
+        if (*handle == NULL)
+            return CL_INVALID_OPERATION;
+
+        created = TRUE;
+    }
+
+    if (param->real) {
+        if (direction == UFO_FFT_FORWARD)
+            fftwf_execute_dft_r2c (*handle, in, (fftwf_complex *) out);
+        else
+            fftwf_execute_dft_c2r (*handle, (fftwf_complex *) in, out);
+    }
+    else {
+        fftwf_execute_dft (*handle, (fftwf_complex *) in, (fftwf_complex *) out);
+    }
+
+    if (created && g_getenv (FFTW_WISDOM_ENV) != NULL) {
+        g_mutex_lock (&cache->planner_lock);
+
+        if (!fftwf_export_wisdom_to_filename (g_getenv (FFTW_WISDOM_ENV)))
+            g_warning ("Could not export FFTW wisdom to `%s'", g_getenv (FFTW_WISDOM_ENV));
+
+        g_mutex_unlock (&cache->planner_lock);
+    }
+
+    return CL_SUCCESS;
+}
+
+/* Run on mapped OpenCL buffers, which is free on CPU devices */
+static cl_int
+execute_fftw_mapped (UfoFft *fft, cl_command_queue queue, cl_mem in_mem, cl_mem out_mem,
+                     UfoFftDirection direction, cl_uint num_events, cl_event *event_list,
+                     cl_event *event)
+{
+    gfloat *in;
+    gfloat *out;
+    gsize in_floats;
+    gsize out_floats;
     cl_int error;
 
-    error = CL_SUCCESS;
-    changed = param->size[0] != fft->seen.size[0] || param->size[1] != fft->seen.size[1];
+    get_fftw_buffer_sizes (&fft->seen, direction, &in_floats, &out_floats);
 
-    if (changed)
-        memcpy (&fft->seen, param, sizeof (UfoFftParameter));
+    /* Complex-to-real transforms overwrite their input */
+    in = clEnqueueMapBuffer (queue, in_mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                             0, in_floats * sizeof (gfloat),
+                             num_events, event_list, NULL, &error);
 
-#ifdef HAVE_AMD
-    if (fft->amd_plan == 0 || changed) {
-        /* we use param->dimension to index into this array! */
-        clfftDim dimension[4] = { 0, CLFFT_1D, CLFFT_2D, CLFFT_3D };
+    if (error != CL_SUCCESS)
+        return error;
+
+    out = in;
 
-        if (fft->amd_plan != 0) {
-            clfftDestroyPlan (&fft->amd_plan);
-            fft->amd_plan = 0;
+    if (out_mem != in_mem) {
+        out = clEnqueueMapBuffer (queue, out_mem, CL_TRUE, CL_MAP_WRITE,
+                                  0, out_floats * sizeof (gfloat),
+                                  0, NULL, NULL, &error);
+
+        if (error != CL_SUCCESS) {
+            UFO_RESOURCES_CHECK_CLERR (clEnqueueUnmapMemObject (queue, in_mem, in, 0, NULL, NULL));
+            return error;
         }
+    }
+
+    error = execute_fftw (fft->cache, fft->plan, &fft->seen, in, out, direction);
+
+    if (out_mem != in_mem)
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueUnmapMemObject (queue, out_mem, out, 0, NULL, NULL));
 
-        UFO_RESOURCES_CHECK_CLERR (clfftCreateDefaultPlan (&fft->amd_plan, context, dimension[param->dimensions], param->size));
-        UFO_RESOURCES_CHECK_CLERR (clfftSetPlanBatchSize (fft->amd_plan, param->batch));
-        UFO_RESOURCES_CHECK_CLERR (clfftSetPlanPrecision (fft->amd_plan, CLFFT_SINGLE));
-        UFO_RESOURCES_CHECK_CLERR (clfftSetLayout (fft->amd_plan, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED));
-        UFO_RESOURCES_CHECK_CLERR (clfftSetResultLocation (fft->amd_plan, param->zeropad ? CLFFT_INPLACE : CLFFT_OUTOFPLACE));
-        UFO_RESOURCES_CHECK_CLERR (clfftBakePlan (fft->amd_plan, 1, &queue, NULL, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueUnmapMemObject (queue, in_mem, in, 0, NULL, event));
+
+    return error;
+}
+#endif
+
+static Plan *
+create_plan (cl_context context, cl_device_id device, cl_command_queue queue,
+             UfoFftParameter *param, cl_int *error)
+{
+    Plan *plan;
+
+    plan = g_malloc0 (sizeof (Plan));
+    plan->context = context;
+    plan->device = device;
+    plan->param = *param;
+    g_mutex_init (&plan->execute_lock);
+
+    if (context != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainContext (context));
+
+#if defined(HAVE_AMD)
+    if (param->real) {
+        plan->amd_plan = create_amd_plan (context, queue, param, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
+        plan->amd_inverse_plan = create_amd_plan (context, queue, param, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
     }
+    else {
+        plan->amd_plan = create_amd_plan (context, queue, param, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED);
+    }
+#elif defined(HAVE_FFTW)
+    /* FFTW plans depend on the buffers and are created by the first execution */
 #else
-    if (fft->apple_plan == NULL || changed) {
+    if (param->real) {
+        g_warning ("Real-to-complex transforms are not supported by oclFFT");
+        *error = CL_INVALID_OPERATION;
+    }
+    else {
         clFFT_Dim3 size;
 
         /* we use param->dimension to index into this array! */
@@ -104,15 +449,221 @@ ufo_fft_update (UfoFft *fft, cl_context context, cl_command_queue queue, UfoFftP
         size.y = param->size[1];
         size.z = param->size[2];
 
-        if (fft->apple_plan != NULL) {
-            clFFT_DestroyPlan (fft->apple_plan);
-            fft->apple_plan = NULL;
+        plan->apple_plan = clFFT_CreatePlan (context, size, dimension[param->dimensions], clFFT_InterleavedComplexFormat, error);
+    }
+#endif
+
+    return plan;
+}
+
+static void
+destroy_plan (PlanCache *cache, Plan *plan)
+{
+#if defined(HAVE_AMD)
+    clfftDestroyPlan (&plan->amd_plan);
+
+    if (plan->amd_inverse_plan != 0)
+        clfftDestroyPlan (&plan->amd_inverse_plan);
+#elif defined(HAVE_FFTW)
+    fftwf_plan *handles = &plan->fftw_plans[0][0][0];
+
+    g_mutex_lock (&cache->planner_lock);
+
+    for (guint i = 0; i < sizeof (plan->fftw_plans) / sizeof (fftwf_plan); i++) {
+        if (handles[i] != NULL)
+            fftwf_destroy_plan (handles[i]);
+    }
+
+    g_mutex_unlock (&cache->planner_lock);
+#else
+    if (plan->apple_plan != NULL)
+        clFFT_DestroyPlan (plan->apple_plan);
+#endif
+
+    if (plan->context != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (plan->context));
+    g_mutex_clear (&plan->execute_lock);
+    g_free (plan);
+}
+
+static cl_device_id
+get_queue_device (cl_command_queue queue)
+{
+    cl_device_id device = NULL;
+
+    /* Host-only FFTW plans are not bound to a device */
+    if (queue != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &device, NULL));
+
+    return device;
+}
+
+/*
+ * Destroy the plans of a context if no UfoFft uses any of them anymore. Host
+ * plans are not bound to a context and only bounded by the cache size. Must be
+ * called with cache->lock held.
+ */
+static void
+drop_context_plans (PlanCache *cache, cl_context context)
+{
+    GList *it;
+
+    if (context == NULL)
+        return;
+
+    g_list_for (cache->plans, it) {
+        Plan *plan = (Plan *) it->data;
+
+        if (plan->context == context && plan->refcount > 0)
+            return;
+    }
+
+    it = cache->plans;
+
+    while (it != NULL) {
+        GList *next = g_list_next (it);
+        Plan *plan = (Plan *) it->data;
+
+        if (plan->context == context) {
+            destroy_plan (cache, plan);
+            cache->plans = g_list_delete_link (cache->plans, it);
         }
 
-        fft->apple_plan = clFFT_CreatePlan (context, size, dimension[param->dimensions], clFFT_InterleavedComplexFormat, &error);
+        it = next;
+    }
+}
+
+/* Must be called with cache->lock held */
+static Plan *
+acquire_plan (PlanCache *cache, cl_context context, cl_command_queue queue,
+              UfoFftParameter *param, cl_int *error)
+{
+    cl_device_id device;
+    Plan *plan;
+    GList *it;
+
+    device = get_queue_device (queue);
+
+    g_list_for (cache->plans, it) {
+        plan = (Plan *) it->data;
+
+        if (plan_matches (plan, context, device, param)) {
+            cache->plans = g_list_remove_link (cache->plans, it);
+            cache->plans = g_list_concat (it, cache->plans);
+            plan->refcount++;
+            return plan;
+        }
     }
+
+    plan = create_plan (context, device, queue, param, error);
+    plan->refcount = 1;
+    cache->plans = g_list_prepend (cache->plans, plan);
+    return plan;
+}
+
+/* Must be called with cache->lock held */
+static void
+release_plan (PlanCache *cache, Plan *plan)
+{
+    GList *it;
+    guint n_unused = 0;
+
+    g_assert (plan->refcount > 0);
+    plan->refcount--;
+
+    if (plan->refcount > 0)
+        return;
+
+    /* Evict the least recently used plans that are not in use anymore */
+    it = g_list_find (cache->plans, plan);
+    cache->plans = g_list_remove_link (cache->plans, it);
+    cache->plans = g_list_concat (it, cache->plans);
+
+    it = cache->plans;
+
+    while (it != NULL) {
+        GList *next = g_list_next (it);
+        Plan *candidate = (Plan *) it->data;
+
+        if (candidate->refcount == 0 && ++n_unused > cache->max_unused) {
+            destroy_plan (cache, candidate);
+            cache->plans = g_list_delete_link (cache->plans, it);
+        }
+
+        it = next;
+    }
+}
+
+UfoFft *
+ufo_fft_new (void)
+{
+    UfoFft *fft;
+    PlanCache *cache;
+
+    fft = g_malloc0 (sizeof (UfoFft));
+    fft->cache = cache = get_plan_cache ();
+
+    g_mutex_lock (&cache->lock);
+
+#ifdef HAVE_AMD
+    if (!cache->amd_ready) {
+        UFO_RESOURCES_CHECK_CLERR (clfftSetup (&cache->amd_setup));
+        cache->amd_ready = TRUE;
+    }
+#endif
+
+    cache->n_users++;
+    g_mutex_unlock (&cache->lock);
+
+    return fft;
+}
+
+/**
+ * ufo_fft_supports_real:
+ *
+ * Returns: %TRUE if #UfoFftParameter.real transforms can be used.
+ */
+gboolean
+ufo_fft_supports_real (void)
+{
+#if defined(HAVE_AMD) || defined(HAVE_FFTW)
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+cl_int
+ufo_fft_update (UfoFft *fft, cl_context context, cl_command_queue queue, UfoFftParameter *param)
+{
+    Plan *old;
+    cl_int error;
+
+#ifdef HAVE_FFTW
+    /* Host plans do not depend on the device and are shared by all of them */
+    context = NULL;
+    queue = NULL;
 #endif
 
+    error = CL_SUCCESS;
+    memcpy (&fft->seen, param, sizeof (UfoFftParameter));
+
+    if (fft->plan != NULL && plan_matches (fft->plan, context, get_queue_device (queue), param))
+        return error;
+
+    g_mutex_lock (&fft->cache->lock);
+    old = fft->plan;
+    fft->plan = acquire_plan (fft->cache, context, queue, param, &error);
+
+    if (old != NULL) {
+        cl_context old_context = old->context;
+
+        release_plan (fft->cache, old);
+        drop_context_plans (fft->cache, old_context);
+    }
+
+    g_mutex_unlock (&fft->cache->lock);
+
     return error;
 }
 
@@ -121,35 +672,53 @@ ufo_fft_execute (UfoFft *fft, cl_command_queue queue, UfoProfiler *profiler,
                  cl_mem in_mem, cl_mem out_mem, UfoFftDirection direction,
                  cl_uint num_events, cl_event *event_list, cl_event *event)
 {
-#ifdef HAVE_AMD
-    return clfftEnqueueTransform (fft->amd_plan,
-                                  direction == UFO_FFT_FORWARD ? CLFFT_FORWARD : CLFFT_BACKWARD,
-                                  1, &queue,
-                                  num_events, event_list, event, &in_mem, &out_mem, NULL);
+    cl_int error;
+
+    /* Plans are shared and keep temporary buffers */
+    g_mutex_lock (&fft->plan->execute_lock);
+
+#if defined(HAVE_AMD)
+    error = clfftEnqueueTransform (fft->seen.real && direction == UFO_FFT_BACKWARD ?
+                                   fft->plan->amd_inverse_plan : fft->plan->amd_plan,
+                                   direction == UFO_FFT_FORWARD ? CLFFT_FORWARD : CLFFT_BACKWARD,
+                                   1, &queue,
+                                   num_events, event_list, event, &in_mem, &out_mem, NULL);
+#elif defined(HAVE_FFTW)
+    error = execute_fftw_mapped (fft, queue, in_mem, out_mem, direction, num_events, event_list, event);
 #else
-    return clFFT_ExecuteInterleaved_Ufo (queue, fft->apple_plan,
-                                         fft->seen.batch,
-                                         direction == UFO_FFT_FORWARD ? clFFT_Forward : clFFT_Inverse,
-                                         in_mem, out_mem, num_events, event_list, event, profiler);
+    error = clFFT_ExecuteInterleaved_Ufo (queue, fft->plan->apple_plan,
+                                          fft->seen.batch,
+                                          direction == UFO_FFT_FORWARD ? clFFT_Forward : clFFT_Inverse,
+                                          in_mem, out_mem, num_events, event_list, event, profiler);
 #endif
+
+    g_mutex_unlock (&fft->plan->execute_lock);
+    return error;
 }
 
 void
 ufo_fft_destroy (UfoFft *fft)
 {
-#ifdef HAVE_AMD
-    g_mutex_lock (&amd_mutex);
+    PlanCache *cache = fft->cache;
 
-    clfftDestroyPlan (&fft->amd_plan);
-    ffts_created = g_list_remove (ffts_created, fft);
+    g_mutex_lock (&cache->lock);
 
-    if (g_list_length (ffts_created) == 0)
-        clfftTeardown ();
+    if (fft->plan != NULL) {
+        cl_context context = fft->plan->context;
 
-    g_mutex_unlock (&amd_mutex);
-#else
-    clFFT_DestroyPlan (fft->apple_plan);
+        release_plan (cache, fft->plan);
+        drop_context_plans (cache, context);
+    }
+
+    cache->n_users--;
+
+#ifdef HAVE_AMD
+    if (cache->n_users == 0 && cache->plans == NULL) {
+        clfftTeardown ();
+        cache->amd_ready = FALSE;
+    }
 #endif
 
+    g_mutex_unlock (&cache->lock);
     g_free (fft);
 }
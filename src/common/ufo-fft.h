@@ -38,6 +38,12 @@ typedef struct {
     gsize size[3];
     gsize batch;
     gboolean zeropad;
+
+    /* Real-to-complex forward and complex-to-real backward transforms. The
+     * spectrum is stored hermitian interleaved, i.e. only the size[0] / 2 + 1
+     * non-redundant complex values of each row. Always out-of-place, the
+     * complex-to-real transform may overwrite its input. */
+    gboolean real;
 } UfoFftParameter;
 
 typedef enum {
@@ -47,20 +53,21 @@ typedef enum {
 
 typedef struct _UfoFft UfoFft;
 
-UfoFft *ufo_fft_new     (void);
-cl_int  ufo_fft_update  (UfoFft            *fft,
-                         cl_context         context,
-                         cl_command_queue   queue,
-                         UfoFftParameter   *param);
-cl_int  ufo_fft_execute (UfoFft            *fft,
-                         cl_command_queue   queue,
-                         UfoProfiler       *profiler,
-                         cl_mem             in_mem,
-                         cl_mem             out_mem,
-                         UfoFftDirection    direction,
-                         cl_uint            num_events,
-                         cl_event          *event_list,
-                         cl_event          *event);
-void    ufo_fft_destroy (UfoFft            *fft);
+UfoFft  *ufo_fft_new            (void);
+gboolean ufo_fft_supports_real  (void);
+cl_int   ufo_fft_update         (UfoFft            *fft,
+                                 cl_context         context,
+                                 cl_command_queue   queue,
+                                 UfoFftParameter   *param);
+cl_int   ufo_fft_execute        (UfoFft            *fft,
+                                 cl_command_queue   queue,
+                                 UfoProfiler       *profiler,
+                                 cl_mem             in_mem,
+                                 cl_mem             out_mem,
+                                 UfoFftDirection    direction,
+                                 cl_uint            num_events,
+                                 cl_event          *event_list,
+                                 cl_event          *event);
+void     ufo_fft_destroy        (UfoFft            *fft);
 
 #endif
@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#include "ufo-filter-coefficients.h"
+#include "ufo-fft.h"
+
+/*
+ * Coefficient buffers are shared by the filtering tasks of a plugin with the
+ * same context, width and filter parameters. Buffers which are not used
+ * anymore are kept in least recently used order up to a fixed bound, so that
+ * width changes do not compute and upload them again, but only as long as
+ * another buffer of their context is in use. Releasing the last one destroys
+ * all buffers of the context.
+ */
+#define CACHE_MAX_UNUSED    32
+
+typedef void (*SetupFunc)(UfoFilterParameter *param, gfloat *coefficients, guint width);
+
+typedef struct {
+    UfoFilterParameter param;
+    guint width;
+    cl_context context;
+    cl_mem mem;
+    guint refcount;
+} Entry;
+
+typedef struct {
+    GMutex lock;
+    GList *entries;     /* most recently used first */
+} CoefficientCache;
+
+static void compute_ramp_coefficients (UfoFilterParameter *, gfloat *, guint);
+static void compute_real_space_ramp_coefficients (UfoFilterParameter *, gfloat *, guint);
+static void compute_butterworth_coefficients (UfoFilterParameter *, gfloat *, guint);
+static void compute_faris_byer_coefficients (UfoFilterParameter *, gfloat *, guint);
+static void compute_hamming_coefficients (UfoFilterParameter *, gfloat *, guint);
+
+GEnumValue ufo_filter_type_values[] = {
+    { UFO_FILTER_RAMP,          "FILTER_RAMP",          "ramp" },
+    { UFO_FILTER_RAMP_FROMREAL, "FILTER_RAMP_FROMREAL", "ramp-fromreal" },
+    { UFO_FILTER_BUTTERWORTH,   "FILTER_BUTTERWORTH",   "butterworth"},
+    { UFO_FILTER_FARIS_BYER,    "FILTER_FARIS_BYER",    "faris-byer"},
+    { UFO_FILTER_HAMMING,       "FILTER_HAMMING",       "hamming"},
+    { 0, NULL, NULL}
+};
+
+static SetupFunc filter_funcs[] = {
+    &compute_ramp_coefficients,
+    &compute_real_space_ramp_coefficients,
+    &compute_butterworth_coefficients,
+    &compute_faris_byer_coefficients,
+    &compute_hamming_coefficients,
+};
+
+static void
+mirror_coefficients (gfloat *filter, guint width)
+{
+    for (guint k = width/2 + 2; k < width; k += 2) {
+        filter[k] = filter[width - k];
+        filter[k + 1] = filter[width - k + 1];
+    }
+}
+
+static void
+compute_ramp_coefficients (UfoFilterParameter *param,
+                           gfloat *filter,
+                           guint width)
+{
+    const gdouble step = 2.0 / width;
+
+    for (guint k = 1; k < width / 4 + 1; k++) {
+        filter[2*k] = k * step * param->scale;
+        filter[2*k + 1] = filter[2*k];
+    }
+}
+
+static void
+compute_real_space_ramp_coefficients (UfoFilterParameter *param,
+                                      gfloat *filter,
+                                      guint width)
+{
+    filter[0] = filter[1] = 0.25;
+
+    for (guint k = 1; k < width / 4 + 1; k++) {
+        filter[2*k] = k % 2 ? - 1 / (k * k * G_PI * G_PI) : 0.0;
+        filter[2*k + 1] = filter[2*k];
+    }
+}
+
+static void
+compute_butterworth_coefficients (UfoFilterParameter *param,
+                                  gfloat *filter,
+                                  guint width)
+{
+    const gdouble step = 2.0 / width;
+
+    for (guint k = 0; k < (width / 4) + 1; k++) {
+        const gdouble f = k * step;
+        filter[2*k] = (gfloat) (f / (1.0 + pow (f / param->cutoff, 2.0 * param->bw_order)) * param->scale);
+        filter[2*k+1] = filter[2*k];
+    }
+}
+
+static void
+compute_hamming_coefficients (UfoFilterParameter *param,
+                              gfloat *filter,
+                              guint width)
+{
+    const gdouble step = 2.0 / width;
+
+    for (guint k = 0; k < (width / 4) + 1; k++) {
+        const gdouble f = k * step;
+
+        filter[2*k] = f < param->cutoff ? f * (0.54 + 0.46 * cos (G_PI * f / param->cutoff)) * param->scale : 0;
+        filter[2*k+1] = filter[2*k];
+    }
+}
+
+static guint
+get_padding_value (guint x)
+{
+    guint padding = 2 * x;
+    guint result = 1;
+
+    while (result < padding)
+        result *= 2;
+
+    return result;
+}
+
+static void
+compute_faris_byer_coefficients (UfoFilterParameter *param,
+                                 gfloat *filter,
+                                 guint width)
+{
+    const gdouble pi_squared_tau = G_PI * G_PI * param->fb_tau;
+    const gdouble sin_theta_2 = - sin (param->fb_theta) / 2;
+    const guint padding = get_padding_value (width);
+
+    filter[0] = 0;
+
+    for (guint x = 1; x <= width / 2; x++) {
+        if (x % 2 != 0)
+            filter[x] = 1 / (pi_squared_tau * x);
+    }
+
+    for (guint i = width / 2 + 1; i < width; i++) {
+        guint x = width + 1 - i;
+
+        if (x % 2 != 0)
+            filter[padding - width - i - 1] = sin_theta_2 / (x * x * pi_squared_tau);
+    }
+}
+
+static cl_mem
+create_coefficients (UfoFilterParameter *param,
+                     guint width,
+                     cl_context context,
+                     cl_command_queue queue,
+                     UfoProfiler *profiler)
+{
+    cl_mem filter_mem;
+    cl_int cl_err;
+    gfloat *coefficients;
+
+    coefficients = g_malloc0 (width * sizeof (gfloat));
+
+    coefficients[0] = 0.5 / width;
+    coefficients[1] = coefficients[0];
+
+    filter_funcs[param->type] (param, coefficients, width);
+    mirror_coefficients (coefficients, width);
+
+    filter_mem = clCreateBuffer (context,
+                                 CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                 width * sizeof(float),
+                                 coefficients,
+                                 &cl_err);
+    UFO_RESOURCES_CHECK_CLERR (cl_err);
+    g_free (coefficients);
+
+    if (param->type == UFO_FILTER_RAMP_FROMREAL) {
+        UfoFftParameter fft_param;
+        UfoFft *fft;
+
+        fft_param.dimensions = UFO_FFT_1D;
+        fft_param.size[0] = width / 2;
+        fft_param.size[1] = 1;
+        fft_param.size[2] = 1;
+        fft_param.batch = 1;
+        fft_param.zeropad = TRUE;
+        fft_param.real = FALSE;
+
+        fft = ufo_fft_new ();
+        UFO_RESOURCES_CHECK_CLERR (ufo_fft_update (fft, context, queue, &fft_param));
+        UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (fft, queue, profiler, filter_mem, filter_mem,
+                                                    UFO_FFT_FORWARD, 0, NULL, NULL));
+
+        /* The plan stays cached but its temporaries must not be in use */
+        UFO_RESOURCES_CHECK_CLERR (clFinish (queue));
+        ufo_fft_destroy (fft);
+    }
+
+    return filter_mem;
+}
+
+static CoefficientCache *
+create_cache (void)
+{
+    CoefficientCache *cache;
+
+    cache = g_malloc0 (sizeof (CoefficientCache));
+    g_mutex_init (&cache->lock);
+
+    return cache;
+}
+
+static CoefficientCache *
+get_cache (void)
+{
+    static CoefficientCache *cache = NULL;
+
+    if (g_once_init_enter (&cache))
+        g_once_init_leave (&cache, create_cache ());
+
+    return cache;
+}
+
+static void
+destroy_entry (Entry *entry)
+{
+    UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (entry->mem));
+    UFO_RESOURCES_CHECK_CLERR (clReleaseContext (entry->context));
+    g_free (entry);
+}
+
+/*
+ * Destroy the buffers of a context if none of them is in use anymore. Must be
+ * called with cache->lock held.
+ */
+static void
+drop_context_entries (CoefficientCache *cache, cl_context context)
+{
+    GList *it;
+
+    g_list_for (cache->entries, it) {
+        Entry *entry = (Entry *) it->data;
+
+        if (entry->context == context && entry->refcount > 0)
+            return;
+    }
+
+    it = cache->entries;
+
+    while (it != NULL) {
+        GList *next = g_list_next (it);
+        Entry *entry = (Entry *) it->data;
+
+        if (entry->context == context) {
+            destroy_entry (entry);
+            cache->entries = g_list_delete_link (cache->entries, it);
+        }
+
+        it = next;
+    }
+}
+
+static gboolean
+entry_matches (Entry *entry, UfoFilterParameter *param, guint width, cl_context context)
+{
+    return entry->context == context &&
+           entry->width == width &&
+           entry->param.type == param->type &&
+           entry->param.cutoff == param->cutoff &&
+           entry->param.bw_order == param->bw_order &&
+           entry->param.fb_tau == param->fb_tau &&
+           entry->param.fb_theta == param->fb_theta &&
+           entry->param.scale == param->scale;
+}
+
+/* Must be called with cache->lock held */
+static Entry *
+lookup_entry (CoefficientCache *cache, UfoFilterParameter *param, guint width, cl_context context)
+{
+    GList *it;
+
+    g_list_for (cache->entries, it) {
+        Entry *entry = (Entry *) it->data;
+
+        if (entry_matches (entry, param, width, context)) {
+            cache->entries = g_list_remove_link (cache->entries, it);
+            cache->entries = g_list_concat (it, cache->entries);
+            entry->refcount++;
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * ufo_filter_coefficients_acquire:
+ * @param: Filter parameters
+ * @width: Number of floats of an interleaved complex spectrum row
+ * @context: Context in which the buffer is created
+ * @queue: Queue used to upload and transform the coefficients
+ * @profiler: Profiler of the calling task
+ *
+ * Get the frequency response of a filter for one spectrum row. The buffer is
+ * computed only if no other user has requested it before and must not be
+ * modified.
+ *
+ * Returns: A buffer of @width floats, to be given back with
+ * ufo_filter_coefficients_release().
+ */
+cl_mem
+ufo_filter_coefficients_acquire (UfoFilterParameter *param,
+                                 guint width,
+                                 cl_context context,
+                                 cl_command_queue queue,
+                                 UfoProfiler *profiler)
+{
+    CoefficientCache *cache;
+    Entry *entry;
+    cl_mem mem;
+
+    cache = get_cache ();
+    g_mutex_lock (&cache->lock);
+    entry = lookup_entry (cache, param, width, context);
+    g_mutex_unlock (&cache->lock);
+
+    if (entry != NULL)
+        return entry->mem;
+
+    /* Computing may run an FFT, do not block other tasks meanwhile */
+    mem = create_coefficients (param, width, context, queue, profiler);
+
+    g_mutex_lock (&cache->lock);
+    entry = lookup_entry (cache, param, width, context);
+
+    if (entry != NULL) {
+        /* Another task was faster */
+        g_mutex_unlock (&cache->lock);
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (mem));
+        return entry->mem;
+    }
+
+    /* The entry keeps its context alive, hence comparing it is safe */
+    entry = g_malloc0 (sizeof (Entry));
+    entry->param = *param;
+    entry->width = width;
+    entry->context = context;
+    entry->mem = mem;
+    entry->refcount = 1;
+    UFO_RESOURCES_CHECK_CLERR (clRetainContext (context));
+    cache->entries = g_list_prepend (cache->entries, entry);
+
+    g_mutex_unlock (&cache->lock);
+    return mem;
+}
+
+/**
+ * ufo_filter_coefficients_release:
+ * @mem: A buffer returned by ufo_filter_coefficients_acquire()
+ *
+ * Give back a coefficient buffer. It stays in the cache until it is one of
+ * the least recently used buffers that are not in use anymore or no buffer of
+ * its context is in use anymore.
+ */
+void
+ufo_filter_coefficients_release (cl_mem mem)
+{
+    CoefficientCache *cache;
+    cl_context context = NULL;
+    GList *it;
+    guint n_unused = 0;
+
+    cache = get_cache ();
+    g_mutex_lock (&cache->lock);
+
+    g_list_for (cache->entries, it) {
+        Entry *entry = (Entry *) it->data;
+
+        if (entry->mem == mem) {
+            g_assert (entry->refcount > 0);
+            entry->refcount--;
+            context = entry->context;
+            break;
+        }
+    }
+
+    if (context != NULL)
+        drop_context_entries (cache, context);
+
+    it = cache->entries;
+
+    while (it != NULL) {
+        GList *next = g_list_next (it);
+        Entry *entry = (Entry *) it->data;
+
+        if (entry->refcount == 0 && ++n_unused > CACHE_MAX_UNUSED) {
+            destroy_entry (entry);
+            cache->entries = g_list_delete_link (cache->entries, it);
+        }
+
+        it = next;
+    }
+
+    g_mutex_unlock (&cache->lock);
+}
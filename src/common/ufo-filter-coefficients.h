@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UFO_FILTER_COEFFICIENTS_H
+#define UFO_FILTER_COEFFICIENTS_H
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <ufo/ufo.h>
+
+typedef enum {
+    UFO_FILTER_RAMP = 0,
+    UFO_FILTER_RAMP_FROMREAL,
+    UFO_FILTER_BUTTERWORTH,
+    UFO_FILTER_FARIS_BYER,
+    UFO_FILTER_HAMMING,
+} UfoFilterType;
+
+typedef struct {
+    UfoFilterType type;
+    gfloat cutoff;
+    gfloat bw_order;
+    gfloat fb_tau;
+    gfloat fb_theta;
+    gfloat scale;
+} UfoFilterParameter;
+
+/* Nick names of UfoFilterType, to be registered by each plugin */
+extern GEnumValue ufo_filter_type_values[];
+
+cl_mem  ufo_filter_coefficients_acquire (UfoFilterParameter *param,
+                                         guint               width,
+                                         cl_context          context,
+                                         cl_command_queue    queue,
+                                         UfoProfiler        *profiler);
+void    ufo_filter_coefficients_release (cl_mem              mem);
+
+#endif
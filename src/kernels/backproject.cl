@@ -30,7 +30,8 @@ backproject_nearest (global float *sinogram,
                      const unsigned int y_offset,
                      const unsigned int angle_offset,
                      const unsigned n_projections,
-                     const float axis_pos)
+                     const float axis_pos,
+                     const unsigned int sinogram_width)
 {
     const int idx = get_global_id(0);
     const int idy = get_global_id(1);
@@ -41,7 +42,10 @@ backproject_nearest (global float *sinogram,
 
     for(int proj = 0; proj < n_projections; proj++) {
         float h = axis_pos + bx * cos_lut[angle_offset + proj] + by * sin_lut[angle_offset + proj];
-        sum += sinogram[(int)(proj * width + h)];
+
+        /* Rays missing the detector contribute nothing, like with the texture sampler */
+        if (h >= 0.0f && h < sinogram_width)
+            sum += sinogram[proj * sinogram_width + (int) h];
     }
 
     slice[idy * width + idx] = sum * M_PI_F / n_projections;
@@ -78,3 +82,138 @@ backproject_tex (read_only image2d_t sinogram,
     slice[idy * get_global_size(0) + idx] = sum * M_PI_F / n_projections;
 }
 
+
+/* Number of slices reconstructed by a single work item of the batch kernels,
+ * must match BATCH_SLICES in ufo-backproject-task.c */
+#define BATCH_SLICES 4
+
+kernel void
+backproject_nearest_batch (global float *sinograms,
+                           global float *slices,
+                           constant float *sin_lut,
+                           constant float *cos_lut,
+                           const unsigned int x_offset,
+                           const unsigned int y_offset,
+                           const unsigned int angle_offset,
+                           const unsigned int n_projections,
+                           const float axis_pos,
+                           const unsigned int n_slices,
+                           const unsigned int sinogram_width)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int idz = get_global_id(2) * BATCH_SLICES;
+    const int width = get_global_size(0);
+    const int height = get_global_size(1);
+    const int n = min (BATCH_SLICES, (int) n_slices - idz);
+    const float bx = idx - axis_pos + x_offset + 0.5f;
+    const float by = idy - axis_pos + y_offset + 0.5f;
+    const int sinogram_size = n_projections * sinogram_width;
+    float sum[BATCH_SLICES] = {0.0f};
+
+    for(int proj = 0; proj < n_projections; proj++) {
+        float h = axis_pos + bx * cos_lut[angle_offset + proj] + by * sin_lut[angle_offset + proj];
+        int index = idz * sinogram_size + proj * sinogram_width + (int) h;
+
+        if (h < 0.0f || h >= sinogram_width)
+            continue;
+
+        for (int s = 0; s < BATCH_SLICES; s++) {
+            if (s < n)
+                sum[s] += sinograms[index + s * sinogram_size];
+        }
+    }
+
+    for (int s = 0; s < n; s++)
+        slices[((idz + s) * height + idy) * width + idx] = sum[s] * M_PI_F / n_projections;
+}
+
+kernel void
+backproject_tex_batch (read_only image3d_t sinograms,
+                       global float *slices,
+                       constant float *sin_lut,
+                       constant float *cos_lut,
+                       const unsigned int x_offset,
+                       const unsigned int y_offset,
+                       const unsigned int angle_offset,
+                       const unsigned int n_projections,
+                       const float axis_pos,
+                       const unsigned int n_slices)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int idz = get_global_id(2) * BATCH_SLICES;
+    const int width = get_global_size(0);
+    const int height = get_global_size(1);
+    const float bx = idx - axis_pos + x_offset + 0.5f;
+    const float by = idy - axis_pos + y_offset + 0.5f;
+    float sum[BATCH_SLICES] = {0.0f};
+
+    for(int proj = 0; proj < n_projections; proj++) {
+        float h = by * sin_lut[angle_offset + proj] + bx * cos_lut[angle_offset + proj] + axis_pos;
+
+        /* Slices beyond n_slices are clamped to zero by the sampler */
+        for (int s = 0; s < BATCH_SLICES; s++)
+            sum[s] += read_imagef (sinograms, volumeSampler, (float4)(h, proj + 0.5f, idz + s + 0.5f, 0.0f)).x;
+    }
+
+    for (int s = 0; s < min (BATCH_SLICES, (int) n_slices - idz); s++)
+        slices[((idz + s) * height + idy) * width + idx] = sum[s] * M_PI_F / n_projections;
+}
+
+kernel void
+backproject_nearest_stream (global float *projection,
+                            global float *slices,
+                            constant float *sin_lut,
+                            constant float *cos_lut,
+                            const unsigned int x_offset,
+                            const unsigned int y_offset,
+                            const unsigned int angle_index,
+                            const float axis_pos,
+                            const unsigned int n_slices,
+                            const float scale,
+                            const unsigned int projection_width)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int idz = get_global_id(2) * BATCH_SLICES;
+    const int width = get_global_size(0);
+    const int height = get_global_size(1);
+    const int n = min (BATCH_SLICES, (int) n_slices - idz);
+    const float bx = idx - axis_pos + x_offset + 0.5f;
+    const float by = idy - axis_pos + y_offset + 0.5f;
+    const float h = axis_pos + bx * cos_lut[angle_index] + by * sin_lut[angle_index];
+
+    if (h < 0.0f || h >= projection_width)
+        return;
+
+    /* Row idz + s of the projection is the sinogram row of slice idz + s */
+    for (int s = 0; s < n; s++)
+        slices[((idz + s) * height + idy) * width + idx] += projection[(idz + s) * projection_width + (int) h] * scale;
+}
+
+kernel void
+backproject_tex_stream (read_only image2d_t projection,
+                        global float *slices,
+                        constant float *sin_lut,
+                        constant float *cos_lut,
+                        const unsigned int x_offset,
+                        const unsigned int y_offset,
+                        const unsigned int angle_index,
+                        const float axis_pos,
+                        const unsigned int n_slices,
+                        const float scale)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int idz = get_global_id(2) * BATCH_SLICES;
+    const int width = get_global_size(0);
+    const int height = get_global_size(1);
+    const int n = min (BATCH_SLICES, (int) n_slices - idz);
+    const float bx = idx - axis_pos + x_offset + 0.5f;
+    const float by = idy - axis_pos + y_offset + 0.5f;
+    const float h = by * sin_lut[angle_index] + bx * cos_lut[angle_index] + axis_pos;
+
+    for (int s = 0; s < n; s++)
+        slices[((idz + s) * height + idy) * width + idx] += read_imagef (projection, volumeSampler, (float2)(h, idz + s + 0.5f)).x * scale;
+}
@@ -71,6 +71,55 @@ fft_pack (global float *in,
             = in[idz*stride_y_in + idy*stride_x_in + idx*2] * scale;
 }
 
+kernel void
+fft_pack_image (global float *in,
+                write_only image2d_t out,
+                const int width,
+                const float scale)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int stride_x_in = get_global_size(0) * 2;
+
+    if (idx < width)
+        write_imagef (out, (int2) (idx, idy), (float4) (in[idy*stride_x_in + idx*2] * scale, 0.0f, 0.0f, 0.0f));
+}
+
+kernel void
+fft_pad_real (global float *out,
+              global float *in,
+              const int width,
+              const int height)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int idz = get_global_id(2);
+    const int len_x = get_global_size(0);
+    const int len_y = get_global_size(1);
+
+    if ((idy >= height) || (idx >= width))
+        out[idz*len_x*len_y + idy*len_x + idx] = 0.0f;
+    else
+        out[idz*len_x*len_y + idy*len_x + idx] = in[idz*width*height + idy*width + idx];
+}
+
+kernel void
+fft_pack_real (global float *in,
+               global float *out,
+               const int width,
+               const int height,
+               const float scale)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int idz = get_global_id(2);
+    const int len_x = get_global_size(0);
+    const int len_y = get_global_size(1);
+
+    if (idx < width && idy < height)
+        out[idz*width*height + idy*width + idx] = in[idz*len_x*len_y + idy*len_x + idx] * scale;
+}
+
 kernel void
 fft_normalize (global float *data)
 {
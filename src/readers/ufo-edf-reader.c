@@ -66,7 +66,10 @@ ufo_edf_reader_open (UfoReader *reader,
 
     fseek (priv->fp, 0L, SEEK_END);
     priv->size = (gsize) ftell (priv->fp);
-    fseek (priv->fp, 0L, SEEK_SET);
+
+    /* An EDF file holds a single frame, there is nothing after it */
+    if (start == 0)
+        fseek (priv->fp, 0L, SEEK_SET);
 }
 
 static void
@@ -17,11 +17,16 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "common/hdf5.h"
 #include "readers/ufo-reader.h"
 #include "readers/ufo-hdf5-reader.h"
 
 
+#define MAX_STAGING_SIZE        (256 * 1024 * 1024)
+#define MAX_CHUNK_CACHE_SIZE    (256 * 1024 * 1024)
+
 struct _UfoHdf5ReaderPrivate {
     hid_t file_id;
     hid_t dataset_id;
@@ -30,6 +35,16 @@ struct _UfoHdf5ReaderPrivate {
     gint n_dims;
     hsize_t dims[3];
     guint current;
+
+    gfloat *staging;
+    gsize staging_size;
+    hsize_t batch;
+    hsize_t chunk_frames;
+    hsize_t staged_first;
+    hsize_t staged_count;
+    guint staged_roi_y;
+    guint staged_roi_step;
+    gsize staged_rows;
 };
 
 static void ufo_reader_interface_init (UfoReaderIface *iface);
@@ -53,6 +68,20 @@ ufo_hdf5_reader_can_open (UfoReader *reader,
     return ufo_hdf5_can_open (filename);
 }
 
+static gsize
+next_prime (gsize n)
+{
+    for (;; n++) {
+        gboolean prime = n > 1;
+
+        for (gsize d = 2; d * d <= n && prime; d++)
+            prime = n % d != 0;
+
+        if (prime)
+            return n;
+    }
+}
+
 static void
 ufo_hdf5_reader_open (UfoReader *reader,
                       const gchar *filename,
@@ -62,6 +91,7 @@ ufo_hdf5_reader_open (UfoReader *reader,
     gchar *h5_filename;
     gchar *h5_dataset;
     gchar **components;
+    hid_t create_plist_id;
 
     priv = UFO_HDF5_READER_GET_PRIVATE (reader);
     components = g_strsplit (filename, ":", 2);
@@ -74,7 +104,7 @@ ufo_hdf5_reader_open (UfoReader *reader,
     h5_filename = components[0];
     h5_dataset = components[1];
 
-    priv->file_id = H5Fopen (h5_filename, H5F_ACC_RDWR, H5P_DEFAULT);
+    priv->file_id = H5Fopen (h5_filename, H5F_ACC_RDONLY, H5P_DEFAULT);
     priv->dataset_id = H5Dopen (priv->file_id, h5_dataset, H5P_DEFAULT);
     priv->src_dataspace_id = H5Dget_space (priv->dataset_id);
     priv->n_dims = H5Sget_simple_extent_ndims (priv->src_dataspace_id);
@@ -84,6 +114,53 @@ ufo_hdf5_reader_open (UfoReader *reader,
 
     H5Sget_simple_extent_dims (priv->src_dataspace_id, priv->dims, NULL);
 
+    create_plist_id = H5Dget_create_plist (priv->dataset_id);
+    priv->batch = 1;
+    priv->chunk_frames = 1;
+
+    if (priv->n_dims == 3 && H5Pget_layout (create_plist_id) == H5D_CHUNKED) {
+        hsize_t chunk_dims[3];
+        hsize_t n_chunks;
+        gsize cache_size;
+        hid_t access_plist_id;
+        hid_t type_id;
+
+        H5Pget_chunk (create_plist_id, 3, chunk_dims);
+
+        /*
+         * Read as many frames at once as a chunk spans and make the chunk
+         * cache large enough to hold one layer of chunks, so that each chunk
+         * is decompressed only once. Slabs start at chunk boundaries to never
+         * straddle two layers. The staging buffer and the chunk cache are
+         * bounded, chunks of a layer that do not fit are decompressed again.
+         */
+        priv->chunk_frames = chunk_dims[0];
+        priv->batch = CLAMP (MAX_STAGING_SIZE / (priv->dims[1] * priv->dims[2] * sizeof (gfloat)), 1, chunk_dims[0]);
+        n_chunks = ((priv->dims[1] + chunk_dims[1] - 1) / chunk_dims[1]) *
+                   ((priv->dims[2] + chunk_dims[2] - 1) / chunk_dims[2]);
+
+        type_id = H5Dget_type (priv->dataset_id);
+        cache_size = MIN (n_chunks * chunk_dims[0] * chunk_dims[1] * chunk_dims[2] * H5Tget_size (type_id),
+                          MAX_CHUNK_CACHE_SIZE);
+        H5Tclose (type_id);
+
+        access_plist_id = H5Pcreate (H5P_DATASET_ACCESS);
+        H5Pset_chunk_cache (access_plist_id, next_prime (100 * n_chunks), cache_size, 1.0);
+
+        /* The chunk cache can only be configured when opening */
+        H5Sclose (priv->src_dataspace_id);
+        H5Dclose (priv->dataset_id);
+        priv->dataset_id = H5Dopen (priv->file_id, h5_dataset, access_plist_id);
+        priv->src_dataspace_id = H5Dget_space (priv->dataset_id);
+        H5Pclose (access_plist_id);
+    }
+
+    H5Pclose (create_plist_id);
+
+    g_free (priv->staging);
+    priv->staging = NULL;
+    priv->staging_size = 0;
+    priv->staged_count = 0;
     priv->current = start;
     g_strfreev (components);
 }
@@ -98,6 +175,11 @@ ufo_hdf5_reader_close (UfoReader *reader)
     H5Sclose (priv->src_dataspace_id);
     H5Dclose (priv->dataset_id);
     H5Fclose (priv->file_id);
+
+    g_free (priv->staging);
+    priv->staging = NULL;
+    priv->staging_size = 0;
+    priv->staged_count = 0;
 }
 
 static gboolean
@@ -110,6 +192,58 @@ ufo_hdf5_reader_data_available (UfoReader *reader)
     return priv->current < priv->dims[0];
 }
 
+static void
+read_frames (UfoHdf5ReaderPrivate *priv,
+             hsize_t first,
+             hsize_t count,
+             gsize width,
+             gsize n_rows,
+             guint roi_y,
+             guint roi_step,
+             gpointer data)
+{
+    hid_t dst_dataspace_id;
+    hsize_t offset[3] = { first, roi_y, 0 };
+    hsize_t stride[3] = { 1, roi_step, 1 };
+    hsize_t dst_dims[3] = { count, n_rows, width };
+
+    dst_dataspace_id = H5Screate_simple (3, dst_dims, NULL);
+    H5Sselect_hyperslab (priv->src_dataspace_id, H5S_SELECT_SET, offset, stride, dst_dims, NULL);
+    H5Dread (priv->dataset_id, H5T_NATIVE_FLOAT, dst_dataspace_id, priv->src_dataspace_id, H5P_DEFAULT, data);
+    H5Sclose (dst_dataspace_id);
+}
+
+static void
+stage_frames (UfoHdf5ReaderPrivate *priv,
+              gsize width,
+              gsize n_rows,
+              guint roi_y,
+              guint roi_step)
+{
+    hsize_t layer;
+    hsize_t first;
+    hsize_t count;
+
+    /* Start at the chunk layer boundary or the batch boundary within it */
+    layer = priv->current - priv->current % priv->chunk_frames;
+    first = layer + (priv->current - layer) / priv->batch * priv->batch;
+    count = MIN (MIN (priv->batch, layer + priv->chunk_frames - first), priv->dims[0] - first);
+
+    if (priv->batch * n_rows * width * sizeof (gfloat) > priv->staging_size) {
+        priv->staging_size = priv->batch * n_rows * width * sizeof (gfloat);
+        g_free (priv->staging);
+        priv->staging = g_malloc (priv->staging_size);
+    }
+
+    read_frames (priv, first, count, width, n_rows, roi_y, roi_step, priv->staging);
+
+    priv->staged_first = first;
+    priv->staged_count = count;
+    priv->staged_rows = n_rows;
+    priv->staged_roi_y = roi_y;
+    priv->staged_roi_step = roi_step;
+}
+
 static void
 ufo_hdf5_reader_read (UfoReader *reader,
                       UfoBuffer *buffer,
@@ -120,23 +254,29 @@ ufo_hdf5_reader_read (UfoReader *reader,
 {
     UfoHdf5ReaderPrivate *priv;
     gpointer data;
-    hid_t dst_dataspace_id;
-    hsize_t dst_dims[2];
+    gsize width;
+    gsize n_rows;
+    gsize frame_size;
 
     priv = UFO_HDF5_READER_GET_PRIVATE (reader);
     data = ufo_buffer_get_host_array (buffer, NULL);
+    width = requisition->dims[0];
+    n_rows = requisition->dims[1];
+    frame_size = width * n_rows;
+
+    if (priv->batch == 1) {
+        /* Nothing to share between frames, skip the staging copy */
+        read_frames (priv, priv->current, 1, width, n_rows, roi_y, roi_step, data);
+        priv->current++;
+        return;
+    }
 
-    hsize_t offset[3] = { priv->current, roi_y, 0 };
-    hsize_t count[3] = { 1, roi_height, requisition->dims[0] };
-
-    dst_dims[0] = roi_height;
-    dst_dims[1] = requisition->dims[0];
-    dst_dataspace_id = H5Screate_simple (2, dst_dims, NULL);
-
-    H5Sselect_hyperslab (priv->src_dataspace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
-    H5Dread (priv->dataset_id, H5T_NATIVE_FLOAT, dst_dataspace_id, priv->src_dataspace_id, H5P_DEFAULT, data);
-    H5Sclose (dst_dataspace_id);
+    if (priv->current < priv->staged_first ||
+        priv->current >= priv->staged_first + priv->staged_count ||
+        roi_y != priv->staged_roi_y || roi_step != priv->staged_roi_step || n_rows != priv->staged_rows)
+        stage_frames (priv, width, n_rows, roi_y, roi_step);
 
+    memcpy (data, priv->staging + (priv->current - priv->staged_first) * frame_size, frame_size * sizeof (gfloat));
     priv->current++;
 }
 
@@ -166,14 +306,40 @@ ufo_reader_interface_init (UfoReaderIface *iface)
     iface->data_available = ufo_hdf5_reader_data_available;
 }
 
+static void
+ufo_hdf5_reader_finalize (GObject *object)
+{
+    UfoHdf5ReaderPrivate *priv;
+
+    priv = UFO_HDF5_READER_GET_PRIVATE (object);
+    g_free (priv->staging);
+    priv->staging = NULL;
+    priv->staging_size = 0;
+
+    G_OBJECT_CLASS (ufo_hdf5_reader_parent_class)->finalize (object);
+}
+
 static void
 ufo_hdf5_reader_class_init(UfoHdf5ReaderClass *klass)
 {
-    g_type_class_add_private (G_OBJECT_CLASS (klass), sizeof (UfoHdf5ReaderPrivate));
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    gobject_class->finalize = ufo_hdf5_reader_finalize;
+
+    g_type_class_add_private (gobject_class, sizeof (UfoHdf5ReaderPrivate));
 }
 
 static void
 ufo_hdf5_reader_init (UfoHdf5Reader *self)
 {
-    self->priv = UFO_HDF5_READER_GET_PRIVATE (self);
+    UfoHdf5ReaderPrivate *priv = NULL;
+
+    self->priv = priv = UFO_HDF5_READER_GET_PRIVATE (self);
+    priv->staging = NULL;
+    priv->staging_size = 0;
+    priv->batch = 1;
+    priv->chunk_frames = 1;
+    priv->staged_first = 0;
+    priv->staged_count = 0;
+    priv->staged_rows = 0;
 }
@@ -17,8 +17,15 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "readers/ufo-reader.h"
 #include "readers/ufo-raw-reader.h"
@@ -34,6 +41,10 @@ struct _UfoRawReaderPrivate {
     gulong pre_offset;
     gulong post_offset;
     UfoBufferDepth bitdepth;
+    gboolean use_mmap;
+    gchar *map;
+    gsize map_pos;
+    gboolean advised;
 };
 
 static void ufo_reader_interface_init (UfoReaderIface *iface);
@@ -51,6 +62,7 @@ enum {
     PROP_BITDEPTH,
     PROP_PRE_OFFSET,
     PROP_POST_OFFSET,
+    PROP_MMAP,
     N_PROPERTIES
 };
 
@@ -82,6 +94,70 @@ ufo_raw_reader_can_open (UfoReader *reader,
     return TRUE;
 }
 
+static gsize
+page_size (void)
+{
+    static gsize size = 0;
+
+    if (size == 0)
+        size = (gsize) sysconf (_SC_PAGESIZE);
+
+    return size;
+}
+
+static void
+advise_range (UfoRawReaderPrivate *priv, gsize offset, gsize length, int advice)
+{
+    gsize aligned;
+
+    if (offset >= priv->total_size)
+        return;
+
+    /* posix_madvise wants page-aligned addresses */
+    aligned = offset - (offset % page_size ());
+    length = MIN (length + offset - aligned, priv->total_size - aligned);
+
+    if (length > 0)
+        posix_madvise (priv->map + aligned, length, advice);
+}
+
+static gboolean
+open_mmap (UfoRawReaderPrivate *priv, const gchar *filename, guint start)
+{
+    struct stat st;
+    gint fd;
+    gpointer map;
+
+    fd = open (filename, O_RDONLY);
+
+    if (fd < 0)
+        return FALSE;
+
+    if (fstat (fd, &st) < 0 || st.st_size == 0) {
+        close (fd);
+        return FALSE;
+    }
+
+    map = mmap (NULL, (gsize) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    /* The mapping keeps its own reference to the file */
+    close (fd);
+
+    if (map == MAP_FAILED) {
+        g_warning ("Could not map `%s', falling back to buffered reads", filename);
+        return FALSE;
+    }
+
+    priv->map = map;
+    priv->total_size = (gsize) st.st_size;
+    priv->map_pos = start * priv->frame_size;
+    priv->advised = FALSE;
+
+    /* Start paging in the first frame while the rest of the pipeline is set up */
+    advise_range (priv, priv->map_pos, priv->pre_offset + priv->frame_size, POSIX_MADV_WILLNEED);
+    return TRUE;
+}
+
 static void
 ufo_raw_reader_open (UfoReader *reader,
                      const gchar *filename,
@@ -90,11 +166,15 @@ ufo_raw_reader_open (UfoReader *reader,
     UfoRawReaderPrivate *priv;
 
     priv = UFO_RAW_READER_GET_PRIVATE (reader);
+    priv->frame_size = priv->width * priv->height * priv->bytes_per_pixel;
+
+    if (priv->use_mmap && open_mmap (priv, filename, start))
+        return;
+
     priv->fp = fopen (filename, "rb");
 
     fseek (priv->fp, 0L, SEEK_END);
     priv->total_size = (gsize) ftell (priv->fp);
-    priv->frame_size = priv->width * priv->height * priv->bytes_per_pixel;
     fseek (priv->fp, start * priv->frame_size, SEEK_SET);
 }
 
@@ -104,9 +184,18 @@ ufo_raw_reader_close (UfoReader *reader)
     UfoRawReaderPrivate *priv;
 
     priv = UFO_RAW_READER_GET_PRIVATE (reader);
-    g_assert (priv->fp != NULL);
-    fclose (priv->fp);
-    priv->fp = NULL;
+
+    if (priv->map != NULL) {
+        munmap (priv->map, priv->total_size);
+        priv->map = NULL;
+        priv->map_pos = 0;
+    }
+    else {
+        g_assert (priv->fp != NULL);
+        fclose (priv->fp);
+        priv->fp = NULL;
+    }
+
     priv->total_size = 0;
 }
 
@@ -117,10 +206,67 @@ ufo_raw_reader_data_available (UfoReader *reader)
     glong pos;
 
     priv = UFO_RAW_READER_GET_PRIVATE (reader);
+
+    if (priv->map != NULL)
+        return priv->map_pos + priv->pre_offset + priv->frame_size <= priv->total_size;
+
     pos = ftell (priv->fp);
     return priv->fp != NULL && pos >= 0 && (((gulong) pos) + priv->pre_offset + priv->frame_size) <= priv->total_size;
 }
 
+static void
+read_mmap (UfoRawReaderPrivate *priv,
+           gchar *data,
+           UfoRequisition *requisition,
+           guint roi_y,
+           guint roi_height,
+           guint roi_step)
+{
+    const gchar *frame;
+    gsize row_size;
+    gsize n_rows;
+    gsize next;
+
+    row_size = priv->width * priv->bytes_per_pixel;
+    n_rows = MIN (requisition->dims[1], priv->height);
+    frame = priv->map + priv->map_pos + priv->pre_offset;
+
+    if (!priv->advised) {
+        /*
+         * Sparse rows are better served by page-sized faults than by the
+         * kernel's read-ahead which would pull in all the skipped rows.
+         */
+        posix_madvise (priv->map, priv->total_size,
+                       roi_step > 1 && row_size * roi_step > 2 * page_size () ?
+                       POSIX_MADV_RANDOM : POSIX_MADV_SEQUENTIAL);
+        priv->advised = TRUE;
+    }
+
+    if (roi_y == 0 && roi_step == 1 && n_rows == priv->height) {
+        memcpy (data, frame, priv->frame_size);
+    }
+    else {
+        for (gsize i = 0; i < n_rows; i++)
+            memcpy (data + i * row_size, frame + (roi_y + i * roi_step) * row_size, row_size);
+    }
+
+    /* Drop the consumed frame from our mapping, it stays in the page cache */
+    advise_range (priv, priv->map_pos, priv->pre_offset + priv->frame_size, POSIX_MADV_DONTNEED);
+
+    priv->map_pos += priv->pre_offset + priv->frame_size + priv->post_offset;
+
+    /* Prefetch only the rows of the next frame that we are going to touch */
+    next = priv->map_pos + priv->pre_offset + roi_y * row_size;
+
+    if (roi_step == 1 || row_size * roi_step <= 2 * page_size ()) {
+        advise_range (priv, next, roi_height * row_size, POSIX_MADV_WILLNEED);
+    }
+    else {
+        for (gsize i = 0; i < n_rows; i++)
+            advise_range (priv, next + i * roi_step * row_size, row_size, POSIX_MADV_WILLNEED);
+    }
+}
+
 static void
 ufo_raw_reader_read (UfoReader *reader,
                      UfoBuffer *buffer,
@@ -135,6 +281,11 @@ ufo_raw_reader_read (UfoReader *reader,
     priv = UFO_RAW_READER_GET_PRIVATE (reader);
     data = (gchar *) ufo_buffer_get_host_array (buffer, NULL);
 
+    if (priv->map != NULL) {
+        read_mmap (priv, data, requisition, roi_y, roi_height, roi_step);
+        return;
+    }
+
     fseek (priv->fp, priv->pre_offset, SEEK_CUR);
 
     /* We never read more than we can store */
@@ -197,6 +348,9 @@ ufo_raw_reader_set_property (GObject *object,
         case PROP_POST_OFFSET:
             priv->post_offset = g_value_get_ulong (value);
             break;
+        case PROP_MMAP:
+            priv->use_mmap = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -219,7 +373,7 @@ ufo_raw_reader_get_property (GObject *object,
             g_value_set_uint (value, priv->height);
             break;
         case PROP_BITDEPTH:
-            g_value_set_uint (value, priv->bitdepth);
+            g_value_set_uint (value, priv->bytes_per_pixel * 8);
             break;
         case PROP_PRE_OFFSET:
             g_value_set_ulong (value, priv->pre_offset);
@@ -227,6 +381,9 @@ ufo_raw_reader_get_property (GObject *object,
         case PROP_POST_OFFSET:
             g_value_set_ulong (value, priv->post_offset);
             break;
+        case PROP_MMAP:
+            g_value_set_boolean (value, priv->use_mmap);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -245,6 +402,11 @@ ufo_raw_reader_finalize (GObject *object)
         priv->fp = NULL;
     }
 
+    if (priv->map != NULL) {
+        munmap (priv->map, priv->total_size);
+        priv->map = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_raw_reader_parent_class)->finalize (object);
 }
 
@@ -303,6 +465,13 @@ ufo_raw_reader_class_init (UfoRawReaderClass *klass)
             0, G_MAXULONG, 0,
             G_PARAM_READWRITE);
 
+    properties[PROP_MMAP] =
+        g_param_spec_boolean("mmap",
+            "Map the file instead of reading it",
+            "Map the file instead of reading it",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -321,4 +490,8 @@ ufo_raw_reader_init (UfoRawReader *self)
     priv->bitdepth = UFO_BUFFER_DEPTH_INVALID;
     priv->pre_offset = 0L;
     priv->post_offset = 0L;
+    priv->use_mmap = FALSE;
+    priv->map = NULL;
+    priv->map_pos = 0;
+    priv->advised = FALSE;
 }
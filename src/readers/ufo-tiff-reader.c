@@ -17,17 +17,43 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <tiffio.h>
 
 #include "readers/ufo-reader.h"
 #include "readers/ufo-tiff-reader.h"
 
 
+typedef struct {
+    GArray  *offsets;
+    gint64   mtime;
+    gint64   size;
+    guint    ref_count;
+} IfdIndex;
+
 struct _UfoTiffReaderPrivate {
-    TIFF    *tiff;
-    gboolean more;
+    TIFF     *tiff;
+    gboolean  more;
+    gchar    *cache;
+    gsize     cache_size;
+    IfdIndex *index;
+    guint     n_indexed;
+    guint     directory;
 };
 
+/*
+ * Directory offsets of every multi-page file we have seen so far, keyed by the
+ * canonical path. They are shared among all reader instances of the process so
+ * that only the first open has to walk the IFD chain, opening at a start frame
+ * jumps there directly. Readers hold a reference on the index they use, and the
+ * table goes away with the last reader.
+ */
+G_LOCK_DEFINE_STATIC (indices);
+static GHashTable *indices = NULL;
+static guint n_readers = 0;
+
 static void ufo_reader_interface_init (UfoReaderIface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (UfoTiffReader, ufo_tiff_reader, G_TYPE_OBJECT,
@@ -50,6 +76,124 @@ ufo_tiff_reader_can_open (UfoReader *reader,
     return g_str_has_suffix (filename, ".tiff") || g_str_has_suffix (filename, ".tif");
 }
 
+/* Must be called with the indices lock held */
+static void
+unref_index (IfdIndex *index)
+{
+    if (--index->ref_count > 0)
+        return;
+
+    g_array_free (index->offsets, TRUE);
+    g_free (index);
+}
+
+static IfdIndex *
+get_index (const gchar *filename)
+{
+    IfdIndex *index;
+    struct stat st;
+    gchar *path;
+
+    if (stat (filename, &st) < 0)
+        return NULL;
+
+    path = realpath (filename, NULL);
+
+    if (path == NULL)
+        return NULL;
+
+    G_LOCK (indices);
+
+    if (indices == NULL)
+        indices = g_hash_table_new_full (g_str_hash, g_str_equal, free, (GDestroyNotify) unref_index);
+
+    index = g_hash_table_lookup (indices, path);
+
+    if (index == NULL || index->mtime != (gint64) st.st_mtime || index->size != (gint64) st.st_size) {
+        /* Readers still using an outdated index keep their own reference */
+        index = g_new0 (IfdIndex, 1);
+        index->offsets = g_array_new (FALSE, FALSE, sizeof (guint64));
+        index->mtime = (gint64) st.st_mtime;
+        index->size = (gint64) st.st_size;
+        index->ref_count = 1;
+        g_hash_table_replace (indices, path, index);
+    }
+    else {
+        free (path);
+    }
+
+    index->ref_count++;
+    G_UNLOCK (indices);
+    return index;
+}
+
+static void
+release_index (UfoTiffReaderPrivate *priv)
+{
+    if (priv->index == NULL)
+        return;
+
+    G_LOCK (indices);
+    unref_index (priv->index);
+    G_UNLOCK (indices);
+    priv->index = NULL;
+}
+
+static void
+record_directory (UfoTiffReaderPrivate *priv)
+{
+    guint64 offset;
+
+    /* Offsets are only appended, known ones need no lock */
+    if (priv->index == NULL || priv->directory < priv->n_indexed)
+        return;
+
+    offset = (guint64) TIFFCurrentDirOffset (priv->tiff);
+
+    G_LOCK (indices);
+
+    if (priv->index->offsets->len == priv->directory)
+        g_array_append_val (priv->index->offsets, offset);
+
+    priv->n_indexed = priv->index->offsets->len;
+    G_UNLOCK (indices);
+}
+
+static void
+next_directory (UfoTiffReaderPrivate *priv)
+{
+    priv->more = TIFFReadDirectory (priv->tiff) == 1;
+
+    if (priv->more) {
+        priv->directory++;
+        record_directory (priv);
+    }
+}
+
+static void
+seek_directory (UfoTiffReaderPrivate *priv, guint directory)
+{
+    guint64 offset = 0;
+    guint n_known = 0;
+
+    if (priv->index != NULL) {
+        G_LOCK (indices);
+        n_known = priv->n_indexed = priv->index->offsets->len;
+
+        if (n_known > 0)
+            offset = g_array_index (priv->index->offsets, guint64, MIN (directory, n_known - 1));
+
+        G_UNLOCK (indices);
+    }
+
+    /* Jump as far as the index reaches and walk the rest of the chain */
+    if (n_known > 0 && TIFFSetSubDirectory (priv->tiff, offset) == 1)
+        priv->directory = MIN (directory, n_known - 1);
+
+    while (priv->more && priv->directory < directory)
+        next_directory (priv);
+}
+
 static void
 ufo_tiff_reader_open (UfoReader *reader,
                       const gchar *filename,
@@ -60,9 +204,14 @@ ufo_tiff_reader_open (UfoReader *reader,
     priv = UFO_TIFF_READER_GET_PRIVATE (reader);
     priv->tiff = TIFFOpen (filename, "r");
     priv->more = TRUE;
-
-    for (guint i = 0; i < start; i++)
-        priv->more = TIFFReadDirectory (priv->tiff) == 1;
+    priv->directory = 0;
+    priv->n_indexed = 0;
+    release_index (priv);
+    priv->index = get_index (filename);
+    record_directory (priv);
+
+    if (start > 0)
+        seek_directory (priv, start);
 }
 
 static void
@@ -74,6 +223,7 @@ ufo_tiff_reader_close (UfoReader *reader)
     g_assert (priv->tiff != NULL);
     TIFFClose (priv->tiff);
     priv->tiff = NULL;
+    release_index (priv);
 }
 
 static gboolean
@@ -86,6 +236,141 @@ ufo_tiff_reader_data_available (UfoReader *reader)
     return priv->more && priv->tiff != NULL;
 }
 
+static gchar *
+get_cache (UfoTiffReaderPrivate *priv, gsize size)
+{
+    if (size > priv->cache_size) {
+        g_free (priv->cache);
+        priv->cache = g_malloc (size);
+        priv->cache_size = size;
+    }
+
+    return priv->cache;
+}
+
+static gboolean
+read_scanlines (UfoTiffReaderPrivate *priv,
+                gchar *data,
+                gsize row_size,
+                guint roi_y,
+                guint roi_height,
+                guint roi_step)
+{
+    gsize offset = 0;
+
+    for (guint i = roi_y; i < roi_y + roi_height; i += roi_step) {
+        if (TIFFReadScanline (priv->tiff, data + offset, i, 0) == -1)
+            return FALSE;
+
+        offset += row_size;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+read_strips (UfoTiffReaderPrivate *priv,
+             gchar *data,
+             gsize row_size,
+             guint roi_y,
+             guint roi_height,
+             guint roi_step)
+{
+    guint32 rows_per_strip;
+    tmsize_t strip_size;
+    tstrip_t current;
+    gsize scanline_size;
+    gchar *strip;
+    gsize offset = 0;
+
+    if (!TIFFGetFieldDefaulted (priv->tiff, TIFFTAG_ROWSPERSTRIP, &rows_per_strip))
+        return FALSE;
+
+    strip_size = TIFFStripSize (priv->tiff);
+    scanline_size = (gsize) TIFFScanlineSize (priv->tiff);
+    strip = get_cache (priv, (gsize) strip_size);
+    current = (tstrip_t) -1;
+
+    /*
+     * Each strip is decoded once no matter how many of its rows we need and
+     * strips without any row of the ROI are never touched.
+     */
+    for (guint i = roi_y; i < roi_y + roi_height; i += roi_step) {
+        tstrip_t index = TIFFComputeStrip (priv->tiff, i, 0);
+
+        if (index != current) {
+            if (TIFFReadEncodedStrip (priv->tiff, index, strip, -1) == -1)
+                return FALSE;
+
+            current = index;
+        }
+
+        memcpy (data + offset, strip + (i - index * rows_per_strip) * scanline_size, row_size);
+        offset += row_size;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+read_tiles (UfoTiffReaderPrivate *priv,
+            gchar *data,
+            gsize row_size,
+            guint width,
+            guint bits,
+            guint roi_y,
+            guint roi_height,
+            guint roi_step)
+{
+    guint32 tile_width;
+    guint32 tile_height;
+    gsize tile_size;
+    gsize tile_row_size;
+    guint n_tiles_x;
+    guint band_y;
+    gchar *band;
+    gsize offset = 0;
+
+    TIFFGetField (priv->tiff, TIFFTAG_TILEWIDTH, &tile_width);
+    TIFFGetField (priv->tiff, TIFFTAG_TILELENGTH, &tile_height);
+
+    tile_size = (gsize) TIFFTileSize (priv->tiff);
+    tile_row_size = (gsize) TIFFTileRowSize (priv->tiff);
+    n_tiles_x = (width + tile_width - 1) / tile_width;
+
+    /* Holds one decoded row of tiles */
+    band = get_cache (priv, n_tiles_x * tile_size);
+    band_y = G_MAXUINT;
+
+    for (guint i = roi_y; i < roi_y + roi_height; i += roi_step) {
+        guint y = i - i % tile_height;
+
+        if (y != band_y) {
+            for (guint t = 0; t < n_tiles_x; t++) {
+                ttile_t index = TIFFComputeTile (priv->tiff, t * tile_width, y, 0, 0);
+
+                if (TIFFReadEncodedTile (priv->tiff, index, band + t * tile_size, -1) == -1)
+                    return FALSE;
+            }
+
+            band_y = y;
+        }
+
+        for (guint t = 0; t < n_tiles_x; t++) {
+            gsize x = t * tile_width;
+            gsize n_bytes = MIN (tile_width, width - x) * bits / 8;
+
+            memcpy (data + offset + x * bits / 8,
+                    band + t * tile_size + (i - y) * tile_row_size,
+                    n_bytes);
+        }
+
+        offset += row_size;
+    }
+
+    return TRUE;
+}
+
 static void
 ufo_tiff_reader_read (UfoReader *reader,
                       UfoBuffer *buffer,
@@ -96,30 +381,29 @@ ufo_tiff_reader_read (UfoReader *reader,
 {
     UfoTiffReaderPrivate *priv;
     gchar *data;
-    tsize_t result;
-    gsize offset;
     guint16 bits;
+    guint16 planar_config;
     gsize step;
+    gboolean success;
 
     priv = UFO_TIFF_READER_GET_PRIVATE (reader);
 
     TIFFGetField (priv->tiff, TIFFTAG_BITSPERSAMPLE, &bits);
+    TIFFGetFieldDefaulted (priv->tiff, TIFFTAG_PLANARCONFIG, &planar_config);
     step = requisition->dims[0] * bits / 8;
     data = (gchar *) ufo_buffer_get_host_array (buffer, NULL);
-    offset = 0;
 
-    for (guint i = roi_y; i < roi_y + roi_height; i += roi_step) {
-        result = TIFFReadScanline (priv->tiff, data + offset, i, 0);
+    if (planar_config != PLANARCONFIG_CONTIG)
+        success = read_scanlines (priv, data, step, roi_y, roi_height, roi_step);
+    else if (TIFFIsTiled (priv->tiff))
+        success = read_tiles (priv, data, step, requisition->dims[0], bits, roi_y, roi_height, roi_step);
+    else
+        success = read_strips (priv, data, step, roi_y, roi_height, roi_step);
 
-        if (result == -1) {
-            g_warning ("Cannot read scanline");
-            return;
-        }
+    if (!success)
+        g_warning ("Cannot read scanline");
 
-        offset += step;
-    }
-
-    priv->more = TIFFReadDirectory (priv->tiff) == 1;
+    next_directory (priv);
 }
 
 static void
@@ -165,6 +449,18 @@ ufo_tiff_reader_finalize (GObject *object)
     if (priv->tiff != NULL)
         ufo_tiff_reader_close (UFO_READER (object));
 
+    g_free (priv->cache);
+    priv->cache = NULL;
+
+    G_LOCK (indices);
+
+    if (--n_readers == 0 && indices != NULL) {
+        g_hash_table_destroy (indices);
+        indices = NULL;
+    }
+
+    G_UNLOCK (indices);
+
     G_OBJECT_CLASS (ufo_tiff_reader_parent_class)->finalize (object);
 }
 
@@ -197,5 +493,14 @@ ufo_tiff_reader_init (UfoTiffReader *self)
     self->priv = priv = UFO_TIFF_READER_GET_PRIVATE (self);
     priv->tiff = NULL;
     priv->more = FALSE;
+    priv->cache = NULL;
+    priv->cache_size = 0;
+    priv->index = NULL;
+    priv->n_indexed = 0;
+    priv->directory = 0;
     TIFFSetWarningHandler(NULL);
+
+    G_LOCK (indices);
+    n_readers++;
+    G_UNLOCK (indices);
 }
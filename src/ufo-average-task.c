@@ -18,21 +18,58 @@
  */
 
 #include <string.h>
+#include <math.h>
 #include <gmodule.h>
 
 #include "ufo-average-task.h"
 
 
+typedef enum {
+    PRECISION_SINGLE,
+    PRECISION_KAHAN,
+    PRECISION_DOUBLE
+} Precision;
+
+typedef enum {
+    STATISTIC_MEAN,
+    STATISTIC_VARIANCE,
+    STATISTIC_STD
+} Statistic;
+
+static GEnumValue precision_values[] = {
+    { PRECISION_SINGLE, "PRECISION_SINGLE", "single" },
+    { PRECISION_KAHAN,  "PRECISION_KAHAN",  "kahan" },
+    { PRECISION_DOUBLE, "PRECISION_DOUBLE", "double" },
+    { 0, NULL, NULL}
+};
+
+static GEnumValue statistic_values[] = {
+    { STATISTIC_MEAN,       "STATISTIC_MEAN",       "mean" },
+    { STATISTIC_VARIANCE,   "STATISTIC_VARIANCE",   "variance" },
+    { STATISTIC_STD,        "STATISTIC_STD",        "std" },
+    { 0, NULL, NULL}
+};
+
 struct _UfoAverageTaskPrivate {
     gfloat *averaged;
     gboolean is_data_averaged;
     guint counter;
     guint n_generate;
+    Precision precision;
+    Statistic statistic;
+    /* Kahan compensation of the sums kept in the output buffer */
+    gfloat *compensation;
+    /* sums in double precision or, for the variance, the running mean */
+    gdouble *sums;
+    /* sums of squared differences from the running mean */
+    gdouble *m2;
 };
 
 enum {
     PROP_0,
     PROP_NUM_GENERATE,
+    PROP_PRECISION,
+    PROP_STATISTIC,
     N_PROPERTIES
 };
 
@@ -71,8 +108,20 @@ ufo_average_task_get_requisition (UfoTask *task,
     ufo_buffer_get_requisition (inputs[0], requisition);
 
     if (priv->averaged == NULL) {
-        priv->averaged = g_malloc0 (requisition->dims[0] *
-                                    requisition->dims[1] * sizeof (gfloat));
+        gsize n_pixels = requisition->dims[0] * requisition->dims[1];
+
+        priv->averaged = g_malloc0 (n_pixels * sizeof (gfloat));
+
+        if (priv->statistic != STATISTIC_MEAN) {
+            priv->sums = g_malloc0 (n_pixels * sizeof (gdouble));
+            priv->m2 = g_malloc0 (n_pixels * sizeof (gdouble));
+        }
+        else if (priv->precision == PRECISION_KAHAN) {
+            priv->compensation = g_malloc0 (n_pixels * sizeof (gfloat));
+        }
+        else if (priv->precision == PRECISION_DOUBLE) {
+            priv->sums = g_malloc0 (n_pixels * sizeof (gdouble));
+        }
     }
 }
 
@@ -96,6 +145,83 @@ ufo_average_task_get_mode (UfoTask *task)
     return UFO_TASK_MODE_REDUCTOR | UFO_TASK_MODE_CPU;
 }
 
+/*
+ * The accumulation functions work on rows in parallel, the inner loops have no
+ * dependencies between pixels and are left to the compiler to vectorize.
+ */
+static void
+accumulate_single (gfloat *sums, const gfloat *in, gsize width, gsize height)
+{
+    gint y;
+
+#pragma omp parallel for
+    for (y = 0; y < (gint) height; y++) {
+        gfloat *restrict s = sums + y * width;
+        const gfloat *restrict x = in + y * width;
+
+        for (gsize i = 0; i < width; i++)
+            s[i] += x[i];
+    }
+}
+
+static void
+accumulate_kahan (gfloat *sums, gfloat *compensation, const gfloat *in, gsize width, gsize height)
+{
+    gint y;
+
+#pragma omp parallel for
+    for (y = 0; y < (gint) height; y++) {
+        gfloat *restrict s = sums + y * width;
+        gfloat *restrict c = compensation + y * width;
+        const gfloat *restrict x = in + y * width;
+
+        for (gsize i = 0; i < width; i++) {
+            const gfloat corrected = x[i] - c[i];
+            const gfloat t = s[i] + corrected;
+
+            /* What got lost by adding the small value to the large sum */
+            c[i] = (t - s[i]) - corrected;
+            s[i] = t;
+        }
+    }
+}
+
+static void
+accumulate_double (gdouble *sums, const gfloat *in, gsize width, gsize height)
+{
+    gint y;
+
+#pragma omp parallel for
+    for (y = 0; y < (gint) height; y++) {
+        gdouble *restrict s = sums + y * width;
+        const gfloat *restrict x = in + y * width;
+
+        for (gsize i = 0; i < width; i++)
+            s[i] += x[i];
+    }
+}
+
+static void
+accumulate_welford (gdouble *means, gdouble *m2, const gfloat *in, guint n, gsize width, gsize height)
+{
+    const gdouble scale = 1.0 / n;
+    gint y;
+
+#pragma omp parallel for
+    for (y = 0; y < (gint) height; y++) {
+        gdouble *restrict mean = means + y * width;
+        gdouble *restrict m = m2 + y * width;
+        const gfloat *restrict x = in + y * width;
+
+        for (gsize i = 0; i < width; i++) {
+            const gdouble delta = x[i] - mean[i];
+
+            mean[i] += delta * scale;
+            m[i] += delta * (x[i] - mean[i]);
+        }
+    }
+}
+
 static gboolean
 ufo_average_task_process (UfoTask *task,
                            UfoBuffer **inputs,
@@ -105,17 +231,24 @@ ufo_average_task_process (UfoTask *task,
     UfoAverageTaskPrivate *priv;
     gfloat *in_array;
     gfloat *out_array;
-    gsize n_pixels;
+    gsize width, height;
 
     priv = UFO_AVERAGE_TASK_GET_PRIVATE (UFO_AVERAGE_TASK (task));
-    n_pixels = requisition->dims[0] * requisition->dims[1];
+    width = requisition->dims[0];
+    height = requisition->dims[1];
     in_array = ufo_buffer_get_host_array (inputs[0], NULL);
     out_array = ufo_buffer_get_host_array (output, NULL);
+    priv->counter++;
 
-    for (gsize i = 0; i < n_pixels; i++)
-        out_array[i] += in_array[i];
+    if (priv->statistic != STATISTIC_MEAN)
+        accumulate_welford (priv->sums, priv->m2, in_array, priv->counter, width, height);
+    else if (priv->precision == PRECISION_KAHAN)
+        accumulate_kahan (out_array, priv->compensation, in_array, width, height);
+    else if (priv->precision == PRECISION_DOUBLE)
+        accumulate_double (priv->sums, in_array, width, height);
+    else
+        accumulate_single (out_array, in_array, width, height);
 
-    priv->counter++;
     return TRUE;
 }
 
@@ -137,8 +270,27 @@ ufo_average_task_generate (UfoTask *task,
     n_pixels = requisition->dims[0] * requisition->dims[1];
 
     if (!priv->is_data_averaged) {
-        for (gsize i = 0; i < n_pixels; i++)
-            priv->averaged[i] = out_array[i] / (gfloat) priv->counter;
+        if (priv->statistic != STATISTIC_MEAN) {
+            /* Sample variance, zero for a single frame */
+            const gdouble scale = priv->counter > 1 ? 1.0 / (priv->counter - 1) : 0.0;
+
+            for (gsize i = 0; i < n_pixels; i++) {
+                const gdouble variance = priv->m2[i] * scale;
+                priv->averaged[i] = priv->statistic == STATISTIC_STD ? sqrt (variance) : variance;
+            }
+        }
+        else if (priv->precision == PRECISION_KAHAN) {
+            for (gsize i = 0; i < n_pixels; i++)
+                priv->averaged[i] = (out_array[i] - priv->compensation[i]) / (gfloat) priv->counter;
+        }
+        else if (priv->precision == PRECISION_DOUBLE) {
+            for (gsize i = 0; i < n_pixels; i++)
+                priv->averaged[i] = priv->sums[i] / priv->counter;
+        }
+        else {
+            for (gsize i = 0; i < n_pixels; i++)
+                priv->averaged[i] = out_array[i] / (gfloat) priv->counter;
+        }
 
         priv->is_data_averaged = TRUE;
     }
@@ -172,6 +324,12 @@ ufo_average_task_finalize (GObject *object)
         g_free (priv->averaged);
         priv->averaged = NULL;
     }
+
+    g_free (priv->compensation);
+    g_free (priv->sums);
+    g_free (priv->m2);
+
+    G_OBJECT_CLASS (ufo_average_task_parent_class)->finalize (object);
 }
 
 static void
@@ -186,6 +344,12 @@ ufo_average_task_set_property (GObject *object,
         case PROP_NUM_GENERATE:
             priv->n_generate = g_value_get_uint (value);
             break;
+        case PROP_PRECISION:
+            priv->precision = g_value_get_enum (value);
+            break;
+        case PROP_STATISTIC:
+            priv->statistic = g_value_get_enum (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -204,6 +368,12 @@ ufo_average_task_get_property (GObject *object,
         case PROP_NUM_GENERATE:
             g_value_set_uint (value, priv->n_generate);
             break;
+        case PROP_PRECISION:
+            g_value_set_enum (value, priv->precision);
+            break;
+        case PROP_STATISTIC:
+            g_value_set_enum (value, priv->statistic);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -228,6 +398,22 @@ ufo_average_task_class_init (UfoAverageTaskClass *klass)
             1, G_MAXUINT, 1,
             G_PARAM_READWRITE);
 
+    properties[PROP_PRECISION] =
+        g_param_spec_enum ("precision",
+            "Accumulation of the mean (\"single\", \"kahan\", \"double\")",
+            "Accumulation of the mean (\"single\", \"kahan\", \"double\")",
+            g_enum_register_static ("ufo_average_precision", precision_values),
+            PRECISION_SINGLE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_STATISTIC] =
+        g_param_spec_enum ("statistic",
+            "Computed statistic (\"mean\", \"variance\", \"std\")",
+            "Computed statistic (\"mean\", \"variance\", \"std\")",
+            g_enum_register_static ("ufo_average_statistic", statistic_values),
+            STATISTIC_MEAN,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -242,4 +428,9 @@ ufo_average_task_init(UfoAverageTask *self)
     self->priv->averaged = NULL;
     self->priv->n_generate = 1;
     self->priv->is_data_averaged = FALSE;
+    self->priv->precision = PRECISION_SINGLE;
+    self->priv->statistic = STATISTIC_MEAN;
+    self->priv->compensation = NULL;
+    self->priv->sums = NULL;
+    self->priv->m2 = NULL;
 }
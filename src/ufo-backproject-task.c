@@ -24,28 +24,72 @@
 #endif
 
 #include <math.h>
+#include <string.h>
 #include "ufo-backproject-task.h"
 
+/* Vector variants are compiled per function and picked at run time, so that
+ * they do not depend on the flags of the whole build */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+/* Output tile processed by one thread of the native backend */
+#define CPU_TILE_WIDTH  64
+#define CPU_TILE_HEIGHT 8
+
+/* Slices reconstructed together by the batch kernels and the native backend,
+ * must match BATCH_SLICES in backproject.cl */
+#define BATCH_SLICES    4
+
+/* Zero columns on each side of a sinogram row so that clamped sample
+ * positions always read two valid neighbours */
+#define CPU_PADDING     2
+
 
 typedef enum {
     MODE_NEAREST,
     MODE_TEXTURE
 } Mode;
 
+typedef void (*AccumulateFunc) (const gfloat *row, gsize slice_stride, guint n_slices,
+                                gfloat *acc, gsize acc_stride, guint n,
+                                gfloat base, gfloat step, gfloat width);
+
 static GEnumValue mode_values[] = {
     { MODE_NEAREST, "MODE_NEAREST", "nearest" },
     { MODE_TEXTURE, "MODE_TEXTURE", "texture" },
     { 0, NULL, NULL}
 };
 
+typedef enum {
+    BACKEND_AUTO,
+    BACKEND_OPENCL,
+    BACKEND_NATIVE
+} Backend;
+
+static GEnumValue backend_values[] = {
+    { BACKEND_AUTO,   "BACKEND_AUTO",   "auto" },
+    { BACKEND_OPENCL, "BACKEND_OPENCL", "opencl" },
+    { BACKEND_NATIVE, "BACKEND_NATIVE", "native" },
+    { 0, NULL, NULL}
+};
+
 struct _UfoBackprojectTaskPrivate {
     cl_context context;
     cl_kernel nearest_kernel;
     cl_kernel texture_kernel;
+    cl_kernel nearest_batch_kernel;
+    cl_kernel texture_batch_kernel;
+    cl_kernel nearest_stream_kernel;
+    cl_kernel texture_stream_kernel;
+    UfoBuffer *volume;
     cl_mem sin_lut;
     cl_mem cos_lut;
     gfloat *host_sin_lut;
     gfloat *host_cos_lut;
+    gfloat *padded;
+    gsize padded_size;
     gdouble axis_pos;
     gdouble angle_step;
     gdouble angle_offset;
@@ -58,7 +102,16 @@ struct _UfoBackprojectTaskPrivate {
     guint roi_y;
     gint roi_width;
     gint roi_height;
+    guint n_slices;
+    guint n_streamed;
+    guint emit_interval;
+    gboolean streaming;
+    gboolean generated;
     Mode mode;
+    Backend backend;
+    gboolean backend_resolved;
+    gboolean use_native;
+    AccumulateFunc accumulate_linear;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -81,6 +134,9 @@ enum {
     PROP_ROI_WIDTH,
     PROP_ROI_HEIGHT,
     PROP_MODE,
+    PROP_BACKEND,
+    PROP_STREAMING,
+    PROP_EMIT_INTERVAL,
     N_PROPERTIES
 };
 
@@ -92,6 +148,380 @@ ufo_backproject_task_new (void)
     return UFO_NODE (g_object_new (UFO_TYPE_BACKPROJECT_TASK, NULL));
 }
 
+static const gfloat *
+pad_sinogram (UfoBackprojectTaskPrivate *priv,
+              const gfloat *sinogram,
+              guint width,
+              guint height)
+{
+    gsize stride = width + 2 * CPU_PADDING;
+    gsize size = stride * height * sizeof (gfloat);
+
+    if (priv->padded_size < size) {
+        g_free (priv->padded);
+        priv->padded = g_malloc0 (size);
+        priv->padded_size = size;
+    }
+
+    for (guint i = 0; i < height; i++) {
+        gfloat *row = priv->padded + i * stride;
+
+        row[0] = row[1] = 0.0f;
+        memcpy (row + CPU_PADDING, sinogram + i * width, width * sizeof (gfloat));
+        row[stride - 2] = row[stride - 1] = 0.0f;
+    }
+
+    return priv->padded;
+}
+
+/*
+ * Add the contribution of one projection row of n_slices sinograms to pixels
+ * x to n - 1. The sample position of pixel x is base + x * step in texel
+ * coordinates and is shared by all slices, texels outside the row are zero
+ * like with CLK_ADDRESS_CLAMP.
+ */
+static inline void
+accumulate_linear_tail (const gfloat *row,
+                        gsize slice_stride,
+                        guint n_slices,
+                        gfloat *acc,
+                        gsize acc_stride,
+                        guint x,
+                        guint n,
+                        gfloat base,
+                        gfloat step,
+                        gfloat width)
+{
+    for (; x < n; x++) {
+        gfloat u = CLAMP (base + x * step, -2.0f, width);
+        gfloat f = floorf (u);
+        gfloat a = u - f;
+        gint i = (gint) f;
+
+        for (guint s = 0; s < n_slices; s++) {
+            const gfloat *r = row + s * slice_stride;
+
+            acc[s * acc_stride + x] += r[i] + a * (r[i + 1] - r[i]);
+        }
+    }
+}
+
+static void
+accumulate_row_linear (const gfloat *row,
+                       gsize slice_stride,
+                       guint n_slices,
+                       gfloat *acc,
+                       gsize acc_stride,
+                       guint n,
+                       gfloat base,
+                       gfloat step,
+                       gfloat width)
+{
+    accumulate_linear_tail (row, slice_stride, n_slices, acc, acc_stride, 0, n, base, step, width);
+}
+
+#ifdef HAVE_X86_DISPATCH
+__attribute__((target("avx2")))
+static void
+accumulate_row_linear_avx2 (const gfloat *row,
+                            gsize slice_stride,
+                            guint n_slices,
+                            gfloat *acc,
+                            gsize acc_stride,
+                            guint n,
+                            gfloat base,
+                            gfloat step,
+                            gfloat width)
+{
+    const __m256 lo = _mm256_set1_ps (-2.0f);
+    const __m256 hi = _mm256_set1_ps (width);
+    const __m256 vbase = _mm256_set1_ps (base);
+    const __m256 vstep = _mm256_set1_ps (step);
+    const __m256 eight = _mm256_set1_ps (8.0f);
+    __m256 xs = _mm256_setr_ps (0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    guint x = 0;
+
+    for (; x + 8 <= n; x += 8) {
+        __m256 u = _mm256_add_ps (vbase, _mm256_mul_ps (xs, vstep));
+        __m256 f, a;
+        __m256i i;
+
+        u = _mm256_min_ps (_mm256_max_ps (u, lo), hi);
+        f = _mm256_floor_ps (u);
+        a = _mm256_sub_ps (u, f);
+        i = _mm256_cvttps_epi32 (f);
+
+        for (guint s = 0; s < n_slices; s++) {
+            const gfloat *r = row + s * slice_stride;
+            gfloat *dst = acc + s * acc_stride + x;
+            __m256 left = _mm256_i32gather_ps (r, i, 4);
+            __m256 right = _mm256_i32gather_ps (r + 1, i, 4);
+
+            left = _mm256_add_ps (left, _mm256_mul_ps (a, _mm256_sub_ps (right, left)));
+            _mm256_storeu_ps (dst, _mm256_add_ps (_mm256_loadu_ps (dst), left));
+        }
+
+        xs = _mm256_add_ps (xs, eight);
+    }
+
+    accumulate_linear_tail (row, slice_stride, n_slices, acc, acc_stride, x, n, base, step, width);
+}
+
+__attribute__((target("avx512f")))
+static void
+accumulate_row_linear_avx512 (const gfloat *row,
+                              gsize slice_stride,
+                              guint n_slices,
+                              gfloat *acc,
+                              gsize acc_stride,
+                              guint n,
+                              gfloat base,
+                              gfloat step,
+                              gfloat width)
+{
+    const __m512 lo = _mm512_set1_ps (-2.0f);
+    const __m512 hi = _mm512_set1_ps (width);
+    const __m512 vbase = _mm512_set1_ps (base);
+    const __m512 vstep = _mm512_set1_ps (step);
+    const __m512 sixteen = _mm512_set1_ps (16.0f);
+    __m512 xs = _mm512_setr_ps (0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f,
+                                8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f);
+    guint x = 0;
+
+    for (; x + 16 <= n; x += 16) {
+        __m512 u = _mm512_add_ps (vbase, _mm512_mul_ps (xs, vstep));
+        __m512 f, a;
+        __m512i i;
+
+        u = _mm512_min_ps (_mm512_max_ps (u, lo), hi);
+        f = _mm512_roundscale_ps (u, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        a = _mm512_sub_ps (u, f);
+        i = _mm512_cvttps_epi32 (f);
+
+        for (guint s = 0; s < n_slices; s++) {
+            const gfloat *r = row + s * slice_stride;
+            gfloat *dst = acc + s * acc_stride + x;
+            __m512 left = _mm512_i32gather_ps (i, r, 4);
+            __m512 right = _mm512_i32gather_ps (i, r + 1, 4);
+
+            left = _mm512_add_ps (left, _mm512_mul_ps (a, _mm512_sub_ps (right, left)));
+            _mm512_storeu_ps (dst, _mm512_add_ps (_mm512_loadu_ps (dst), left));
+        }
+
+        xs = _mm512_add_ps (xs, sixteen);
+    }
+
+    accumulate_linear_tail (row, slice_stride, n_slices, acc, acc_stride, x, n, base, step, width);
+}
+#endif
+
+static AccumulateFunc
+get_accumulate_linear (void)
+{
+#ifdef HAVE_X86_DISPATCH
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("avx512f"))
+        return accumulate_row_linear_avx512;
+
+    if (__builtin_cpu_supports ("avx2"))
+        return accumulate_row_linear_avx2;
+#endif
+
+    return accumulate_row_linear;
+}
+
+static inline void
+accumulate_row_nearest (const gfloat *row,
+                        gsize slice_stride,
+                        guint n_slices,
+                        gfloat *acc,
+                        gsize acc_stride,
+                        guint n,
+                        gfloat base,
+                        gfloat step,
+                        gfloat width)
+{
+    for (guint x = 0; x < n; x++) {
+        gint i = (gint) floorf (CLAMP (base + x * step, -1.0f, width));
+
+        for (guint s = 0; s < n_slices; s++)
+            acc[s * acc_stride + x] += row[s * slice_stride + i];
+    }
+}
+
+/*
+ * Native counterpart of the backproject_tex and backproject_nearest kernels.
+ * The slices are split into tiles of up to BATCH_SLICES slices which are
+ * distributed across threads. Each tile walks over all projections so that
+ * the accumulators stay in L1 and the sample positions are computed once for
+ * all slices of the tile.
+ */
+static void
+backproject_native (UfoBackprojectTaskPrivate *priv,
+                    const gfloat *sinograms,
+                    gfloat *slices,
+                    guint width,
+                    guint slice_width,
+                    guint slice_height,
+                    guint n_slices,
+                    guint angle_index,
+                    guint n_projections,
+                    gfloat axis_pos,
+                    gfloat scale,
+                    gboolean accumulate)
+{
+    const gfloat *padded;
+    const gfloat *sin_lut;
+    const gfloat *cos_lut;
+    const gsize stride = width + 2 * CPU_PADDING;
+    const gsize padded_slice_size = stride * n_projections;
+    const gboolean linear = priv->mode == MODE_TEXTURE;
+    const gfloat x_start = priv->roi_x - axis_pos + 0.5f;
+    const gfloat y_start = priv->roi_y - axis_pos + 0.5f;
+    const gint n_tiles_x = (slice_width + CPU_TILE_WIDTH - 1) / CPU_TILE_WIDTH;
+    const gint n_tiles_y = (slice_height + CPU_TILE_HEIGHT - 1) / CPU_TILE_HEIGHT;
+    const gint n_tiles_z = (n_slices + BATCH_SLICES - 1) / BATCH_SLICES;
+    gint tile;
+
+    padded = pad_sinogram (priv, sinograms, width, n_projections * n_slices);
+    sin_lut = priv->host_sin_lut + angle_index;
+    cos_lut = priv->host_cos_lut + angle_index;
+
+#pragma omp parallel for schedule(dynamic)
+    for (tile = 0; tile < n_tiles_x * n_tiles_y * n_tiles_z; tile++) {
+        gfloat acc[BATCH_SLICES][CPU_TILE_HEIGHT][CPU_TILE_WIDTH];
+        const gsize acc_stride = CPU_TILE_HEIGHT * CPU_TILE_WIDTH;
+        const guint tx = (tile % n_tiles_x) * CPU_TILE_WIDTH;
+        const guint ty = ((tile / n_tiles_x) % n_tiles_y) * CPU_TILE_HEIGHT;
+        const guint tz = (tile / (n_tiles_x * n_tiles_y)) * BATCH_SLICES;
+        const guint nx = MIN (CPU_TILE_WIDTH, slice_width - tx);
+        const guint ny = MIN (CPU_TILE_HEIGHT, slice_height - ty);
+        const guint nz = MIN (BATCH_SLICES, n_slices - tz);
+
+        memset (acc, 0, sizeof (acc));
+
+        for (guint proj = 0; proj < n_projections; proj++) {
+            const gfloat *row = padded + tz * padded_slice_size + proj * stride + CPU_PADDING;
+            const gfloat s = sin_lut[proj];
+            const gfloat c = cos_lut[proj];
+
+            for (guint y = 0; y < ny; y++) {
+                gfloat base = (ty + y + y_start) * s + (tx + x_start) * c + axis_pos;
+
+                if (linear)
+                    /* Linear filtering samples texel centers */
+                    priv->accumulate_linear (row, padded_slice_size, nz, acc[0][y], acc_stride,
+                                             nx, base - 0.5f, c, (gfloat) width);
+                else
+                    accumulate_row_nearest (row, padded_slice_size, nz, acc[0][y], acc_stride,
+                                            nx, base, c, (gfloat) width);
+            }
+        }
+
+        for (guint z = 0; z < nz; z++) {
+            for (guint y = 0; y < ny; y++) {
+                gfloat *dst = slices + ((tz + z) * slice_height + ty + y) * slice_width + tx;
+
+                if (accumulate) {
+                    for (guint x = 0; x < nx; x++)
+                        dst[x] += acc[z][y][x] * scale;
+                }
+                else {
+                    for (guint x = 0; x < nx; x++)
+                        dst[x] = acc[z][y][x] * scale;
+                }
+            }
+        }
+    }
+}
+
+static void
+clear_volume (UfoBackprojectTaskPrivate *priv)
+{
+    memset (ufo_buffer_get_host_array (priv->volume, NULL), 0, ufo_buffer_get_size (priv->volume));
+}
+
+/*
+ * Add the contribution of a single projection to all slices of the volume.
+ * Row i of the projection is the sinogram row of slice i.
+ */
+static void
+backproject_stream (UfoTask *task,
+                    UfoBuffer *projection,
+                    gfloat axis_pos)
+{
+    UfoBackprojectTaskPrivate *priv;
+    UfoGpuNode *node;
+    UfoProfiler *profiler;
+    UfoRequisition in_req;
+    UfoRequisition out_req;
+    cl_command_queue cmd_queue;
+    cl_mem in_mem;
+    cl_mem out_mem;
+    cl_kernel kernel;
+    gsize global_size[3];
+    guint angle_index;
+    gfloat scale;
+
+    priv = UFO_BACKPROJECT_TASK (task)->priv;
+    angle_index = priv->offset + priv->n_streamed;
+    scale = (gfloat) G_PI / priv->n_projections;
+    ufo_buffer_get_requisition (projection, &in_req);
+    ufo_buffer_get_requisition (priv->volume, &out_req);
+
+    if (priv->use_native) {
+        backproject_native (priv,
+                            ufo_buffer_get_host_array (projection, NULL),
+                            ufo_buffer_get_host_array (priv->volume, NULL),
+                            (guint) in_req.dims[0],
+                            (guint) out_req.dims[0],
+                            (guint) out_req.dims[1],
+                            priv->n_slices,
+                            angle_index, 1,
+                            axis_pos, scale, TRUE);
+        return;
+    }
+
+    node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
+    cmd_queue = ufo_gpu_node_get_cmd_queue (node);
+    out_mem = ufo_buffer_get_device_array (priv->volume, cmd_queue);
+
+    if (priv->mode == MODE_TEXTURE) {
+        in_mem = ufo_buffer_get_device_image (projection, cmd_queue);
+        kernel = priv->texture_stream_kernel;
+    }
+    else {
+        in_mem = ufo_buffer_get_device_array (projection, cmd_queue);
+        kernel = priv->nearest_stream_kernel;
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &out_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof (cl_mem), &priv->sin_lut));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 3, sizeof (cl_mem), &priv->cos_lut));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 4, sizeof (guint),  &priv->roi_x));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 5, sizeof (guint),  &priv->roi_y));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 6, sizeof (guint),  &angle_index));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 7, sizeof (gfloat), &axis_pos));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 8, sizeof (guint),  &priv->n_slices));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 9, sizeof (gfloat), &scale));
+
+    /* Projection rows are as wide as the detector, not as the ROI */
+    if (priv->mode == MODE_NEAREST) {
+        guint projection_width = (guint) in_req.dims[0];
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 10, sizeof (guint), &projection_width));
+    }
+
+    global_size[0] = out_req.dims[0];
+    global_size[1] = out_req.dims[1];
+    global_size[2] = (priv->n_slices + BATCH_SLICES - 1) / BATCH_SLICES;
+
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+    ufo_profiler_call (profiler, cmd_queue, kernel, 3, global_size, NULL);
+}
+
 static gboolean
 ufo_backproject_task_process (UfoTask *task,
                               UfoBuffer **inputs,
@@ -101,35 +531,62 @@ ufo_backproject_task_process (UfoTask *task,
     UfoBackprojectTaskPrivate *priv;
     UfoGpuNode *node;
     UfoProfiler *profiler;
+    UfoRequisition in_req;
     cl_command_queue cmd_queue;
     cl_mem in_mem;
     cl_mem out_mem;
     cl_kernel kernel;
     gfloat axis_pos;
+    guint sinogram_width;
 
     priv = UFO_BACKPROJECT_TASK (task)->priv;
+
+    /* Guess axis position if they are not provided by the user. */
+    ufo_buffer_get_requisition (inputs[0], &in_req);
+    axis_pos = priv->axis_pos <= 0.0 ? ((gfloat) in_req.dims[0]) / 2.0f : (gfloat) priv->axis_pos;
+
+    /* Slices are as wide as the ROI, the nearest kernels need the sinogram width */
+    sinogram_width = (guint) in_req.dims[0];
+
+    if (priv->streaming) {
+        backproject_stream (task, inputs[0], axis_pos);
+        priv->n_streamed++;
+        priv->generated = FALSE;
+
+        /* Returning FALSE emits the current state of the volume */
+        if (priv->offset + priv->n_streamed >= priv->n_projections)
+            return FALSE;
+
+        return priv->emit_interval == 0 || priv->n_streamed % priv->emit_interval != 0;
+    }
+
+    if (priv->use_native) {
+        backproject_native (priv,
+                            ufo_buffer_get_host_array (inputs[0], NULL),
+                            ufo_buffer_get_host_array (output, NULL),
+                            (guint) in_req.dims[0],
+                            (guint) requisition->dims[0],
+                            (guint) requisition->dims[1],
+                            priv->n_slices,
+                            priv->offset,
+                            priv->burst_projections,
+                            axis_pos,
+                            (gfloat) G_PI / priv->burst_projections,
+                            FALSE);
+        return TRUE;
+    }
+
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
     cmd_queue = ufo_gpu_node_get_cmd_queue (node);
     out_mem = ufo_buffer_get_device_array (output, cmd_queue);
 
     if (priv->mode == MODE_TEXTURE) {
         in_mem = ufo_buffer_get_device_image (inputs[0], cmd_queue);
-        kernel = priv->texture_kernel;
+        kernel = in_req.n_dims == 3 ? priv->texture_batch_kernel : priv->texture_kernel;
     }
     else {
         in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
-        kernel = priv->nearest_kernel;
-    }
-
-    /* Guess axis position if they are not provided by the user. */
-    if (priv->axis_pos <= 0.0) {
-        UfoRequisition in_req;
-
-        ufo_buffer_get_requisition (inputs[0], &in_req);
-        axis_pos = (gfloat) ((gfloat) in_req.dims[0]) / 2.0f;
-    }
-    else {
-        axis_pos = priv->axis_pos;
+        kernel = in_req.n_dims == 3 ? priv->nearest_batch_kernel : priv->nearest_kernel;
     }
 
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &in_mem));
@@ -143,11 +600,110 @@ ufo_backproject_task_process (UfoTask *task,
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 8, sizeof (gfloat), &axis_pos));
 
     profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-    ufo_profiler_call (profiler, cmd_queue, kernel, 2, requisition->dims, NULL);
+
+    if (in_req.n_dims == 3) {
+        gsize global_size[3];
+
+        /* Each work item reconstructs BATCH_SLICES slices */
+        global_size[0] = requisition->dims[0];
+        global_size[1] = requisition->dims[1];
+        global_size[2] = (priv->n_slices + BATCH_SLICES - 1) / BATCH_SLICES;
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 9, sizeof (guint), &priv->n_slices));
+
+        if (priv->mode == MODE_NEAREST)
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 10, sizeof (guint), &sinogram_width));
+
+        ufo_profiler_call (profiler, cmd_queue, kernel, 3, global_size, NULL);
+    }
+    else {
+        if (priv->mode == MODE_NEAREST)
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 9, sizeof (guint), &sinogram_width));
+
+        ufo_profiler_call (profiler, cmd_queue, kernel, 2, requisition->dims, NULL);
+    }
 
     return TRUE;
 }
 
+static gboolean
+ufo_backproject_task_generate (UfoTask *task,
+                               UfoBuffer *output,
+                               UfoRequisition *requisition)
+{
+    UfoBackprojectTaskPrivate *priv;
+
+    priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (task);
+
+    if (priv->generated)
+        return FALSE;
+
+    ufo_buffer_copy (priv->volume, output);
+    priv->generated = TRUE;
+
+    /* Start over with the next scan once all projections were accumulated */
+    if (priv->offset + priv->n_streamed >= priv->n_projections) {
+        clear_volume (priv);
+        priv->n_streamed = 0;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+have_gpu_device (UfoResources *resources)
+{
+    GList *devices = ufo_resources_get_devices (resources);
+    GList *it;
+
+    g_list_for (devices, it) {
+        cl_device_type type = 0;
+
+        UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo ((cl_device_id) it->data, CL_DEVICE_TYPE,
+                                                    sizeof (cl_device_type), &type, NULL));
+
+        if (type & (CL_DEVICE_TYPE_GPU | CL_DEVICE_TYPE_ACCELERATOR))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * The scheduler asks for the mode before the task is set up with its
+ * resources, so the auto backend looks at the devices of all platforms.
+ */
+static gboolean
+have_any_gpu_device (void)
+{
+    cl_platform_id platforms[16];
+    cl_uint n_platforms = 0;
+
+    if (clGetPlatformIDs (G_N_ELEMENTS (platforms), platforms, &n_platforms) != CL_SUCCESS)
+        return FALSE;
+
+    for (cl_uint i = 0; i < MIN (n_platforms, G_N_ELEMENTS (platforms)); i++) {
+        cl_uint n_devices = 0;
+
+        if (clGetDeviceIDs (platforms[i], CL_DEVICE_TYPE_GPU | CL_DEVICE_TYPE_ACCELERATOR,
+                            0, NULL, &n_devices) == CL_SUCCESS && n_devices > 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+resolve_backend (UfoBackprojectTaskPrivate *priv)
+{
+    if (priv->backend_resolved)
+        return;
+
+    priv->use_native = priv->backend == BACKEND_NATIVE ||
+                       (priv->backend == BACKEND_AUTO && !have_any_gpu_device ());
+    priv->backend_resolved = TRUE;
+}
+
 static void
 ufo_backproject_task_setup (UfoTask *task,
                             UfoResources *resources,
@@ -158,16 +714,49 @@ ufo_backproject_task_setup (UfoTask *task,
     priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (task);
 
     priv->context = ufo_resources_get_context (resources);
-    priv->nearest_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_nearest", error);
-    priv->texture_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_tex", error);
+
+    /* Keep what get_mode has decided, the task is already placed accordingly */
+    if (!priv->backend_resolved) {
+        priv->use_native = priv->backend == BACKEND_NATIVE ||
+                           (priv->backend == BACKEND_AUTO && !have_gpu_device (resources));
+        priv->backend_resolved = TRUE;
+    }
+
+    priv->n_streamed = 0;
+    priv->generated = TRUE;
 
     UFO_RESOURCES_CHECK_CLERR (clRetainContext (priv->context));
 
+    if (priv->use_native) {
+        g_debug ("backproject: using native CPU backend");
+        priv->accumulate_linear = get_accumulate_linear ();
+        return;
+    }
+
+    priv->nearest_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_nearest", error);
+    priv->texture_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_tex", error);
+    priv->nearest_batch_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_nearest_batch", error);
+    priv->texture_batch_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_tex_batch", error);
+    priv->nearest_stream_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_nearest_stream", error);
+    priv->texture_stream_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_tex_stream", error);
+
     if (priv->nearest_kernel != NULL)
         UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->nearest_kernel));
 
     if (priv->texture_kernel != NULL)
         UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->texture_kernel));
+
+    if (priv->nearest_batch_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->nearest_batch_kernel));
+
+    if (priv->texture_batch_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->texture_batch_kernel));
+
+    if (priv->nearest_stream_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->nearest_stream_kernel));
+
+    if (priv->texture_stream_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->texture_stream_kernel));
 }
 
 static cl_mem
@@ -185,6 +774,10 @@ create_lut_buffer (UfoBackprojectTaskPrivate *priv,
     for (guint i = 0; i < n_entries; i++)
         (*host_mem)[i] = (gfloat) func (priv->angle_offset + i * priv->real_angle_step);
 
+    /* The native backend reads the host tables only */
+    if (priv->use_native)
+        return NULL;
+
     mem = clCreateBuffer (priv->context,
                           CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
                           size, *host_mem,
@@ -219,24 +812,42 @@ ufo_backproject_task_get_requisition (UfoTask *task,
     priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (task);
     ufo_buffer_get_requisition (inputs[0], &in_req);
 
-    /* If the number of projections is not specified use the input size */
-    if (priv->n_projections == 0) {
-        priv->n_projections = (guint) in_req.dims[1];
+    if (priv->streaming) {
+        /* Every input is a single projection whose rows belong to consecutive
+         * slices, the total number of projections must be known upfront to
+         * weight the contributions */
+        if (priv->n_projections == 0)
+            g_error ("Streaming backprojection requires num-projections to be set");
+
+        priv->burst_projections = 1;
     }
+    else {
+        /* If the number of projections is not specified use the input size */
+        if (priv->n_projections == 0)
+            priv->n_projections = (guint) in_req.dims[1];
 
-    priv->burst_projections = (guint) in_req.dims[1];
+        priv->burst_projections = (guint) in_req.dims[1];
+    }
 
     if (priv->burst_projections > priv->n_projections) {
         g_error("Total number of projections (%u) must be greater than "
                 "or equal to sinogram height (%u)", priv->n_projections, priv->burst_projections);
     }
 
-    requisition->n_dims = 2;
+    /* A stack of sinograms is reconstructed into a stack of slices, in
+     * streaming mode there is one slice for each projection row */
+    if (priv->streaming)
+        priv->n_slices = (guint) in_req.dims[1];
+    else
+        priv->n_slices = in_req.n_dims == 3 ? (guint) in_req.dims[2] : 1;
+
+    requisition->n_dims = priv->n_slices > 1 || in_req.n_dims == 3 ? 3 : 2;
 
     /* TODO: we should check here, that we might access data outside the
      * projections */
     requisition->dims[0] = priv->roi_width == 0 ? in_req.dims[0] : (gsize) priv->roi_width;
     requisition->dims[1] = priv->roi_height == 0 ? in_req.dims[0] : (gsize) priv->roi_height;
+    requisition->dims[2] = priv->n_slices;
 
     if (priv->real_angle_step < 0.0) {
         if (priv->angle_step <= 0.0)
@@ -247,18 +858,32 @@ ufo_backproject_task_get_requisition (UfoTask *task,
 
     if (priv->luts_changed) {
         release_lut_mems (priv);
+        g_free (priv->host_sin_lut);
+        g_free (priv->host_cos_lut);
+        priv->host_sin_lut = NULL;
+        priv->host_cos_lut = NULL;
         priv->luts_changed = FALSE;
     }
 
-    if (priv->sin_lut == NULL) {
+    /* The host tables always exist, the device ones only for OpenCL */
+    if (priv->host_sin_lut == NULL) {
         priv->sin_lut = create_lut_buffer (priv, &priv->host_sin_lut,
                                            priv->n_projections, sin);
     }
 
-    if (priv->cos_lut == NULL) {
+    if (priv->host_cos_lut == NULL) {
         priv->cos_lut = create_lut_buffer (priv, &priv->host_cos_lut,
                                            priv->n_projections, cos);
     }
+
+    if (priv->streaming && (priv->volume == NULL || ufo_buffer_cmp_dimensions (priv->volume, requisition) != 0)) {
+        if (priv->volume != NULL)
+            g_object_unref (priv->volume);
+
+        priv->volume = ufo_buffer_new (requisition, priv->context);
+        clear_volume (priv);
+        priv->n_streamed = 0;
+    }
 }
 
 static guint
@@ -272,13 +897,24 @@ ufo_filter_task_get_num_dimensions (UfoTask *task,
                                guint input)
 {
     g_return_val_if_fail (input == 0, 0);
-    return 2;
+
+    /* A sinogram or a stack of them, streaming takes single projections */
+    return UFO_BACKPROJECT_TASK_GET_PRIVATE (task)->streaming ? 2 : 3;
 }
 
 static UfoTaskMode
 ufo_filter_task_get_mode (UfoTask *task)
 {
-    return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
+    UfoBackprojectTaskPrivate *priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (task);
+    UfoTaskMode processing;
+
+    resolve_backend (priv);
+    processing = priv->use_native ? UFO_TASK_MODE_CPU : UFO_TASK_MODE_GPU;
+
+    if (priv->streaming)
+        return UFO_TASK_MODE_REDUCTOR | processing;
+
+    return UFO_TASK_MODE_PROCESSOR | processing;
 }
 
 static gboolean
@@ -286,6 +922,11 @@ ufo_backproject_task_equal_real (UfoNode *n1,
                             UfoNode *n2)
 {
     g_return_val_if_fail (UFO_IS_BACKPROJECT_TASK (n1) && UFO_IS_BACKPROJECT_TASK (n2), FALSE);
+
+    /* Native tasks have no kernels to tell them apart */
+    if (UFO_BACKPROJECT_TASK (n1)->priv->use_native)
+        return n1 == n2;
+
     return UFO_BACKPROJECT_TASK (n1)->priv->texture_kernel == UFO_BACKPROJECT_TASK (n2)->priv->texture_kernel;
 }
 
@@ -300,6 +941,7 @@ ufo_backproject_task_finalize (GObject *object)
 
     g_free (priv->host_sin_lut);
     g_free (priv->host_cos_lut);
+    g_free (priv->padded);
 
     if (priv->nearest_kernel) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->nearest_kernel));
@@ -311,6 +953,31 @@ ufo_backproject_task_finalize (GObject *object)
         priv->texture_kernel = NULL;
     }
 
+    if (priv->nearest_batch_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->nearest_batch_kernel));
+        priv->nearest_batch_kernel = NULL;
+    }
+
+    if (priv->texture_batch_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->texture_batch_kernel));
+        priv->texture_batch_kernel = NULL;
+    }
+
+    if (priv->nearest_stream_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->nearest_stream_kernel));
+        priv->nearest_stream_kernel = NULL;
+    }
+
+    if (priv->texture_stream_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->texture_stream_kernel));
+        priv->texture_stream_kernel = NULL;
+    }
+
+    if (priv->volume) {
+        g_object_unref (priv->volume);
+        priv->volume = NULL;
+    }
+
     if (priv->context) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
         priv->context = NULL;
@@ -328,6 +995,7 @@ ufo_task_interface_init (UfoTaskIface *iface)
     iface->get_num_dimensions = ufo_filter_task_get_num_dimensions;
     iface->get_mode = ufo_filter_task_get_mode;
     iface->process = ufo_backproject_task_process;
+    iface->generate = ufo_backproject_task_generate;
 }
 
 static void
@@ -358,6 +1026,16 @@ ufo_backproject_task_set_property (GObject *object,
         case PROP_MODE:
             priv->mode = g_value_get_enum (value);
             break;
+        case PROP_BACKEND:
+            priv->backend = g_value_get_enum (value);
+            priv->backend_resolved = FALSE;
+            break;
+        case PROP_STREAMING:
+            priv->streaming = g_value_get_boolean (value);
+            break;
+        case PROP_EMIT_INTERVAL:
+            priv->emit_interval = g_value_get_uint (value);
+            break;
         case PROP_ROI_X:
             priv->roi_x = g_value_get_uint (value);
             break;
@@ -403,6 +1081,15 @@ ufo_backproject_task_get_property (GObject *object,
         case PROP_MODE:
             g_value_set_enum (value, priv->mode);
             break;
+        case PROP_BACKEND:
+            g_value_set_enum (value, priv->backend);
+            break;
+        case PROP_STREAMING:
+            g_value_set_boolean (value, priv->streaming);
+            break;
+        case PROP_EMIT_INTERVAL:
+            g_value_set_uint (value, priv->emit_interval);
+            break;
         case PROP_ROI_X:
             g_value_set_uint (value, priv->roi_x);
             break;
@@ -477,6 +1164,27 @@ ufo_backproject_task_class_init (UfoBackprojectTaskClass *klass)
             g_enum_register_static ("mode", mode_values),
             MODE_TEXTURE, G_PARAM_READWRITE);
 
+    properties[PROP_BACKEND] =
+        g_param_spec_enum ("backend",
+            "Backprojection backend (\"auto\", \"opencl\", \"native\")",
+            "Backprojection backend (\"auto\", \"opencl\", \"native\")",
+            g_enum_register_static ("UfoBackprojectBackend", backend_values),
+            BACKEND_AUTO, G_PARAM_READWRITE);
+
+    properties[PROP_STREAMING] =
+        g_param_spec_boolean ("streaming",
+            "Accumulate projections as they arrive",
+            "Accumulate projections as they arrive",
+            FALSE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_EMIT_INTERVAL] =
+        g_param_spec_uint ("emit-interval",
+            "Number of projections after which a partial reconstruction is emitted",
+            "Number of projections after which a partial reconstruction is emitted, 0 emits only the final volume",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
     properties[PROP_ROI_X] =
         g_param_spec_uint ("roi-x",
             "X coordinate of region of interest",
@@ -520,7 +1228,17 @@ ufo_backproject_task_init (UfoBackprojectTask *self)
     self->priv = priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (self);
     priv->nearest_kernel = NULL;
     priv->texture_kernel = NULL;
+    priv->nearest_batch_kernel = NULL;
+    priv->texture_batch_kernel = NULL;
+    priv->nearest_stream_kernel = NULL;
+    priv->texture_stream_kernel = NULL;
+    priv->volume = NULL;
+    priv->streaming = FALSE;
+    priv->generated = TRUE;
+    priv->n_streamed = 0;
+    priv->emit_interval = 0;
     priv->n_projections = 0;
+    priv->n_slices = 1;
     priv->offset = 0;
     priv->axis_pos = -1.0;
     priv->angle_step = -1.0;
@@ -530,7 +1248,13 @@ ufo_backproject_task_init (UfoBackprojectTask *self)
     priv->cos_lut = NULL;
     priv->host_sin_lut = NULL;
     priv->host_cos_lut = NULL;
+    priv->padded = NULL;
+    priv->padded_size = 0;
     priv->mode = MODE_TEXTURE;
+    priv->backend = BACKEND_AUTO;
+    priv->backend_resolved = FALSE;
+    priv->use_native = FALSE;
+    priv->accumulate_linear = accumulate_row_linear;
     priv->luts_changed = TRUE;
     priv->roi_x = priv->roi_y = 0;
     priv->roi_width = priv->roi_height = 0;
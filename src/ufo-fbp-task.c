@@ -0,0 +1,721 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+#include <math.h>
+
+#include "ufo-fbp-task.h"
+#include "common/ufo-fft.h"
+#include "common/ufo-filter-coefficients.h"
+
+/**
+ * SECTION:ufo-fbp-task
+ * @Short_description: Filtered backprojection of sinograms
+ * @Title: fbp
+ *
+ * Filters each sinogram row in the Fourier domain and backprojects the result
+ * in one task. The filtered sinogram is written directly into the texture
+ * read by the backprojection, which saves the intermediate buffers and graph
+ * edges of a fft ! filter ! ifft ! backproject pipeline.
+ */
+
+struct _UfoFbpTaskPrivate {
+    cl_context context;
+    cl_kernel spread_kernel;
+    cl_kernel filter_kernel;
+    cl_kernel pack_kernel;
+    cl_kernel backproject_kernel;
+    cl_mem filter_mem;
+    cl_mem spectrum_mem;
+    cl_mem sinogram_image;
+    cl_mem sin_lut;
+    cl_mem cos_lut;
+    UfoFft *fft;
+    UfoFftParameter fft_param;
+    UfoFilterParameter filter_param;
+    gsize width;
+    gsize height;
+    gdouble axis_pos;
+    gdouble angle_step;
+    gdouble angle_offset;
+    gdouble real_angle_step;
+    gboolean luts_changed;
+    gboolean filter_changed;
+    guint offset;
+    guint n_projections;
+    guint roi_x;
+    guint roi_y;
+    gint roi_width;
+    gint roi_height;
+};
+
+static void ufo_task_interface_init (UfoTaskIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (UfoFbpTask, ufo_fbp_task, UFO_TYPE_TASK_NODE,
+                         G_IMPLEMENT_INTERFACE (UFO_TYPE_TASK,
+                                                ufo_task_interface_init))
+
+#define UFO_FBP_TASK_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_FBP_TASK, UfoFbpTaskPrivate))
+
+enum {
+    PROP_0,
+    PROP_FILTER,
+    PROP_CUTOFF,
+    PROP_BW_ORDER,
+    PROP_FB_TAU,
+    PROP_FB_THETA,
+    PROP_SCALE,
+    PROP_NUM_PROJECTIONS,
+    PROP_OFFSET,
+    PROP_AXIS_POSITION,
+    PROP_ANGLE_STEP,
+    PROP_ANGLE_OFFSET,
+    PROP_ROI_X,
+    PROP_ROI_Y,
+    PROP_ROI_WIDTH,
+    PROP_ROI_HEIGHT,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES] = { NULL, };
+
+UfoNode *
+ufo_fbp_task_new (void)
+{
+    return UFO_NODE (g_object_new (UFO_TYPE_FBP_TASK, NULL));
+}
+
+static guint32
+pow2round(guint32 x)
+{
+    --x;
+    x |= x >> 1;
+    x |= x >> 2;
+    x |= x >> 4;
+    x |= x >> 8;
+    x |= x >> 16;
+    return x+1;
+}
+
+static void
+release_mem (cl_mem *mem)
+{
+    if (*mem != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (*mem));
+        *mem = NULL;
+    }
+}
+
+static void
+release_kernel (cl_kernel *kernel)
+{
+    if (*kernel != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (*kernel));
+        *kernel = NULL;
+    }
+}
+
+static gboolean
+ufo_fbp_task_process (UfoTask *task,
+                      UfoBuffer **inputs,
+                      UfoBuffer *output,
+                      UfoRequisition *requisition)
+{
+    UfoFbpTaskPrivate *priv;
+    UfoProfiler *profiler;
+    cl_command_queue queue;
+    cl_mem in_mem;
+    cl_mem out_mem;
+    cl_int width;
+    cl_int height;
+    gfloat axis_pos;
+    gfloat scale;
+    guint n_projections;
+    gsize spectrum_size[2];
+
+    priv = UFO_FBP_TASK_GET_PRIVATE (task);
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+    queue = ufo_gpu_node_get_cmd_queue (UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task))));
+    in_mem = ufo_buffer_get_device_array (inputs[0], queue);
+    out_mem = ufo_buffer_get_device_array (output, queue);
+
+    width = (cl_int) priv->width;
+    height = (cl_int) priv->height;
+    spectrum_size[0] = priv->fft_param.size[0];
+    spectrum_size[1] = priv->height;
+
+    /* Zero-padded complex rows */
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 0, sizeof (cl_mem), &priv->spectrum_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 1, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 2, sizeof (cl_int), &width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 3, sizeof (cl_int), &height));
+    ufo_profiler_call (profiler, queue, priv->spread_kernel, 2, spectrum_size, NULL);
+
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler,
+                                                priv->spectrum_mem, priv->spectrum_mem,
+                                                UFO_FFT_FORWARD, 0, NULL, NULL));
+
+    /* The filter kernel works on interleaved floats */
+    spectrum_size[0] *= 2;
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->filter_kernel, 0, sizeof (cl_mem), &priv->spectrum_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->filter_kernel, 1, sizeof (cl_mem), &priv->spectrum_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->filter_kernel, 2, sizeof (cl_mem), &priv->filter_mem));
+    ufo_profiler_call (profiler, queue, priv->filter_kernel, 2, spectrum_size, NULL);
+    spectrum_size[0] /= 2;
+
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler,
+                                                priv->spectrum_mem, priv->spectrum_mem,
+                                                UFO_FFT_BACKWARD, 0, NULL, NULL));
+
+    /* Crop and scale the real part into the texture like ifft with
+     * crop-width set to the sinogram width */
+    scale = 1.0f / ((gfloat) priv->width);
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->pack_kernel, 0, sizeof (cl_mem), &priv->spectrum_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->pack_kernel, 1, sizeof (cl_mem), &priv->sinogram_image));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->pack_kernel, 2, sizeof (cl_int), &width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->pack_kernel, 3, sizeof (gfloat), &scale));
+    ufo_profiler_call (profiler, queue, priv->pack_kernel, 2, spectrum_size, NULL);
+
+    /* Guess axis position if they are not provided by the user. */
+    axis_pos = priv->axis_pos <= 0.0 ? ((gfloat) priv->width) / 2.0f : (gfloat) priv->axis_pos;
+    n_projections = (guint) priv->height;
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->backproject_kernel, 0, sizeof (cl_mem), &priv->sinogram_image));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->backproject_kernel, 1, sizeof (cl_mem), &out_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->backproject_kernel, 2, sizeof (cl_mem), &priv->sin_lut));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->backproject_kernel, 3, sizeof (cl_mem), &priv->cos_lut));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->backproject_kernel, 4, sizeof (guint),  &priv->roi_x));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->backproject_kernel, 5, sizeof (guint),  &priv->roi_y));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->backproject_kernel, 6, sizeof (guint),  &priv->offset));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->backproject_kernel, 7, sizeof (guint),  &n_projections));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->backproject_kernel, 8, sizeof (gfloat), &axis_pos));
+    ufo_profiler_call (profiler, queue, priv->backproject_kernel, 2, requisition->dims, NULL);
+
+    return TRUE;
+}
+
+static void
+ufo_fbp_task_setup (UfoTask *task,
+                    UfoResources *resources,
+                    GError **error)
+{
+    UfoFbpTaskPrivate *priv;
+
+    priv = UFO_FBP_TASK_GET_PRIVATE (task);
+
+    priv->context = ufo_resources_get_context (resources);
+    UFO_RESOURCES_CHECK_CLERR (clRetainContext (priv->context));
+
+    priv->spread_kernel = ufo_resources_get_kernel (resources, "fft.cl", "fft_spread", error);
+    priv->filter_kernel = ufo_resources_get_kernel (resources, "filter.cl", "filter", error);
+    priv->pack_kernel = ufo_resources_get_kernel (resources, "fft.cl", "fft_pack_image", error);
+    priv->backproject_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_tex", error);
+
+    if (priv->spread_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->spread_kernel));
+
+    if (priv->filter_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->filter_kernel));
+
+    if (priv->pack_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->pack_kernel));
+
+    if (priv->backproject_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->backproject_kernel));
+}
+
+static cl_mem
+create_lut_buffer (UfoFbpTaskPrivate *priv,
+                   gsize n_entries,
+                   double (*func)(double))
+{
+    cl_int errcode;
+    gsize size = n_entries * sizeof (gfloat);
+    gfloat *host_mem;
+    cl_mem mem = NULL;
+
+    host_mem = g_malloc (size);
+
+    for (guint i = 0; i < n_entries; i++)
+        host_mem[i] = (gfloat) func (priv->angle_offset + i * priv->real_angle_step);
+
+    mem = clCreateBuffer (priv->context,
+                          CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
+                          size, host_mem,
+                          &errcode);
+
+    UFO_RESOURCES_CHECK_CLERR (errcode);
+    g_free (host_mem);
+    return mem;
+}
+
+static void
+ufo_fbp_task_get_requisition (UfoTask *task,
+                              UfoBuffer **inputs,
+                              UfoRequisition *requisition)
+{
+    UfoFbpTaskPrivate *priv;
+    UfoRequisition in_req;
+    cl_command_queue queue;
+
+    priv = UFO_FBP_TASK_GET_PRIVATE (task);
+    queue = ufo_gpu_node_get_cmd_queue (UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task))));
+    ufo_buffer_get_requisition (inputs[0], &in_req);
+
+    /* If the number of projections is not specified use the input size */
+    if (priv->n_projections == 0)
+        priv->n_projections = (guint) in_req.dims[1];
+
+    if (in_req.dims[1] > priv->n_projections) {
+        g_error ("Total number of projections (%u) must be greater than "
+                 "or equal to sinogram height (%u)", priv->n_projections, (guint) in_req.dims[1]);
+    }
+
+    if (priv->width != in_req.dims[0] || priv->height != in_req.dims[1]) {
+        cl_image_format format;
+        cl_int err;
+
+        priv->width = in_req.dims[0];
+        priv->height = in_req.dims[1];
+
+        /* Same transform as fft with auto-zeropadding */
+        priv->fft_param.dimensions = UFO_FFT_1D;
+        priv->fft_param.size[0] = pow2round ((guint32) priv->width);
+        priv->fft_param.size[1] = 1;
+        priv->fft_param.size[2] = 1;
+        priv->fft_param.batch = priv->height;
+        priv->fft_param.zeropad = TRUE;
+        priv->fft_param.real = FALSE;
+        UFO_RESOURCES_CHECK_CLERR (ufo_fft_update (priv->fft, priv->context, queue, &priv->fft_param));
+
+        release_mem (&priv->spectrum_mem);
+        release_mem (&priv->sinogram_image);
+
+        priv->spectrum_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE,
+                                             2 * priv->fft_param.size[0] * priv->height * sizeof (gfloat),
+                                             NULL, &err);
+        UFO_RESOURCES_CHECK_CLERR (err);
+
+        format.image_channel_order = CL_R;
+        format.image_channel_data_type = CL_FLOAT;
+        priv->sinogram_image = clCreateImage2D (priv->context, CL_MEM_READ_WRITE, &format,
+                                                priv->width, priv->height, 0, NULL, &err);
+        UFO_RESOURCES_CHECK_CLERR (err);
+
+        priv->filter_changed = TRUE;
+    }
+
+    if (priv->filter_changed) {
+        if (priv->filter_mem != NULL)
+            ufo_filter_coefficients_release (priv->filter_mem);
+
+        priv->filter_mem = ufo_filter_coefficients_acquire (&priv->filter_param,
+                                                            (guint) (2 * priv->fft_param.size[0]),
+                                                            priv->context, queue,
+                                                            ufo_task_node_get_profiler (UFO_TASK_NODE (task)));
+        priv->filter_changed = FALSE;
+    }
+
+    if (priv->real_angle_step < 0.0) {
+        if (priv->angle_step <= 0.0)
+            priv->real_angle_step = G_PI / ((gdouble) priv->n_projections);
+        else
+            priv->real_angle_step = priv->angle_step;
+    }
+
+    if (priv->luts_changed) {
+        release_mem (&priv->sin_lut);
+        release_mem (&priv->cos_lut);
+        priv->sin_lut = create_lut_buffer (priv, priv->n_projections, sin);
+        priv->cos_lut = create_lut_buffer (priv, priv->n_projections, cos);
+        priv->luts_changed = FALSE;
+    }
+
+    requisition->n_dims = 2;
+    requisition->dims[0] = priv->roi_width == 0 ? in_req.dims[0] : (gsize) priv->roi_width;
+    requisition->dims[1] = priv->roi_height == 0 ? in_req.dims[0] : (gsize) priv->roi_height;
+}
+
+static guint
+ufo_fbp_task_get_num_inputs (UfoTask *task)
+{
+    return 1;
+}
+
+static guint
+ufo_fbp_task_get_num_dimensions (UfoTask *task,
+                                 guint input)
+{
+    g_return_val_if_fail (input == 0, 0);
+    return 2;
+}
+
+static UfoTaskMode
+ufo_fbp_task_get_mode (UfoTask *task)
+{
+    return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
+}
+
+static gboolean
+ufo_fbp_task_equal_real (UfoNode *n1,
+                         UfoNode *n2)
+{
+    g_return_val_if_fail (UFO_IS_FBP_TASK (n1) && UFO_IS_FBP_TASK (n2), FALSE);
+    return TRUE;
+}
+
+static void
+ufo_fbp_task_finalize (GObject *object)
+{
+    UfoFbpTaskPrivate *priv;
+
+    priv = UFO_FBP_TASK_GET_PRIVATE (object);
+
+    release_kernel (&priv->spread_kernel);
+    release_kernel (&priv->filter_kernel);
+    release_kernel (&priv->pack_kernel);
+    release_kernel (&priv->backproject_kernel);
+
+    if (priv->filter_mem != NULL) {
+        ufo_filter_coefficients_release (priv->filter_mem);
+        priv->filter_mem = NULL;
+    }
+
+    release_mem (&priv->spectrum_mem);
+    release_mem (&priv->sinogram_image);
+    release_mem (&priv->sin_lut);
+    release_mem (&priv->cos_lut);
+
+    if (priv->fft != NULL) {
+        ufo_fft_destroy (priv->fft);
+        priv->fft = NULL;
+    }
+
+    if (priv->context) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
+        priv->context = NULL;
+    }
+
+    G_OBJECT_CLASS (ufo_fbp_task_parent_class)->finalize (object);
+}
+
+static void
+ufo_task_interface_init (UfoTaskIface *iface)
+{
+    iface->setup = ufo_fbp_task_setup;
+    iface->get_requisition = ufo_fbp_task_get_requisition;
+    iface->get_num_inputs = ufo_fbp_task_get_num_inputs;
+    iface->get_num_dimensions = ufo_fbp_task_get_num_dimensions;
+    iface->get_mode = ufo_fbp_task_get_mode;
+    iface->process = ufo_fbp_task_process;
+}
+
+static void
+ufo_fbp_task_set_property (GObject *object,
+                           guint property_id,
+                           const GValue *value,
+                           GParamSpec *pspec)
+{
+    UfoFbpTaskPrivate *priv = UFO_FBP_TASK_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_FILTER:
+            priv->filter_param.type = g_value_get_enum (value);
+            priv->filter_changed = TRUE;
+            break;
+        case PROP_CUTOFF:
+            priv->filter_param.cutoff = g_value_get_float (value);
+            priv->filter_changed = TRUE;
+            break;
+        case PROP_BW_ORDER:
+            priv->filter_param.bw_order = g_value_get_float (value);
+            priv->filter_changed = TRUE;
+            break;
+        case PROP_FB_TAU:
+            priv->filter_param.fb_tau = g_value_get_float (value);
+            priv->filter_changed = TRUE;
+            break;
+        case PROP_FB_THETA:
+            priv->filter_param.fb_theta = g_value_get_float (value);
+            priv->filter_changed = TRUE;
+            break;
+        case PROP_SCALE:
+            priv->filter_param.scale = g_value_get_float (value);
+            priv->filter_changed = TRUE;
+            break;
+        case PROP_NUM_PROJECTIONS:
+            priv->n_projections = g_value_get_uint (value);
+            break;
+        case PROP_OFFSET:
+            priv->offset = g_value_get_uint (value);
+            break;
+        case PROP_AXIS_POSITION:
+            priv->axis_pos = g_value_get_double (value);
+            break;
+        case PROP_ANGLE_STEP:
+            priv->angle_step = g_value_get_double (value);
+            break;
+        case PROP_ANGLE_OFFSET:
+            priv->angle_offset = g_value_get_double (value);
+            priv->luts_changed = TRUE;
+            break;
+        case PROP_ROI_X:
+            priv->roi_x = g_value_get_uint (value);
+            break;
+        case PROP_ROI_Y:
+            priv->roi_y = g_value_get_uint (value);
+            break;
+        case PROP_ROI_WIDTH:
+            priv->roi_width = g_value_get_uint (value);
+            break;
+        case PROP_ROI_HEIGHT:
+            priv->roi_height = g_value_get_uint (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_fbp_task_get_property (GObject *object,
+                           guint property_id,
+                           GValue *value,
+                           GParamSpec *pspec)
+{
+    UfoFbpTaskPrivate *priv = UFO_FBP_TASK_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_FILTER:
+            g_value_set_enum (value, priv->filter_param.type);
+            break;
+        case PROP_CUTOFF:
+            g_value_set_float (value, priv->filter_param.cutoff);
+            break;
+        case PROP_BW_ORDER:
+            g_value_set_float (value, priv->filter_param.bw_order);
+            break;
+        case PROP_FB_TAU:
+            g_value_set_float (value, priv->filter_param.fb_tau);
+            break;
+        case PROP_FB_THETA:
+            g_value_set_float (value, priv->filter_param.fb_theta);
+            break;
+        case PROP_SCALE:
+            g_value_set_float (value, priv->filter_param.scale);
+            break;
+        case PROP_NUM_PROJECTIONS:
+            g_value_set_uint (value, priv->n_projections);
+            break;
+        case PROP_OFFSET:
+            g_value_set_uint (value, priv->offset);
+            break;
+        case PROP_AXIS_POSITION:
+            g_value_set_double (value, priv->axis_pos);
+            break;
+        case PROP_ANGLE_STEP:
+            g_value_set_double (value, priv->angle_step);
+            break;
+        case PROP_ANGLE_OFFSET:
+            g_value_set_double (value, priv->angle_offset);
+            break;
+        case PROP_ROI_X:
+            g_value_set_uint (value, priv->roi_x);
+            break;
+        case PROP_ROI_Y:
+            g_value_set_uint (value, priv->roi_y);
+            break;
+        case PROP_ROI_WIDTH:
+            g_value_set_uint (value, priv->roi_width);
+            break;
+        case PROP_ROI_HEIGHT:
+            g_value_set_uint (value, priv->roi_height);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_fbp_task_class_init (UfoFbpTaskClass *klass)
+{
+    GObjectClass *oclass;
+    UfoNodeClass *node_class;
+    const gfloat limit = (gfloat) (4.0 * G_PI);
+
+    oclass = G_OBJECT_CLASS (klass);
+    node_class = UFO_NODE_CLASS (klass);
+
+    oclass->finalize = ufo_fbp_task_finalize;
+    oclass->set_property = ufo_fbp_task_set_property;
+    oclass->get_property = ufo_fbp_task_get_property;
+
+    properties[PROP_FILTER] =
+        g_param_spec_enum ("filter",
+            "Type of filter (\"ramp\", \"ramp-fromreal\", \"butterworth\", \"faris-byer\", \"hamming\")",
+            "Type of filter (\"ramp\", \"ramp-fromreal\", \"butterworth\", \"faris-byer\", \"hamming\")",
+            g_enum_register_static ("UfoFbpFilter", ufo_filter_type_values),
+            UFO_FILTER_RAMP_FROMREAL, G_PARAM_READWRITE);
+
+    properties[PROP_CUTOFF] =
+        g_param_spec_float ("cutoff",
+            "Relative cutoff frequency",
+            "Relative cutoff frequency",
+            0.0f, 1.0f, 0.5f,
+            G_PARAM_READWRITE);
+
+    properties[PROP_BW_ORDER] =
+        g_param_spec_float ("order",
+            "Order of the Butterworth filter",
+            "Order of the Butterworth filter",
+            2.0f, 32.0f, 4.0f,
+            G_PARAM_READWRITE);
+
+    properties[PROP_FB_TAU] =
+        g_param_spec_float ("tau",
+            "Tau parameter for Faris-Byer filter",
+            "Tau parameter for Faris-Byer filter",
+            -G_MAXFLOAT, G_MAXFLOAT, 1.0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_FB_THETA] =
+        g_param_spec_float ("theta",
+            "Theta parameter for Faris-Byer filter",
+            "Theta parameter for Faris-Byer filter",
+            -G_MAXFLOAT, G_MAXFLOAT, 1.0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_SCALE] =
+        g_param_spec_float ("scale",
+            "Every component is multiplied by scale",
+            "Every component is multiplied by scale",
+            -G_MAXFLOAT, G_MAXFLOAT, 1.0f,
+            G_PARAM_READWRITE);
+
+    properties[PROP_NUM_PROJECTIONS] =
+        g_param_spec_uint ("num-projections",
+            "Number of projections between 0 and 180 degrees",
+            "Number of projections between 0 and 180 degrees",
+            0, +8192, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_OFFSET] =
+        g_param_spec_uint ("offset",
+            "Offset to the first projection",
+            "Offset to the first projection",
+            0, +8192, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_AXIS_POSITION] =
+        g_param_spec_double ("axis-pos",
+            "Position of rotation axis",
+            "Position of rotation axis",
+            -1.0, +8192.0, 0.0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_ANGLE_STEP] =
+        g_param_spec_double ("angle-step",
+            "Increment of angle in radians",
+            "Increment of angle in radians",
+            -limit, +limit, 0.0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_ANGLE_OFFSET] =
+        g_param_spec_double ("angle-offset",
+            "Angle offset in radians",
+            "Angle offset in radians determining the first angle position",
+            0.0, +limit, 0.0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_ROI_X] =
+        g_param_spec_uint ("roi-x",
+            "X coordinate of region of interest",
+            "X coordinate of region of interest",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_ROI_Y] =
+        g_param_spec_uint ("roi-y",
+            "Y coordinate of region of interest",
+            "Y coordinate of region of interest",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_ROI_WIDTH] =
+        g_param_spec_uint ("roi-width",
+            "Width of region of interest",
+            "Width of region of interest",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_ROI_HEIGHT] =
+        g_param_spec_uint ("roi-height",
+            "Height of region of interest",
+            "Height of region of interest",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
+        g_object_class_install_property (oclass, i, properties[i]);
+
+    node_class->equal = ufo_fbp_task_equal_real;
+
+    g_type_class_add_private(klass, sizeof(UfoFbpTaskPrivate));
+}
+
+static void
+ufo_fbp_task_init (UfoFbpTask *self)
+{
+    UfoFbpTaskPrivate *priv;
+    self->priv = priv = UFO_FBP_TASK_GET_PRIVATE (self);
+    priv->context = NULL;
+    priv->spread_kernel = NULL;
+    priv->filter_kernel = NULL;
+    priv->pack_kernel = NULL;
+    priv->backproject_kernel = NULL;
+    priv->filter_mem = NULL;
+    priv->spectrum_mem = NULL;
+    priv->sinogram_image = NULL;
+    priv->sin_lut = NULL;
+    priv->cos_lut = NULL;
+    priv->fft = ufo_fft_new ();
+    priv->width = 0;
+    priv->height = 0;
+    priv->filter_param.type = UFO_FILTER_RAMP_FROMREAL;
+    priv->filter_param.cutoff = 0.5f;
+    priv->filter_param.bw_order = 4.0f;
+    priv->filter_param.fb_tau = 0.1f;
+    priv->filter_param.fb_theta = 1.0f;
+    priv->filter_param.scale = 1.0f;
+    priv->filter_changed = TRUE;
+    priv->n_projections = 0;
+    priv->offset = 0;
+    priv->axis_pos = -1.0;
+    priv->angle_step = -1.0;
+    priv->angle_offset = 0.0;
+    priv->real_angle_step = -1.0;
+    priv->luts_changed = TRUE;
+    priv->roi_x = priv->roi_y = 0;
+    priv->roi_width = priv->roi_height = 0;
+}
@@ -35,8 +35,11 @@ struct _UfoFftTaskPrivate {
 
     cl_context context;
     cl_kernel kernel;
+    cl_mem padded_mem;
+    gsize padded_size;
 
     gboolean zeropad;
+    gboolean real;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -54,6 +57,7 @@ enum {
     PROP_SIZE_X,
     PROP_SIZE_Y,
     PROP_SIZE_Z,
+    PROP_REAL,
     N_PROPERTIES
 };
 
@@ -86,8 +90,15 @@ ufo_fft_task_setup (UfoTask *task,
 
     priv = UFO_FFT_TASK_GET_PRIVATE (task);
 
+    if (priv->real && !ufo_fft_supports_real ()) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "Real-to-complex transforms require clFFT or FFTW");
+        return;
+    }
+
     if (priv->zeropad) {
-        priv->kernel = ufo_resources_get_kernel (resources, "fft.cl", "fft_spread", error);
+        priv->kernel = ufo_resources_get_kernel (resources, "fft.cl",
+                                                 priv->real ? "fft_pad_real" : "fft_spread", error);
     }
 
     priv->context = ufo_resources_get_context (resources);
@@ -110,8 +121,12 @@ ufo_fft_task_get_requisition (UfoTask *task,
     priv = UFO_FFT_TASK_GET_PRIVATE (task);
     ufo_buffer_get_requisition (inputs[0], &in_req);
 
+    /* Without zeropadding, complex input is expected unless transforming
+     * real data */
     priv->param.zeropad = priv->zeropad;
-    priv->param.size[0] = priv->zeropad ? pow2round (in_req.dims[0]) : in_req.dims[0] / 2;
+    priv->param.real = priv->real;
+    priv->param.size[0] = priv->zeropad ? pow2round (in_req.dims[0]) :
+                          (priv->real ? in_req.dims[0] : in_req.dims[0] / 2);
 
     switch (priv->param.dimensions) {
         case UFO_FFT_1D:
@@ -131,8 +146,25 @@ ufo_fft_task_get_requisition (UfoTask *task,
     UFO_RESOURCES_CHECK_CLERR (ufo_fft_update (priv->fft, priv->context, queue, &priv->param));
 
     *requisition = in_req;  /* keep third dimension for 2D batching */
-    requisition->dims[0] = 2 * priv->param.size[0];
+    requisition->dims[0] = priv->real ? 2 * (priv->param.size[0] / 2 + 1) : 2 * priv->param.size[0];
     requisition->dims[1] = priv->param.dimensions == UFO_FFT_1D ? in_req.dims[1] : priv->param.size[1];
+
+    if (priv->real && priv->zeropad) {
+        /* Real transforms are out-of-place, pad into a separate buffer */
+        gsize size = priv->param.size[0] * requisition->dims[1] *
+                     (requisition->n_dims == 3 ? requisition->dims[2] : 1) * sizeof (gfloat);
+
+        if (size != priv->padded_size) {
+            cl_int err;
+
+            if (priv->padded_mem != NULL)
+                UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->padded_mem));
+
+            priv->padded_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE, size, NULL, &err);
+            UFO_RESOURCES_CHECK_CLERR (err);
+            priv->padded_size = size;
+        }
+    }
 }
 
 static guint
@@ -188,15 +220,17 @@ ufo_fft_task_process (UfoTask *task,
     ufo_buffer_get_requisition (inputs[0], &in_req);
 
     if (priv->zeropad){
+        cl_mem pad_mem = priv->real ? priv->padded_mem : out_mem;
+
         width = (cl_int) in_req.dims[0];
         height = (cl_int) in_req.dims[1];
 
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 0, sizeof (cl_mem), (gpointer) &out_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 0, sizeof (cl_mem), (gpointer) &pad_mem));
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 1, sizeof (cl_mem), (gpointer) &in_mem));
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 2, sizeof (cl_int), &width));
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 3, sizeof (cl_int), &height));
 
-        global_work_size[0] = requisition->dims[0] >> 1;
+        global_work_size[0] = priv->real ? priv->param.size[0] : requisition->dims[0] >> 1;
         global_work_size[1] = requisition->dims[1];
         global_work_size[2] = requisition->n_dims == 3 ? requisition->dims[2] : 1;
 
@@ -205,9 +239,11 @@ ufo_fft_task_process (UfoTask *task,
                                                            0, NULL, NULL));
     }
 
+    if (priv->zeropad)
+        in_mem = priv->real ? priv->padded_mem : out_mem;
+
     UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler,
-                                                priv->zeropad ? out_mem : in_mem,
-                                                out_mem, UFO_FFT_FORWARD,
+                                                in_mem, out_mem, UFO_FFT_FORWARD,
                                                 0, NULL, NULL));
 
     return TRUE;
@@ -225,6 +261,11 @@ ufo_fft_task_finalize (GObject *object)
         priv->kernel = NULL;
     }
 
+    if (priv->padded_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->padded_mem));
+        priv->padded_mem = NULL;
+    }
+
     if (priv->context) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
         priv->context = NULL;
@@ -273,6 +314,9 @@ ufo_fft_task_set_property (GObject *object,
         case PROP_SIZE_Z:
             priv->param.size[2] = g_value_get_uint (value);
             break;
+        case PROP_REAL:
+            priv->real = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -303,6 +347,9 @@ ufo_fft_task_get_property (GObject *object,
         case PROP_SIZE_Z:
             g_value_set_uint (value, priv->param.size[2]);
             break;
+        case PROP_REAL:
+            g_value_set_boolean (value, priv->real);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -357,6 +404,13 @@ ufo_fft_task_class_init (UfoFftTaskClass *klass)
             1, 8192, 1,
             G_PARAM_READWRITE);
 
+    properties[PROP_REAL] =
+        g_param_spec_boolean("real",
+            "Real-to-complex transform producing only the non-redundant half spectrum",
+            "Real-to-complex transform producing only the non-redundant half spectrum",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -373,7 +427,10 @@ ufo_fft_task_init (UfoFftTask *self)
     self->priv = priv = UFO_FFT_TASK_GET_PRIVATE (self);
 
     priv->kernel = NULL;
+    priv->padded_mem = NULL;
+    priv->padded_size = 0;
     priv->zeropad = TRUE;
+    priv->real = FALSE;
     priv->fft = ufo_fft_new ();
     priv->param.dimensions = UFO_FFT_1D;
     priv->param.size[0] = 1;
@@ -22,10 +22,9 @@
 #else
 #include <CL/cl.h>
 #endif
-#include <math.h>
 
 #include "ufo-filter-task.h"
-#include "common/ufo-fft.h"
+#include "common/ufo-filter-coefficients.h"
 
 /**
  * SECTION:ufo-filter-task
@@ -37,51 +36,18 @@
  * #UfoFilterTask:filter property.
  */
 
-typedef void (*SetupFunc)(UfoFilterTaskPrivate *priv, gfloat *coefficients, guint width);
-
 static void ufo_task_interface_init (UfoTaskIface *iface);
-static void compute_ramp_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-static void compute_real_space_ramp_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-static void compute_butterworth_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-static void compute_faris_byer_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-static void compute_hamming_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-
-typedef enum {
-    FILTER_RAMP = 0,
-    FILTER_RAMP_FROMREAL,
-    FILTER_BUTTERWORTH,
-    FILTER_FARIS_BYER,
-    FILTER_HAMMING,
-} Filter;
-
-static GEnumValue filter_values[] = {
-    { FILTER_RAMP,          "FILTER_RAMP",          "ramp" },
-    { FILTER_RAMP_FROMREAL, "FILTER_RAMP_FROMREAL", "ramp-fromreal" },
-    { FILTER_BUTTERWORTH,   "FILTER_BUTTERWORTH",   "butterworth"},
-    { FILTER_FARIS_BYER,    "FILTER_FARIS_BYER",    "faris-byer"},
-    { FILTER_HAMMING,       "FILTER_HAMMING",       "hamming"},
-    { 0, NULL, NULL}
-};
-
-static SetupFunc filter_funcs[] = {
-    &compute_ramp_coefficients,
-    &compute_real_space_ramp_coefficients,
-    &compute_butterworth_coefficients,
-    &compute_faris_byer_coefficients,
-    &compute_hamming_coefficients,
-};
 
 struct _UfoFilterTaskPrivate {
     cl_context context;
     cl_kernel kernel;
     cl_mem filter_mem;
-    gfloat cutoff;
-    gfloat bw_order;
-    gfloat fb_tau;
-    gfloat fb_theta;
-    gfloat scale;
-    Filter filter;
-    UfoFft *fft;
+    guint filter_width;
+    GList *precomputed;
+    guint precompute_min_width;
+    guint precompute_max_width;
+    UfoFilterParameter param;
+    gboolean half_spectrum;
 };
 
 G_DEFINE_TYPE_WITH_CODE (UfoFilterTask, ufo_filter_task, UFO_TYPE_TASK_NODE,
@@ -98,6 +64,9 @@ enum {
     PROP_FB_TAU,
     PROP_FB_THETA,
     PROP_SCALE,
+    PROP_HALF_SPECTRUM,
+    PROP_PRECOMPUTE_MIN_WIDTH,
+    PROP_PRECOMPUTE_MAX_WIDTH,
     N_PROPERTIES
 };
 
@@ -109,6 +78,18 @@ ufo_filter_task_new (void)
     return UFO_NODE (g_object_new (UFO_TYPE_FILTER_TASK, NULL));
 }
 
+static guint32
+pow2round(guint32 x)
+{
+    --x;
+    x |= x >> 1;
+    x |= x >> 2;
+    x |= x >> 4;
+    x |= x >> 8;
+    x |= x >> 16;
+    return x+1;
+}
+
 static gboolean
 ufo_filter_task_process (UfoTask *task,
                          UfoBuffer **inputs,
@@ -152,105 +133,21 @@ ufo_filter_task_setup (UfoTask *task,
 
     if (priv->kernel != NULL)
         UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->kernel));
-}
-
-static void
-mirror_coefficients (gfloat *filter, guint width)
-{
-    for (guint k = width/2 + 2; k < width; k += 2) {
-        filter[k] = filter[width - k];
-        filter[k + 1] = filter[width - k + 1];
-    }
-}
-
-static void
-compute_ramp_coefficients (UfoFilterTaskPrivate *priv,
-                           gfloat *filter,
-                           guint width)
-{
-    const gdouble step = 2.0 / width;
-
-    for (guint k = 1; k < width / 4 + 1; k++) {
-        filter[2*k] = k * step * priv->scale;
-        filter[2*k + 1] = filter[2*k];
-    }
-}
-
-static void
-compute_real_space_ramp_coefficients (UfoFilterTaskPrivate *priv,
-                                      gfloat *filter,
-                                      guint width)
-{
-    filter[0] = filter[1] = 0.25;
-
-    for (guint k = 1; k < width / 4 + 1; k++) {
-        filter[2*k] = k % 2 ? - 1 / (k * k * G_PI * G_PI) : 0.0;
-        filter[2*k + 1] = filter[2*k];
-    }
-}
-
-static void
-compute_butterworth_coefficients (UfoFilterTaskPrivate *priv,
-                                  gfloat *filter,
-                                  guint width)
-{
-    const gdouble step = 2.0 / width;
-
-    for (guint k = 0; k < (width / 4) + 1; k++) {
-        const gdouble f = k * step;
-        filter[2*k] = (gfloat) (f / (1.0 + pow (f / priv->cutoff, 2.0 * priv->bw_order)) * priv->scale);
-        filter[2*k+1] = filter[2*k];
-    }
-}
-
-static void
-compute_hamming_coefficients (UfoFilterTaskPrivate *priv,
-                              gfloat *filter,
-                              guint width)
-{
-    const gdouble step = 2.0 / width;
 
-    for (guint k = 0; k < (width / 4) + 1; k++) {
-        const gdouble f = k * step;
+    if (priv->precompute_max_width > 0) {
+        cl_command_queue queue;
+        UfoProfiler *profiler;
+        guint32 last;
 
-        filter[2*k] = f < priv->cutoff ? f * (0.54 + 0.46 * cos (G_PI * f / priv->cutoff)) * priv->scale : 0;
-        filter[2*k+1] = filter[2*k];
-    }
-}
-
-static guint
-get_padding_value (guint x)
-{
-    guint padding = 2 * x;
-    guint result = 1;
+        /* Zero-padded transforms of all sinogram widths in the range */
+        queue = g_list_nth_data (ufo_resources_get_cmd_queues (resources), 0);
+        profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+        last = pow2round (priv->precompute_max_width);
 
-    while (result < padding)
-        result *= 2;
-
-    return result;
-}
-
-static void
-compute_faris_byer_coefficients (UfoFilterTaskPrivate *priv,
-                                 gfloat *filter,
-                                 guint width)
-{
-    const gdouble pi_squared_tau = G_PI * G_PI * priv->fb_tau;
-    const gdouble sin_theta_2 = - sin (priv->fb_theta) / 2;
-    const guint padding = get_padding_value (width);
-
-    filter[0] = 0;
-
-    for (guint x = 1; x <= width / 2; x++) {
-        if (x % 2 != 0)
-            filter[x] = 1 / (pi_squared_tau * x);
-    }
-
-    for (guint i = width / 2 + 1; i < width; i++) {
-        guint x = width + 1 - i;
-
-        if (x % 2 != 0)
-            filter[padding - width - i - 1] = sin_theta_2 / (x * x * pi_squared_tau);
+        for (guint32 n = pow2round (MAX (priv->precompute_min_width, 1)); n <= last && n != 0; n *= 2) {
+            cl_mem mem = ufo_filter_coefficients_acquire (&priv->param, 2 * n, priv->context, queue, profiler);
+            priv->precomputed = g_list_append (priv->precomputed, mem);
+        }
     }
 }
 
@@ -260,50 +157,28 @@ ufo_filter_task_get_requisition (UfoTask *task,
                                  UfoRequisition *requisition)
 {
     UfoFilterTaskPrivate *priv;
+    guint width;
 
     priv = UFO_FILTER_TASK_GET_PRIVATE (task);
     ufo_buffer_get_requisition (inputs[0], requisition);
 
-    if (priv->filter_mem == NULL) {
-        cl_int cl_err;
-        guint width;
-        gfloat *coefficients;
-
-        width = (guint) requisition->dims[0];
-        coefficients = g_malloc0 (width * sizeof (gfloat));
-
-        coefficients[0] = 0.5 / width;
-        coefficients[1] = coefficients[0];
-
-        filter_funcs[priv->filter] (priv, coefficients, width);
-        mirror_coefficients (coefficients, width);
-
-        priv->filter_mem = clCreateBuffer (priv->context,
-                                           CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                                           width * sizeof(float),
-                                           coefficients,
-                                           &cl_err);
-        UFO_RESOURCES_CHECK_CLERR (cl_err);
-        g_free (coefficients);
-
-        if (priv->filter == FILTER_RAMP_FROMREAL) {
-            UfoFftParameter param;
-            cl_command_queue queue;
-            UfoProfiler *profiler;
-
-            param.dimensions = UFO_FFT_1D;
-            param.size[0] = requisition->dims[0] / 2;
-            param.size[1] = 1;
-            param.size[2] = 1;
-            param.batch = 1;
-
-            priv->fft = ufo_fft_new ();
-            profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-            queue = ufo_gpu_node_get_cmd_queue (UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task))));
-            UFO_RESOURCES_CHECK_CLERR (ufo_fft_update (priv->fft, priv->context, queue, &param));
-            UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler, priv->filter_mem, priv->filter_mem,
-                                                        UFO_FFT_FORWARD, 0, NULL, NULL));
-        }
+    /* A half spectrum of an even-sized transform has n / 2 + 1 complex
+     * values which are the first ones of the full spectrum */
+    width = (guint) requisition->dims[0];
+
+    if (priv->half_spectrum)
+        width = 2 * (width - 2);
+
+    if (priv->filter_mem == NULL || priv->filter_width != width) {
+        cl_command_queue queue;
+
+        if (priv->filter_mem != NULL)
+            ufo_filter_coefficients_release (priv->filter_mem);
+
+        queue = ufo_gpu_node_get_cmd_queue (UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task))));
+        priv->filter_mem = ufo_filter_coefficients_acquire (&priv->param, width, priv->context, queue,
+                                                            ufo_task_node_get_profiler (UFO_TASK_NODE (task)));
+        priv->filter_width = width;
     }
 }
 
@@ -348,14 +223,12 @@ ufo_filter_task_finalize (GObject *object)
     }
 
     if (priv->filter_mem) {
-        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->filter_mem));
+        ufo_filter_coefficients_release (priv->filter_mem);
         priv->filter_mem = NULL;
     }
 
-    if (priv->fft != NULL) {
-        ufo_fft_destroy (priv->fft);
-        priv->fft = NULL;
-    }
+    g_list_free_full (priv->precomputed, (GDestroyNotify) ufo_filter_coefficients_release);
+    priv->precomputed = NULL;
 
     G_OBJECT_CLASS (ufo_filter_task_parent_class)->finalize (object);
 }
@@ -381,22 +254,31 @@ ufo_filter_task_set_property (GObject *object,
 
     switch (property_id) {
         case PROP_FILTER:
-            priv->filter = g_value_get_enum (value);
+            priv->param.type = g_value_get_enum (value);
             break;
         case PROP_CUTOFF:
-            priv->cutoff = g_value_get_float (value);
+            priv->param.cutoff = g_value_get_float (value);
             break;
         case PROP_BW_ORDER:
-            priv->bw_order = g_value_get_float (value);
+            priv->param.bw_order = g_value_get_float (value);
             break;
         case PROP_FB_TAU:
-            priv->fb_tau = g_value_get_float (value);
+            priv->param.fb_tau = g_value_get_float (value);
             break;
         case PROP_FB_THETA:
-            priv->fb_theta = g_value_get_float (value);
+            priv->param.fb_theta = g_value_get_float (value);
             break;
         case PROP_SCALE:
-            priv->scale = g_value_get_float (value);
+            priv->param.scale = g_value_get_float (value);
+            break;
+        case PROP_HALF_SPECTRUM:
+            priv->half_spectrum = g_value_get_boolean (value);
+            break;
+        case PROP_PRECOMPUTE_MIN_WIDTH:
+            priv->precompute_min_width = g_value_get_uint (value);
+            break;
+        case PROP_PRECOMPUTE_MAX_WIDTH:
+            priv->precompute_max_width = g_value_get_uint (value);
             break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -414,22 +296,31 @@ ufo_filter_task_get_property (GObject *object,
 
     switch (property_id) {
         case PROP_FILTER:
-            g_value_set_enum (value, priv->filter);
+            g_value_set_enum (value, priv->param.type);
             break;
         case PROP_CUTOFF:
-            g_value_set_float (value, priv->cutoff);
+            g_value_set_float (value, priv->param.cutoff);
             break;
         case PROP_BW_ORDER:
-            g_value_set_float (value, priv->bw_order);
+            g_value_set_float (value, priv->param.bw_order);
             break;
         case PROP_FB_TAU:
-            g_value_set_float (value, priv->fb_tau);
+            g_value_set_float (value, priv->param.fb_tau);
             break;
         case PROP_FB_THETA:
-            g_value_set_float (value, priv->fb_theta);
+            g_value_set_float (value, priv->param.fb_theta);
             break;
         case PROP_SCALE:
-            g_value_set_float (value, priv->scale);
+            g_value_set_float (value, priv->param.scale);
+            break;
+        case PROP_HALF_SPECTRUM:
+            g_value_set_boolean (value, priv->half_spectrum);
+            break;
+        case PROP_PRECOMPUTE_MIN_WIDTH:
+            g_value_set_uint (value, priv->precompute_min_width);
+            break;
+        case PROP_PRECOMPUTE_MAX_WIDTH:
+            g_value_set_uint (value, priv->precompute_max_width);
             break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -454,7 +345,7 @@ ufo_filter_task_class_init (UfoFilterTaskClass *klass)
         g_param_spec_enum ("filter",
             "Type of filter (\"ramp\", \"ramp-fromreal\", \"butterworth\", \"faris-byer\", \"hamming\")",
             "Type of filter (\"ramp\", \"ramp-fromreal\", \"butterworth\", \"faris-byer\", \"hamming\")",
-            g_enum_register_static ("filter", filter_values),
+            g_enum_register_static ("filter", ufo_filter_type_values),
             0, G_PARAM_READWRITE);
 
     properties[PROP_CUTOFF] =
@@ -492,6 +383,27 @@ ufo_filter_task_class_init (UfoFilterTaskClass *klass)
             -G_MAXFLOAT, G_MAXFLOAT, 1.0f,
             G_PARAM_READWRITE);
 
+    properties[PROP_HALF_SPECTRUM] =
+        g_param_spec_boolean ("half-spectrum",
+            "Input is a half spectrum from a real-to-complex transform",
+            "Input is a half spectrum from a real-to-complex transform",
+            FALSE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_PRECOMPUTE_MIN_WIDTH] =
+        g_param_spec_uint ("precompute-min-width",
+            "Smallest sinogram width for which coefficients are computed at setup",
+            "Smallest sinogram width for which coefficients are computed at setup",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_PRECOMPUTE_MAX_WIDTH] =
+        g_param_spec_uint ("precompute-max-width",
+            "Largest sinogram width for which coefficients are computed at setup",
+            "Largest sinogram width for which coefficients are computed at setup, 0 disables precomputation",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -507,11 +419,15 @@ ufo_filter_task_init (UfoFilterTask *self)
     self->priv = priv = UFO_FILTER_TASK_GET_PRIVATE (self);
     priv->kernel = NULL;
     priv->filter_mem = NULL;
-    priv->filter = FILTER_RAMP_FROMREAL;
-    priv->cutoff = 0.5f;
-    priv->bw_order = 4.0f;
-    priv->fb_tau = 0.1f;
-    priv->fb_theta = 1.0f;
-    priv->scale = 1.0f;
-    priv->fft = NULL;
+    priv->filter_width = 0;
+    priv->precomputed = NULL;
+    priv->precompute_min_width = 0;
+    priv->precompute_max_width = 0;
+    priv->param.type = UFO_FILTER_RAMP_FROMREAL;
+    priv->param.cutoff = 0.5f;
+    priv->param.bw_order = 4.0f;
+    priv->param.fb_tau = 0.1f;
+    priv->param.fb_theta = 1.0f;
+    priv->param.scale = 1.0f;
+    priv->half_spectrum = FALSE;
 }
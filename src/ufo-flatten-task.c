@@ -18,18 +18,32 @@
  */
 
 #include <stdlib.h>
+#include <math.h>
 #include "ufo-flatten-task.h"
 
+/* Pixels of a row whose values along the stack are gathered at once */
+#define BLOCK_WIDTH 64
+/* Ranges up to this length are sorted instead of partitioned further */
+#define INSERTION_SORT_LENGTH 16
+
 typedef enum {
     M_0,
     M_MEDIAN,
+    M_MIN,
+    M_MAX,
+    M_SUM,
+    M_MEAN,
+    M_PERCENTILE,
+    M_TRIMMED_MEAN,
     M_LAST
 } Mode;
 
-static const gchar *modes[] = {"median"};
+static const gchar *modes[] = {"median", "min", "max", "sum", "mean", "percentile", "trimmed-mean"};
 
 struct _UfoFlattenTaskPrivate {
     Mode mode;
+    gfloat percentile;
+    gfloat trim;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -43,6 +57,8 @@ G_DEFINE_TYPE_WITH_CODE (UfoFlattenTask, ufo_flatten_task, UFO_TYPE_TASK_NODE,
 enum {
     PROP_0,
     PROP_MODE,
+    PROP_PERCENTILE,
+    PROP_TRIM,
     N_PROPERTIES
 };
 
@@ -100,10 +116,116 @@ ufo_flatten_task_get_mode (UfoTask *task)
     return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_CPU;
 }
 
-static int
-cmp_float (gconstpointer p1, gconstpointer p2)
+static void
+insertion_sort (gfloat *values, glong left, glong right)
+{
+    for (glong i = left + 1; i <= right; i++) {
+        gfloat value = values[i];
+        glong j = i - 1;
+
+        for (; j >= left && values[j] > value; j--)
+            values[j + 1] = values[j];
+
+        values[j + 1] = value;
+    }
+}
+
+/*
+ * Partially sort @values so that the @k-th smallest value is at index @k,
+ * no value before it is larger and no value after it is smaller.
+ */
+static gfloat
+select_kth (gfloat *values, gsize n, gsize k)
 {
-    return (int) (*((const gfloat *) p1) - *((const gfloat *) p2));
+    glong left = 0;
+    glong right = (glong) n - 1;
+
+    while (right - left >= INSERTION_SORT_LENGTH) {
+        glong i = left;
+        glong j = right;
+        gfloat pivot;
+        gfloat a = values[left];
+        gfloat b = values[(left + right) / 2];
+        gfloat c = values[right];
+
+        /* Median of three avoids the worst case for already sorted stacks */
+        pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+
+        while (i <= j) {
+            while (values[i] < pivot)
+                i++;
+
+            while (pivot < values[j])
+                j--;
+
+            if (i <= j) {
+                gfloat tmp = values[i];
+                values[i++] = values[j];
+                values[j--] = tmp;
+            }
+        }
+
+        if ((glong) k <= j)
+            right = j;
+        else if ((glong) k >= i)
+            left = i;
+        else
+            return values[k];
+    }
+
+    insertion_sort (values, left, right);
+    return values[k];
+}
+
+static gfloat
+reduce (gfloat *values, gsize depth, Mode mode, gfloat percentile, gfloat trim)
+{
+    gdouble sum = 0.0;
+    gfloat result;
+    gsize cut;
+
+    switch (mode) {
+        case M_MIN:
+            result = values[0];
+
+            for (gsize i = 1; i < depth; i++)
+                result = MIN (result, values[i]);
+
+            return result;
+        case M_MAX:
+            result = values[0];
+
+            for (gsize i = 1; i < depth; i++)
+                result = MAX (result, values[i]);
+
+            return result;
+        case M_SUM:
+        case M_MEAN:
+            for (gsize i = 0; i < depth; i++)
+                sum += values[i];
+
+            return mode == M_SUM ? sum : sum / depth;
+        case M_PERCENTILE:
+            return select_kth (values, depth, (gsize) roundf (percentile / 100.0f * (depth - 1)));
+        case M_TRIMMED_MEAN:
+            cut = (gsize) (trim * depth);
+
+            if (2 * cut >= depth)
+                return select_kth (values, depth, depth / 2);
+
+            /* Move the lowest and highest cut values out of the middle */
+            if (cut > 0) {
+                select_kth (values, depth, cut);
+                select_kth (values + cut, depth - cut, depth - 2 * cut - 1);
+            }
+
+            for (gsize i = cut; i < depth - cut; i++)
+                sum += values[i];
+
+            return sum / (depth - 2 * cut);
+        default:
+            return select_kth (values, depth, depth / 2);
+    }
 }
 
 static gboolean
@@ -112,34 +234,53 @@ ufo_flatten_task_process (UfoTask *task,
                           UfoBuffer *output,
                           UfoRequisition *requisition)
 {
+    UfoFlattenTaskPrivate *priv;
     gfloat *in_mem;
     gfloat *out_mem;
-    gfloat *tmp;
     gsize width, height, depth;
+    Mode mode;
+    gfloat percentile, trim;
+    gint y;
 
+    priv = UFO_FLATTEN_TASK_GET_PRIVATE (task);
     in_mem = ufo_buffer_get_host_array (inputs[0], NULL);
     out_mem = ufo_buffer_get_host_array (output, NULL);
     width = requisition->dims[0];
     height = requisition->dims[1];
     depth = requisition->dims[2];
-    tmp = g_malloc (sizeof (gfloat) * depth);
+    mode = priv->mode;
+    percentile = priv->percentile;
+    trim = priv->trim;
 
     /*
-     * For now, only median is necessary to flatten in a "fat" way, i.e. not
-     * doing in-place. In fact we should replace the averager with a "thin"
-     * flattener that can also determine the sum, min and max.
+     * Values of BLOCK_WIDTH adjacent pixels are gathered by reading a row
+     * segment of every frame, which keeps reads contiguous, and are then
+     * reduced pixel by pixel. Rows are distributed among the threads.
      */
-    for (gsize x = 0; x < width; x++) {
-        for (gsize y = 0; y < height; y++) {
-            for (gsize i = 0; i < depth; i++)
-                tmp[i] = in_mem[i * width * height + y * width + x];
+#pragma omp parallel
+    {
+        gfloat *block = g_malloc (sizeof (gfloat) * BLOCK_WIDTH * depth);
+
+#pragma omp for
+        for (y = 0; y < (gint) height; y++) {
+            for (gsize x0 = 0; x0 < width; x0 += BLOCK_WIDTH) {
+                gsize n = MIN (BLOCK_WIDTH, width - x0);
+
+                for (gsize i = 0; i < depth; i++) {
+                    const gfloat *row = in_mem + i * width * height + y * width + x0;
 
-            qsort ((gpointer) tmp, depth, sizeof(gfloat), cmp_float);
-            out_mem[y * width + x] = tmp[depth / 2];
+                    for (gsize x = 0; x < n; x++)
+                        block[x * depth + i] = row[x];
+                }
+
+                for (gsize x = 0; x < n; x++)
+                    out_mem[y * width + x0 + x] = reduce (block + x * depth, depth, mode, percentile, trim);
+            }
         }
+
+        g_free (block);
     }
 
-    g_free (tmp);
     return TRUE;
 }
 
@@ -158,8 +299,16 @@ ufo_flatten_task_set_property (GObject *object,
 
                 if (mode != M_0)
                     priv->mode = mode;
+                else
+                    g_warning ("Unknown flatten mode `%s'", g_value_get_string (value));
             }
             break;
+        case PROP_PERCENTILE:
+            priv->percentile = g_value_get_float (value);
+            break;
+        case PROP_TRIM:
+            priv->trim = g_value_get_float (value);
+            break;
 
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -177,7 +326,13 @@ ufo_flatten_task_get_property (GObject *object,
 
     switch (property_id) {
         case PROP_MODE:
-            g_value_set_string (value, modes[priv->mode]);
+            g_value_set_string (value, modes[priv->mode - 1]);
+            break;
+        case PROP_PERCENTILE:
+            g_value_set_float (value, priv->percentile);
+            break;
+        case PROP_TRIM:
+            g_value_set_float (value, priv->trim);
             break;
 
         default:
@@ -214,11 +369,25 @@ ufo_flatten_task_class_init (UfoFlattenTaskClass *klass)
 
     properties[PROP_MODE] =
         g_param_spec_string ("mode",
-            "Mode (min, max, sum, median)",
-            "Mode (min, max, sum, median)",
+            "Mode (min, max, sum, mean, median, percentile, trimmed-mean)",
+            "Mode (min, max, sum, mean, median, percentile, trimmed-mean)",
             "",
             G_PARAM_READWRITE);
 
+    properties[PROP_PERCENTILE] =
+        g_param_spec_float ("percentile",
+            "Percentile in percent for the percentile mode",
+            "Percentile in percent for the percentile mode",
+            0.0f, 100.0f, 50.0f,
+            G_PARAM_READWRITE);
+
+    properties[PROP_TRIM] =
+        g_param_spec_float ("trim",
+            "Fraction of values discarded at each end for the trimmed-mean mode",
+            "Fraction of values discarded at each end for the trimmed-mean mode",
+            0.0f, 0.5f, 0.1f,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -230,4 +399,6 @@ ufo_flatten_task_init(UfoFlattenTask *self)
 {
     self->priv = UFO_FLATTEN_TASK_GET_PRIVATE(self);
     self->priv->mode = M_MEDIAN;
+    self->priv->percentile = 50.0f;
+    self->priv->trim = 0.1f;
 }
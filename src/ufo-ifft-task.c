@@ -33,7 +33,10 @@ struct _UfoIfftTaskPrivate {
 
     cl_context context;
     cl_kernel kernel;
+    cl_mem real_mem;
+    gsize real_size;
 
+    gboolean real;
     gint crop_width;
     gint crop_height;
 };
@@ -51,6 +54,7 @@ enum {
     PROP_DIMENSIONS,
     PROP_CROP_WIDTH,
     PROP_CROP_HEIGHT,
+    PROP_REAL,
     N_PROPERTIES
 };
 
@@ -70,7 +74,15 @@ ufo_ifft_task_setup (UfoTask *task,
     UfoIfftTaskPrivate *priv;
 
     priv = UFO_IFFT_TASK_GET_PRIVATE (task);
-    priv->kernel = ufo_resources_get_kernel (resources, "fft.cl", "fft_pack", error);
+
+    if (priv->real && !ufo_fft_supports_real ()) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "Complex-to-real transforms require clFFT or FFTW");
+        return;
+    }
+
+    priv->kernel = ufo_resources_get_kernel (resources, "fft.cl",
+                                             priv->real ? "fft_pack_real" : "fft_pack", error);
     priv->context = ufo_resources_get_context (resources);
 
     UFO_RESOURCES_CHECK_CLERR (clRetainContext (priv->context));
@@ -92,8 +104,10 @@ ufo_ifft_task_get_requisition (UfoTask *task,
     priv = UFO_IFFT_TASK_GET_PRIVATE (task);
     ufo_buffer_get_requisition (inputs[0], &in_req);
 
+    /* A half spectrum of n / 2 + 1 complex values stems from an even n */
     priv->param.zeropad = FALSE;
-    priv->param.size[0] = in_req.dims[0] / 2;
+    priv->param.real = priv->real;
+    priv->param.size[0] = priv->real ? 2 * (in_req.dims[0] / 2 - 1) : in_req.dims[0] / 2;
 
     switch (priv->param.dimensions) {
         case UFO_FFT_1D:
@@ -115,6 +129,23 @@ ufo_ifft_task_get_requisition (UfoTask *task,
     *requisition = in_req;  /* keep third dimension for 2-D batching */
     requisition->dims[0] = priv->crop_width > 0 ? (gsize) priv->crop_width : priv->param.size[0];
     requisition->dims[1] = priv->crop_height > 0 ? (gsize) priv->crop_height : in_req.dims[1];
+
+    if (priv->real) {
+        /* Complex-to-real transforms are out-of-place */
+        gsize size = priv->param.size[0] * in_req.dims[1] *
+                     (in_req.n_dims == 3 ? in_req.dims[2] : 1) * sizeof (gfloat);
+
+        if (size != priv->real_size) {
+            cl_int err;
+
+            if (priv->real_mem != NULL)
+                UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->real_mem));
+
+            priv->real_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE, size, NULL, &err);
+            UFO_RESOURCES_CHECK_CLERR (err);
+            priv->real_size = size;
+        }
+    }
 }
 
 static guint
@@ -168,9 +199,13 @@ ufo_ifft_task_process (UfoTask *task,
     in_mem = ufo_buffer_get_device_array (inputs[0], queue);
     out_mem = ufo_buffer_get_device_array (output, queue);
 
-    /* In-place IFFT */
-    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler, in_mem, in_mem, UFO_FFT_BACKWARD,
-                                                0, NULL, NULL));
+    /* In-place IFFT or out-of-place into the real buffer */
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler, in_mem,
+                                                priv->real ? priv->real_mem : in_mem,
+                                                UFO_FFT_BACKWARD, 0, NULL, NULL));
+
+    if (priv->real)
+        in_mem = priv->real_mem;
 
     /* Scale and reshape if necessary */
     scale = 1.0f / ((gfloat) requisition->dims[0]);
@@ -184,7 +219,7 @@ ufo_ifft_task_process (UfoTask *task,
 
     ufo_buffer_get_requisition (inputs[0], &in_req);
 
-    global_work_size[0] = in_req.dims[0] >> 1;
+    global_work_size[0] = priv->param.size[0];
     global_work_size[1] = in_req.dims[1];
     global_work_size[2] = requisition->n_dims == 3 ? in_req.dims[2] : 1;
 
@@ -212,6 +247,11 @@ ufo_ifft_task_finalize (GObject *object)
         priv->kernel = NULL;
     }
 
+    if (priv->real_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->real_mem));
+        priv->real_mem = NULL;
+    }
+
     if (priv->context) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
         priv->context = NULL;
@@ -254,6 +294,9 @@ ufo_ifft_task_set_property (GObject *object,
         case PROP_CROP_HEIGHT:
             priv->crop_height = g_value_get_int (value);
             break;
+        case PROP_REAL:
+            priv->real = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -278,6 +321,9 @@ ufo_ifft_task_get_property (GObject *object,
         case PROP_CROP_HEIGHT:
             g_value_set_int (value, priv->crop_height);
             break;
+        case PROP_REAL:
+            g_value_set_boolean (value, priv->real);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -318,6 +364,13 @@ ufo_ifft_task_class_init (UfoIfftTaskClass *klass)
             -1, G_MAXINT, -1,
             G_PARAM_READWRITE);
 
+    properties[PROP_REAL] =
+        g_param_spec_boolean ("real",
+            "Complex-to-real transform of a non-redundant half spectrum",
+            "Complex-to-real transform of a non-redundant half spectrum",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -335,6 +388,9 @@ ufo_ifft_task_init (UfoIfftTask *self)
     priv->crop_height = -1;
     priv->kernel = NULL;
     priv->context = NULL;
+    priv->real_mem = NULL;
+    priv->real_size = 0;
+    priv->real = FALSE;
     priv->fft = ufo_fft_new ();
     priv->param.dimensions = UFO_FFT_1D;
     priv->param.size[0] = 1;
@@ -18,6 +18,8 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <math.h>
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -41,6 +43,18 @@
                             ((EXTRACT_INT ((region), 1) - EXTRACT_INT ((region), 0) - 1) /\
                             EXTRACT_INT ((region), 2) + 1)
 #define PAD_TO_DIVIDE(dividend, divisor) ((dividend) + (divisor) - (dividend) % (divisor))
+/* Kernels are generated for bursts 1, 2, 4, 8 and 16 */
+#define MAX_BURST 16
+#define N_BURSTS 5
+#define BURST_INDEX(burst) (g_bit_nth_lsf ((burst), -1))
+/* Autotuning results are stored per device in the user's cache directory */
+#define TUNING_FILENAME "lamino-backproject.ini"
+#define TUNING_RUNS 3
+/* Autotuning times a corner of the volume of at most this extent */
+#define TUNING_EXTENT_XY 256
+#define TUNING_EXTENT_Z 32
+/* Image sets filled alternately, one is read by the running burst */
+#define N_IMAGE_SETS 2
 
 
 typedef enum {
@@ -61,19 +75,26 @@ static GEnumValue parameter_values[] = {
 struct _UfoLaminoBackprojectTaskPrivate {
     /* private */
     gboolean generated;
+    gboolean configured;
     guint count;
-    /* sine and cosine table size based on BURST */
-    gsize table_size;
+    /* burst and local work size used for processing, either set or tuned */
+    guint current_burst;
+    gsize local_work_size[3];
 
     /* OpenCL */
     cl_context context;
-    cl_kernel vector_kernel;
-    cl_kernel scalar_kernel;
+    /* backproject_burst_1, backproject_burst_2, ..., backproject_burst_16 */
+    cl_kernel kernels[N_BURSTS];
     cl_sampler sampler;
-    /* Buffered images for invoking backprojection on BURST projections at once.
+    /* Projections are copied on a separate queue, so that copying the next
+     * burst overlaps with backprojecting the current one */
+    cl_command_queue transfer_queue;
+    /* Buffered images for invoking backprojection on burst projections at once.
      * We potentially don't need to copy the last image and can use the one from
      * framework directly but it seems to have no performance effects. */
-    cl_mem images[BURST];
+    cl_mem images[N_IMAGE_SETS][MAX_BURST];
+    /* Marks the end of the last kernel reading an image set */
+    cl_event kernel_events[N_IMAGE_SETS];
 
     /* properties */
     GValueArray *x_region;
@@ -81,8 +102,9 @@ struct _UfoLaminoBackprojectTaskPrivate {
     GValueArray *region;
     GValueArray *center;
     GValueArray *projection_offset;
-    float sines[BURST], cosines[BURST];
+    float sines[MAX_BURST], cosines[MAX_BURST];
     guint num_projections;
+    guint burst;
     gfloat overall_angle;
     gfloat tomo_angle;
     gfloat lamino_angle;
@@ -115,11 +137,20 @@ enum {
     PROP_PARAMETER,
     PROP_ROLL_ANGLE,
     PROP_ADDRESSING_MODE,
+    PROP_BURST,
     N_PROPERTIES
 };
 
 static GParamSpec *properties[N_PROPERTIES] = { NULL, };
 
+/* Candidate (x, y) local work sizes, the z size is derived from the maximum
+ * work group size or set to one */
+static const gsize local_shapes[][2] = {
+    {16, 8}, {32, 4}, {8, 8}, {32, 8}, {16, 16}, {64, 4}
+};
+
+G_LOCK_DEFINE_STATIC (tuning_file);
+
 static void
 set_region (GValueArray *src, GValueArray **dst)
 {
@@ -138,22 +169,460 @@ static void
 copy_to_image (UfoBuffer *input,
                cl_mem output_image,
                cl_command_queue cmd_queue,
+               cl_command_queue transfer_queue,
                size_t origin[3],
                size_t region[3],
-               gint in_width)
+               gint in_width,
+               cl_event wait_event)
 {
+    UfoBufferLocation location;
     cl_mem input_data;
     cl_event event;
 
-    input_data = ufo_buffer_get_device_image (input, cmd_queue);
-    UFO_RESOURCES_CHECK_CLERR (clEnqueueCopyImage (cmd_queue, input_data, output_image,
+    /* Device data was produced on the compute queue, the transfer queue must
+     * not read it earlier. Host data does not depend on the compute queue. */
+    location = ufo_buffer_get_location (input);
+
+    if (location == UFO_BUFFER_LOCATION_DEVICE || location == UFO_BUFFER_LOCATION_DEVICE_IMAGE) {
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueMarker (cmd_queue, &event));
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueWaitForEvents (transfer_queue, 1, &event));
+        UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
+    }
+
+    /* Any upload or conversion to an image runs on the transfer queue, too.
+     * The input buffer is given back after processing, hence wait for the
+     * copy but not for anything else enqueued for backprojection. */
+    input_data = ufo_buffer_get_device_image (input, transfer_queue);
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueCopyImage (transfer_queue, input_data, output_image,
                                                    origin, origin, region,
-                                                   0, NULL, &event));
+                                                   wait_event != NULL ? 1 : 0,
+                                                   wait_event != NULL ? &wait_event : NULL,
+                                                   &event));
 
     UFO_RESOURCES_CHECK_CLERR (clWaitForEvents (1, &event));
     UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
 }
 
+static gsize
+get_table_size (guint burst)
+{
+    switch (burst) {
+        case 1: return sizeof (cl_float);
+        case 2: return sizeof (cl_float2);
+        case 4: return sizeof (cl_float4);
+        case 8: return sizeof (cl_float8);
+        case 16: return sizeof (cl_float16);
+        default: g_warning ("Unsupported vector size"); return 0;
+    }
+}
+
+static void
+get_global_work_size (UfoRequisition *requisition, const gsize local_work_size[3], gsize global_work_size[3])
+{
+    for (guint i = 0; i < 3; i++) {
+        global_work_size[i] = requisition->dims[i] % local_work_size[i] ?
+                              PAD_TO_DIVIDE (requisition->dims[i], local_work_size[i]) :
+                              requisition->dims[i];
+    }
+}
+
+/*
+ * Set all arguments following the @burst projection images.
+ */
+static void
+set_kernel_args (UfoLaminoBackprojectTaskPrivate *priv,
+                 cl_kernel kernel,
+                 guint burst,
+                 cl_mem out_mem,
+                 UfoRequisition *requisition,
+                 gfloat *sines,
+                 gfloat *cosines,
+                 gint cumulate)
+{
+    /* regions stripped off the "to" value */
+    gfloat x_region[2], y_region[2], z_region[2], x_center[2], lamino_angles[2], roll_angles[2],
+           y_center, sin_lamino, cos_lamino, norm_factor, sin_roll, cos_roll;
+    const gint real_size[4] = {requisition->dims[0], requisition->dims[1], requisition->dims[2], 0};
+    gsize table_size;
+    guint i = burst;
+
+    table_size = get_table_size (burst);
+    norm_factor = fabs (priv->overall_angle) / priv->num_projections;
+    x_region[0] = (gfloat) EXTRACT_INT (priv->x_region, 0);
+    x_region[1] = (gfloat) EXTRACT_INT (priv->x_region, 2);
+    y_region[0] = (gfloat) EXTRACT_INT (priv->y_region, 0);
+    y_region[1] = (gfloat) EXTRACT_INT (priv->y_region, 2);
+
+    if (priv->parameter == PARAMETER_Z) {
+        z_region[0] = EXTRACT_FLOAT (priv->region, 0);
+        z_region[1] = EXTRACT_FLOAT (priv->region, 2);
+    } else {
+        z_region[0] = priv->z;
+    }
+
+    if (priv->parameter == PARAMETER_X_CENTER) {
+        x_center[0] = EXTRACT_FLOAT (priv->region, 0) - EXTRACT_INT (priv->projection_offset, 0);
+        x_center[1] = EXTRACT_FLOAT (priv->region, 2);
+    } else {
+        x_center[0] = x_center[1] = EXTRACT_FLOAT (priv->center, 0) - EXTRACT_INT (priv->projection_offset, 0);
+    }
+
+    if (priv->parameter == PARAMETER_LAMINO_ANGLE) {
+        lamino_angles[0] = EXTRACT_FLOAT (priv->region, 0);
+        lamino_angles[1] = EXTRACT_FLOAT (priv->region, 2);
+    } else {
+        lamino_angles[0] = lamino_angles[1] = priv->lamino_angle;
+    }
+
+    if (priv->parameter == PARAMETER_ROLL_ANGLE) {
+        roll_angles[0] = EXTRACT_FLOAT (priv->region, 0);
+        roll_angles[1] = EXTRACT_FLOAT (priv->region, 2);
+    } else {
+        roll_angles[0] = roll_angles[1] = priv->roll_angle;
+    }
+
+    y_center = EXTRACT_FLOAT (priv->center, 1) - EXTRACT_INT (priv->projection_offset, 1);
+    sin_lamino = sinf (priv->lamino_angle);
+    cos_lamino = cosf (priv->lamino_angle);
+    /* Minus the value because we are rotating back */
+    sin_roll = sinf (-priv->roll_angle);
+    cos_roll = cosf (-priv->roll_angle);
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_mem), &out_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_sampler), &priv->sampler));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_int3), real_size));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), x_center));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), (cl_float *) &y_center));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), x_region));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), y_region));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), z_region));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), lamino_angles));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), roll_angles));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &sin_lamino));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &cos_lamino));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, table_size, sines));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, table_size, cosines));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &norm_factor));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &sin_roll));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &cos_roll));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i, sizeof (cl_int), (cl_int *) &cumulate));
+}
+
+static gchar *
+get_tuning_filename (void)
+{
+    return g_build_filename (g_get_user_cache_dir (), "ufo", TUNING_FILENAME, NULL);
+}
+
+/*
+ * Part of the volume on which candidates are timed, the kernels skip work items
+ * outside of the real volume.
+ */
+static void
+get_tuning_requisition (UfoRequisition *requisition, UfoRequisition *tuning)
+{
+    const gsize extent[3] = { TUNING_EXTENT_XY, TUNING_EXTENT_XY, TUNING_EXTENT_Z };
+
+    *tuning = *requisition;
+
+    for (guint i = 0; i < 3; i++)
+        tuning->dims[i] = MIN (requisition->dims[i], extent[i]);
+}
+
+/*
+ * Volumes that are at least as large as the tuning extent share their results,
+ * smaller ones are grouped by powers of two.
+ */
+static gchar *
+get_tuning_key (UfoLaminoBackprojectTaskPrivate *priv, UfoRequisition *requisition)
+{
+    UfoRequisition tuning;
+    guint size[3];
+
+    get_tuning_requisition (requisition, &tuning);
+
+    for (guint i = 0; i < 3; i++)
+        size[i] = 1 << g_bit_storage (MAX (tuning.dims[i], 1) - 1);
+
+    return g_strdup_printf ("%s-%ux%ux%u", parameter_values[priv->parameter].value_nick,
+                            size[0], size[1], size[2]);
+}
+
+static gboolean
+load_configuration (UfoLaminoBackprojectTaskPrivate *priv,
+                    const gchar *device_name,
+                    const gchar *key,
+                    gsize max_work_group_size)
+{
+    GKeyFile *key_file;
+    gchar *filename;
+    gint *values;
+    gsize length = 0;
+    gboolean found = FALSE;
+
+    key_file = g_key_file_new ();
+    filename = get_tuning_filename ();
+
+    G_LOCK (tuning_file);
+
+    if (g_key_file_load_from_file (key_file, filename, G_KEY_FILE_NONE, NULL)) {
+        values = g_key_file_get_integer_list (key_file, device_name, key, &length, NULL);
+
+        /* Stored values must be sane, the file may have been edited by hand */
+        if (values != NULL && length == 4 &&
+            values[0] > 0 && values[0] <= MAX_BURST && !(values[0] & (values[0] - 1)) &&
+            values[1] > 0 && values[2] > 0 && values[3] > 0 &&
+            (gsize) values[1] * values[2] * values[3] <= max_work_group_size) {
+            priv->current_burst = values[0];
+            priv->local_work_size[0] = values[1];
+            priv->local_work_size[1] = values[2];
+            priv->local_work_size[2] = values[3];
+            found = TRUE;
+        }
+
+        g_free (values);
+    }
+
+    G_UNLOCK (tuning_file);
+
+    g_free (filename);
+    g_key_file_free (key_file);
+
+    return found;
+}
+
+static void
+store_configuration (UfoLaminoBackprojectTaskPrivate *priv,
+                     const gchar *device_name,
+                     const gchar *key)
+{
+    GKeyFile *key_file;
+    GError *error = NULL;
+    gchar *filename, *dirname, *data;
+    gsize length;
+    gint values[4];
+
+    values[0] = priv->current_burst;
+    values[1] = priv->local_work_size[0];
+    values[2] = priv->local_work_size[1];
+    values[3] = priv->local_work_size[2];
+    key_file = g_key_file_new ();
+    filename = get_tuning_filename ();
+    dirname = g_path_get_dirname (filename);
+
+    G_LOCK (tuning_file);
+
+    /* Keep results of other devices and regions */
+    g_key_file_load_from_file (key_file, filename, G_KEY_FILE_NONE, NULL);
+    g_key_file_set_integer_list (key_file, device_name, key, values, 4);
+    data = g_key_file_to_data (key_file, &length, NULL);
+
+    if (g_mkdir_with_parents (dirname, 0755) || !g_file_set_contents (filename, data, length, &error)) {
+        g_debug ("Could not store lamino tuning results in `%s': %s", filename,
+                 error != NULL ? error->message : g_strerror (errno));
+        g_clear_error (&error);
+    }
+
+    G_UNLOCK (tuning_file);
+
+    g_free (data);
+    g_free (dirname);
+    g_free (filename);
+    g_key_file_free (key_file);
+}
+
+/*
+ * Time one burst and local work size on the tuning part of the volume.
+ * Returns the time per projection or G_MAXDOUBLE if the device cannot run it.
+ */
+static gdouble
+time_candidate (cl_command_queue cmd_queue,
+                cl_kernel kernel,
+                guint burst,
+                UfoRequisition *tuning,
+                const gsize local_work_size[3])
+{
+    gsize global_work_size[3];
+    gint64 start;
+
+    get_global_work_size (tuning, local_work_size, global_work_size);
+
+    /* Warm up and skip shapes the device cannot run */
+    if (clEnqueueNDRangeKernel (cmd_queue, kernel, 3, NULL, global_work_size, local_work_size,
+                                0, NULL, NULL) != CL_SUCCESS)
+        return G_MAXDOUBLE;
+
+    UFO_RESOURCES_CHECK_CLERR (clFinish (cmd_queue));
+    start = g_get_monotonic_time ();
+
+    for (guint run = 0; run < TUNING_RUNS; run++) {
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (cmd_queue, kernel, 3, NULL,
+                                                           global_work_size, local_work_size,
+                                                           0, NULL, NULL));
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clFinish (cmd_queue));
+
+    return (gdouble) (g_get_monotonic_time () - start) / (TUNING_RUNS * burst);
+}
+
+static gsize
+get_kernel_work_group_size (cl_kernel kernel, cl_device_id device, gsize max_work_group_size)
+{
+    gsize size;
+
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                                         sizeof (gsize), &size, NULL));
+    return MIN (size, max_work_group_size);
+}
+
+/*
+ * Choose the burst and the local work size by backprojecting @image, which is
+ * the first projection, into a corner of @out_mem. The first burst of the
+ * volume does not cumulate and overwrites the result. Bursts are compared with
+ * the default local work size first, then only the local work sizes of the
+ * fastest burst are timed.
+ */
+static void
+autotune (UfoLaminoBackprojectTaskPrivate *priv,
+          cl_command_queue cmd_queue,
+          cl_device_id device,
+          cl_mem image,
+          cl_mem out_mem,
+          UfoRequisition *requisition,
+          gsize max_work_group_size)
+{
+    UfoRequisition tuning;
+    gfloat sines[MAX_BURST], cosines[MAX_BURST];
+    gsize local_work_size[3], kernel_work_group_size;
+    gdouble elapsed, best = G_MAXDOUBLE;
+    cl_kernel kernel;
+    guint shape;
+
+    get_tuning_requisition (requisition, &tuning);
+
+    for (guint i = 0; i < MAX_BURST; i++) {
+        sines[i] = sin (priv->overall_angle * i / priv->num_projections);
+        cosines[i] = cos (priv->overall_angle * i / priv->num_projections);
+    }
+
+    /* Bursts larger than the number of projections would never be used */
+    for (guint burst = 1; burst <= MAX_BURST && burst <= priv->num_projections; burst *= 2) {
+        kernel = priv->kernels[BURST_INDEX (burst)];
+        kernel_work_group_size = get_kernel_work_group_size (kernel, device, max_work_group_size);
+
+        for (guint i = 0; i < burst; i++)
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i, sizeof (cl_mem), &image));
+
+        set_kernel_args (priv, kernel, burst, out_mem, requisition, sines, cosines, 0);
+
+        /* The first shape that fits, filled up along z */
+        for (shape = 0; shape < G_N_ELEMENTS (local_shapes); shape++) {
+            if (local_shapes[shape][0] * local_shapes[shape][1] <= kernel_work_group_size)
+                break;
+        }
+
+        if (shape == G_N_ELEMENTS (local_shapes))
+            continue;
+
+        local_work_size[0] = local_shapes[shape][0];
+        local_work_size[1] = local_shapes[shape][1];
+        local_work_size[2] = kernel_work_group_size / (local_work_size[0] * local_work_size[1]);
+
+        elapsed = time_candidate (cmd_queue, kernel, burst, &tuning, local_work_size);
+
+        if (elapsed < best) {
+            best = elapsed;
+            priv->current_burst = burst;
+            memcpy (priv->local_work_size, local_work_size, sizeof (local_work_size));
+        }
+    }
+
+    if (best == G_MAXDOUBLE) {
+        g_warning ("No candidate local work size fits the device, falling back to burst 1");
+        priv->current_burst = 1;
+        priv->local_work_size[0] = priv->local_work_size[1] = priv->local_work_size[2] = 1;
+        return;
+    }
+
+    /* The kernel arguments of the fastest burst are still set */
+    kernel = priv->kernels[BURST_INDEX (priv->current_burst)];
+    kernel_work_group_size = get_kernel_work_group_size (kernel, device, max_work_group_size);
+
+    for (guint i = 0; i < G_N_ELEMENTS (local_shapes) * 2; i++) {
+        local_work_size[0] = local_shapes[i / 2][0];
+        local_work_size[1] = local_shapes[i / 2][1];
+
+        if (local_work_size[0] * local_work_size[1] > kernel_work_group_size)
+            continue;
+
+        local_work_size[2] = i % 2 ? 1 : kernel_work_group_size / (local_work_size[0] * local_work_size[1]);
+
+        /* Timed in the first pass already */
+        if (!memcmp (local_work_size, priv->local_work_size, sizeof (local_work_size)))
+            continue;
+
+        elapsed = time_candidate (cmd_queue, kernel, priv->current_burst, &tuning, local_work_size);
+
+        if (elapsed < best) {
+            best = elapsed;
+            memcpy (priv->local_work_size, local_work_size, sizeof (local_work_size));
+        }
+    }
+}
+
+static void
+configure (UfoLaminoBackprojectTaskPrivate *priv,
+           UfoGpuNode *node,
+           cl_command_queue cmd_queue,
+           UfoBuffer *input,
+           cl_mem out_mem,
+           UfoRequisition *requisition)
+{
+    GValue *work_group_size;
+    cl_device_id device;
+    gsize max_work_group_size;
+    gchar device_name[256];
+    gchar *key;
+
+    work_group_size = ufo_gpu_node_get_info (node, UFO_GPU_NODE_INFO_MAX_WORK_GROUP_SIZE);
+    max_work_group_size = g_value_get_ulong (work_group_size);
+    g_value_unset (work_group_size);
+
+    if (priv->burst) {
+        /* keep the warp size satisfied but make sure the local grid is
+         * localized around a point in 3D for efficient caching, let last axis
+         * depend on maximum work group size */
+        priv->current_burst = priv->burst;
+        priv->local_work_size[0] = 16;
+        priv->local_work_size[1] = 8;
+        priv->local_work_size[2] = MAX (max_work_group_size / 128, 1);
+        return;
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (cmd_queue, CL_QUEUE_DEVICE,
+                                                      sizeof (cl_device_id), &device, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, CL_DEVICE_NAME,
+                                                sizeof (device_name), device_name, NULL));
+
+    /* Group names must not contain brackets */
+    g_strdelimit (g_strstrip (device_name), "[]", '_');
+    key = get_tuning_key (priv, requisition);
+
+    if (!load_configuration (priv, device_name, key, max_work_group_size)) {
+        autotune (priv, cmd_queue, device,
+                  ufo_buffer_get_device_image (input, cmd_queue),
+                  out_mem, requisition, max_work_group_size);
+        store_configuration (priv, device_name, key);
+    }
+
+    g_debug ("Lamino backprojection on `%s' uses burst %u and local work size %ux%ux%u",
+             device_name, priv->current_burst, (guint) priv->local_work_size[0],
+             (guint) priv->local_work_size[1], (guint) priv->local_work_size[2]);
+
+    g_free (key);
+}
+
 UfoNode *
 ufo_lamino_backproject_task_new (void)
 {
@@ -168,7 +637,7 @@ ufo_lamino_backproject_task_setup (UfoTask *task,
     UfoLaminoBackprojectTaskPrivate *priv;
     cl_int cl_error;
     gint i;
-    gchar *vector_kernel_name;
+    gchar *kernel_name;
     gchar *kernel_filename;
 
     priv = UFO_LAMINO_BACKPROJECT_TASK_GET_PRIVATE (task);
@@ -183,15 +652,12 @@ ufo_lamino_backproject_task_setup (UfoTask *task,
         return;
     }
 
-    vector_kernel_name = g_strdup_printf ("backproject_burst_%d", BURST);
-
-    if (!vector_kernel_name) {
-        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP, "Unable to create burst kernel name");
+    if (priv->burst & (priv->burst - 1)) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "Burst must be one of 0 (autotune), 1, 2, 4, 8, 16");
         return;
     }
 
-    priv->context = ufo_resources_get_context (resources);
-
     switch (priv->parameter) {
         case PARAMETER_Z:
             kernel_filename = g_strdup ("z_kernel.cl");
@@ -210,35 +676,33 @@ ufo_lamino_backproject_task_setup (UfoTask *task,
             return;
     }
 
-    priv->vector_kernel = ufo_resources_get_kernel (resources, kernel_filename, vector_kernel_name, error);
-    priv->scalar_kernel = ufo_resources_get_kernel (resources, kernel_filename, "backproject_burst_1", error);
-    priv->sampler = clCreateSampler (priv->context, (cl_bool) FALSE, priv->addressing_mode, CL_FILTER_LINEAR, &cl_error);
-
+    priv->context = ufo_resources_get_context (resources);
     UFO_RESOURCES_CHECK_CLERR (clRetainContext (priv->context));
+
+    priv->sampler = clCreateSampler (priv->context, (cl_bool) FALSE, priv->addressing_mode, CL_FILTER_LINEAR, &cl_error);
     UFO_RESOURCES_CHECK_CLERR (cl_error);
 
-    if (priv->vector_kernel) {
-        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->vector_kernel));
-    }
+    /* All burst kernels are loaded, the one to use is decided on the first projection */
+    for (i = 0; i < N_BURSTS; i++) {
+        kernel_name = g_strdup_printf ("backproject_burst_%d", 1 << i);
+        priv->kernels[i] = ufo_resources_get_kernel (resources, kernel_filename, kernel_name, error);
+        g_free (kernel_name);
 
-    if (priv->scalar_kernel) {
-        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->scalar_kernel));
-    }
+        if (priv->kernels[i] == NULL)
+            break;
 
-    for (i = 0; i < BURST; i++) {
-        priv->images[i] = NULL;
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->kernels[i]));
     }
 
-    switch (BURST) {
-        case 1: priv->table_size = sizeof (cl_float); break;
-        case 2: priv->table_size = sizeof (cl_float2); break;
-        case 4: priv->table_size = sizeof (cl_float4); break;
-        case 8: priv->table_size = sizeof (cl_float8); break;
-        case 16: priv->table_size = sizeof (cl_float16); break;
-        default: g_warning ("Unsupported vector size"); break;
+    for (i = 0; i < N_IMAGE_SETS; i++) {
+        for (gint j = 0; j < MAX_BURST; j++)
+            priv->images[i][j] = NULL;
+
+        priv->kernel_events[i] = NULL;
     }
 
-    g_free (vector_kernel_name);
+    priv->transfer_queue = NULL;
+    priv->configured = FALSE;
     g_free (kernel_filename);
 }
 
@@ -293,99 +757,56 @@ ufo_lamino_backproject_task_process (UfoTask *task,
     UfoGpuNode *node;
     UfoProfiler *profiler;
     gfloat tomo_angle, *sines, *cosines;
-    gint i, index;
+    guint burst, index, set;
     gint cumulate;
-    gsize table_size;
     gboolean scalar;
-    /* regions stripped off the "to" value */
-    gfloat x_region[2], y_region[2], z_region[2], x_center[2], z_ends[2], lamino_angles[2], roll_angles[2],
-           y_center, sin_lamino, cos_lamino, norm_factor, sin_roll, cos_roll;
+    gfloat z_ends[2];
     gint x_copy_region[2], y_copy_region[2];
     cl_kernel kernel;
     cl_command_queue cmd_queue;
+    cl_device_id device;
     cl_mem out_mem;
     cl_int cl_error;
     /* image creation and copying */
     cl_image_format image_fmt;
     size_t origin[3];
     size_t region[3];
-    /* keep the warp size satisfied but make sure the local grid is localized
-     * around a point in 3D for efficient caching */
-    const gint real_size[4] = {requisition->dims[0], requisition->dims[1], requisition->dims[2], 0};
-    gsize local_work_size[3] = {16, 8, 8};
     gsize global_work_size[3];
-    GValue *work_group_size;
 
     priv = UFO_LAMINO_BACKPROJECT_TASK (task)->priv;
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
-    work_group_size = ufo_gpu_node_get_info (node, UFO_GPU_NODE_INFO_MAX_WORK_GROUP_SIZE);
-
-    /* Let last axis depend on maximum work group size */
-    local_work_size[2] = g_value_get_ulong (work_group_size) / 128;
-    g_value_unset (work_group_size);
-
-    global_work_size[0] = requisition->dims[0] % local_work_size[0] ?
-                          PAD_TO_DIVIDE (requisition->dims[0], local_work_size[0]) :
-                          requisition->dims[0];
-    global_work_size[1] = requisition->dims[1] % local_work_size[1] ?
-                          PAD_TO_DIVIDE (requisition->dims[1], local_work_size[1]) :
-                          requisition->dims[1];
-    global_work_size[2] = requisition->dims[2] % local_work_size[2] ?
-                          PAD_TO_DIVIDE (requisition->dims[2], local_work_size[2]) :
-                          requisition->dims[2];
-
     cmd_queue = ufo_gpu_node_get_cmd_queue (node);
     out_mem = ufo_buffer_get_device_array (output, cmd_queue);
+
+    if (!priv->configured) {
+        configure (priv, node, cmd_queue, inputs[0], out_mem, requisition);
+        UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (cmd_queue, CL_QUEUE_DEVICE,
+                                                          sizeof (cl_device_id), &device, NULL));
+        priv->transfer_queue = clCreateCommandQueue (priv->context, device, 0, &cl_error);
+        UFO_RESOURCES_CHECK_CLERR (cl_error);
+        priv->configured = TRUE;
+    }
+
+    burst = priv->current_burst;
+    get_global_work_size (requisition, priv->local_work_size, global_work_size);
     ufo_buffer_get_requisition (inputs[0], &in_req);
 
-    index = priv->count % BURST;
+    index = priv->count % burst;
+    set = priv->count / burst % N_IMAGE_SETS;
     tomo_angle = priv->tomo_angle > -G_MAXFLOAT ? priv->tomo_angle :
                  priv->overall_angle * priv->count / priv->num_projections;
-    norm_factor = fabs (priv->overall_angle) / priv->num_projections;
     priv->sines[index] = sin (tomo_angle);
     priv->cosines[index] = cos (tomo_angle);
-    x_region[0] = (gfloat) EXTRACT_INT (priv->x_region, 0);
-    x_region[1] = (gfloat) EXTRACT_INT (priv->x_region, 2);
-    y_region[0] = (gfloat) EXTRACT_INT (priv->y_region, 0);
-    y_region[1] = (gfloat) EXTRACT_INT (priv->y_region, 2);
 
     if (priv->parameter == PARAMETER_Z) {
-        z_ends[0] = z_region[0] = EXTRACT_FLOAT (priv->region, 0);
-        z_region[1] = EXTRACT_FLOAT (priv->region, 2);
+        z_ends[0] = EXTRACT_FLOAT (priv->region, 0);
         z_ends[1] = EXTRACT_FLOAT (priv->region, 1);
     } else {
-        z_ends[0] = z_region[0] = priv->z;
+        z_ends[0] = priv->z;
         z_ends[1] = priv->z + 1.0f;
     }
 
-    if (priv->parameter == PARAMETER_X_CENTER) {
-        x_center[0] = EXTRACT_FLOAT (priv->region, 0) - EXTRACT_INT (priv->projection_offset, 0);
-        x_center[1] = EXTRACT_FLOAT (priv->region, 2);
-    } else {
-        x_center[0] = x_center[1] = EXTRACT_FLOAT (priv->center, 0) - EXTRACT_INT (priv->projection_offset, 0);
-    }
-
-    if (priv->parameter == PARAMETER_LAMINO_ANGLE) {
-        lamino_angles[0] = EXTRACT_FLOAT (priv->region, 0);
-        lamino_angles[1] = EXTRACT_FLOAT (priv->region, 2);
-    } else {
-        lamino_angles[0] = lamino_angles[1] = priv->lamino_angle;
-    }
-
-    if (priv->parameter == PARAMETER_ROLL_ANGLE) {
-        roll_angles[0] = EXTRACT_FLOAT (priv->region, 0);
-        roll_angles[1] = EXTRACT_FLOAT (priv->region, 2);
-    } else {
-        roll_angles[0] = roll_angles[1] = priv->roll_angle;
-    }
-
-    y_center = EXTRACT_FLOAT (priv->center, 1) - EXTRACT_INT (priv->projection_offset, 1);
-    sin_lamino = sinf (priv->lamino_angle);
-    cos_lamino = cosf (priv->lamino_angle);
-    /* Minus the value because we are rotating back */
-    sin_roll = sinf (-priv->roll_angle);
-    cos_roll = cosf (-priv->roll_angle);
-    scalar = priv->count >= priv->num_projections / BURST * BURST ? 1 : 0;
+    scalar = priv->count >= priv->num_projections / burst * burst ? 1 : 0;
 
     /* If COPY_PROJECTION_REGION is True we copy only the part necessary  */
     /* for a given tomographic and laminographic angle */
@@ -408,68 +829,56 @@ ufo_lamino_backproject_task_process (UfoTask *task,
     }
     region[2] = 1;
 
-    if (priv->images[index] == NULL) {
+    if (priv->images[set][index] == NULL) {
         /* TODO: dangerous, don't rely on the ufo-buffer */
         image_fmt.image_channel_order = CL_INTENSITY;
         image_fmt.image_channel_data_type = CL_FLOAT;
         /* TODO: what with the "other" API? */
-        priv->images[index] = clCreateImage2D (priv->context,
-                                               CL_MEM_READ_ONLY,
-                                               &image_fmt,
-                                               in_req.dims[0],
-                                               in_req.dims[1],
-                                               0,
-                                               NULL,
-                                               &cl_error);
+        priv->images[set][index] = clCreateImage2D (priv->context,
+                                                    CL_MEM_READ_ONLY,
+                                                    &image_fmt,
+                                                    in_req.dims[0],
+                                                    in_req.dims[1],
+                                                    0,
+                                                    NULL,
+                                                    &cl_error);
         UFO_RESOURCES_CHECK_CLERR (cl_error);
     }
 
-    copy_to_image (inputs[0], priv->images[index], cmd_queue, origin, region, in_req.dims[0]);
+    /* The image may still be read by the previous burst of the same set */
+    copy_to_image (inputs[0], priv->images[set][index], cmd_queue, priv->transfer_queue,
+                   origin, region, in_req.dims[0], priv->kernel_events[set]);
 
     if (scalar) {
-        kernel = priv->scalar_kernel;
+        kernel = priv->kernels[0];
         cumulate = priv->count;
-        table_size = sizeof (cl_float);
         sines = &priv->sines[index];
         cosines = &priv->cosines[index];
-        i = 1;
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &priv->images[index]));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &priv->images[set][index]));
     } else {
-        kernel = priv->vector_kernel;
-        cumulate = priv->count + 1 == BURST ? 0 : 1;
-        table_size = priv->table_size;
+        kernel = priv->kernels[BURST_INDEX (burst)];
+        cumulate = priv->count + 1 == burst ? 0 : 1;
         sines = priv->sines;
         cosines = priv->cosines;
-        i = BURST;
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, index, sizeof (cl_mem), &priv->images[index]));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, index, sizeof (cl_mem), &priv->images[set][index]));
     }
 
-    if (scalar || index == BURST - 1) {
-        /* Execute the kernel after BURST images have arrived, i.e. we use more
+    if (scalar || index == burst - 1) {
+        /* Execute the kernel after burst images have arrived, i.e. we use more
          * projections at one invocation, so the number of read/writes to the
-         * result is reduced by a factor of BURST. If there are not enough
+         * result is reduced by a factor of burst. If there are not enough
          * projecttions left, execute the scalar kernel */
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_mem), &out_mem));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_sampler), &priv->sampler));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_int3), real_size));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), x_center));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), (cl_float *) &y_center));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), x_region));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), y_region));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), z_region));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), lamino_angles));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), roll_angles));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &sin_lamino));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &cos_lamino));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, table_size, sines));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, table_size, cosines));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &norm_factor));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &sin_roll));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &cos_roll));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i, sizeof (cl_int), (cl_int *) &cumulate));
+        set_kernel_args (priv, kernel, scalar ? 1 : burst, out_mem, requisition, sines, cosines, cumulate);
 
         profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-        ufo_profiler_call (profiler, cmd_queue, kernel, 3, global_work_size, local_work_size);
+        ufo_profiler_call (profiler, cmd_queue, kernel, 3, global_work_size, priv->local_work_size);
+
+        if (priv->kernel_events[set] != NULL)
+            UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (priv->kernel_events[set]));
+
+        /* Copies into this set wait for the marker, submit it right away */
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueMarker (cmd_queue, &priv->kernel_events[set]));
+        UFO_RESOURCES_CHECK_CLERR (clFlush (cmd_queue));
     }
 
     priv->count++;
@@ -552,6 +961,9 @@ ufo_lamino_backproject_task_set_property (GObject *object,
         case PROP_ADDRESSING_MODE:
             priv->addressing_mode = g_value_get_enum (value);
             break;
+        case PROP_BURST:
+            priv->burst = g_value_get_uint (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -606,6 +1018,9 @@ ufo_lamino_backproject_task_get_property (GObject *object,
         case PROP_ADDRESSING_MODE:
             g_value_set_enum (value, priv->addressing_mode);
             break;
+        case PROP_BURST:
+            g_value_set_uint (value, priv->burst);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -625,13 +1040,11 @@ ufo_lamino_backproject_task_finalize (GObject *object)
     g_value_array_free (priv->projection_offset);
     g_value_array_free (priv->center);
 
-    if (priv->vector_kernel) {
-        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->vector_kernel));
-        priv->vector_kernel = NULL;
-    }
-    if (priv->scalar_kernel) {
-        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->scalar_kernel));
-        priv->scalar_kernel = NULL;
+    for (i = 0; i < N_BURSTS; i++) {
+        if (priv->kernels[i]) {
+            UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->kernels[i]));
+            priv->kernels[i] = NULL;
+        }
     }
     if (priv->context) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
@@ -642,13 +1055,25 @@ ufo_lamino_backproject_task_finalize (GObject *object)
         priv->sampler = NULL;
     }
 
-    for (i = 0; i < BURST; i++) {
-        if (priv->images[i] != NULL) {
-            UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->images[i]));
-            priv->images[i] = NULL;
+    for (i = 0; i < N_IMAGE_SETS; i++) {
+        for (gint j = 0; j < MAX_BURST; j++) {
+            if (priv->images[i][j] != NULL) {
+                UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->images[i][j]));
+                priv->images[i][j] = NULL;
+            }
+        }
+
+        if (priv->kernel_events[i] != NULL) {
+            UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (priv->kernel_events[i]));
+            priv->kernel_events[i] = NULL;
         }
     }
 
+    if (priv->transfer_queue) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseCommandQueue (priv->transfer_queue));
+        priv->transfer_queue = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_lamino_backproject_task_parent_class)->finalize (object);
 }
 
@@ -785,6 +1210,14 @@ ufo_lamino_backproject_task_class_init (UfoLaminoBackprojectTaskClass *klass)
             CL_ADDRESS_CLAMP,
             G_PARAM_READWRITE);
 
+    properties[PROP_BURST] =
+        g_param_spec_uint ("burst",
+            "Number of projections processed by one kernel invocation",
+            "Number of projections processed by one kernel invocation (1, 2, 4, 8, 16), "
+                "0 to choose it and the local work size by timing them on the first projection",
+            0, MAX_BURST, 0,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -829,4 +1262,6 @@ ufo_lamino_backproject_task_init(UfoLaminoBackprojectTask *self)
     self->priv->count = 0;
     self->priv->addressing_mode = CL_ADDRESS_CLAMP;
     self->priv->generated = FALSE;
+    self->priv->configured = FALSE;
+    self->priv->burst = 0;
 }
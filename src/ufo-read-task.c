@@ -63,10 +63,38 @@ static GEnumValue type_values[] = {
     { 0, NULL, NULL}
 };
 
+typedef struct {
+    UfoBuffer      *buffer;
+    UfoRequisition  requisition;
+    gboolean        last;
+} Slot;
+
+/* Position in the file list, owned by whichever thread reads the frames */
+typedef struct {
+    GList          *element;
+    UfoReader      *reader;
+    guint           frame;
+    guint           roi_y;
+    guint           roi_height;
+    UfoBufferDepth  depth;
+} Cursor;
+
+/* Decoded frames of one file waiting to be emitted, protected by jobs_lock */
+typedef struct {
+    guint       index;
+    gchar      *filename;
+    UfoReader  *reader;
+    GQueue     *slots;
+    gboolean    finished;
+} Job;
+
+/* Decoders wait while this many frames of their file have not been emitted */
+#define MAX_FRAMES_PER_JOB 4
+
 struct _UfoReadTaskPrivate {
     gchar   *path;
     GList   *filenames;
-    GList   *current_element;
+    Cursor   cursor;
     guint    current;
     guint    step;
     guint    start;
@@ -74,14 +102,12 @@ struct _UfoReadTaskPrivate {
     gboolean done;
     gboolean single;
 
-    UfoBufferDepth  depth;
     gboolean convert;
 
     guint    roi_y;
     guint    roi_height;
     guint    roi_step;
 
-    UfoReader       *reader;
     UfoEdfReader    *edf_reader;
     UfoRawReader    *raw_reader;
 
@@ -94,9 +120,29 @@ struct _UfoReadTaskPrivate {
 #endif
 
     FileType         type;
+
+    guint            prefetch;
+    guint            prefetch_stalls;
+    gint             prefetch_stop;
+    GThread         *prefetch_thread;
+    GAsyncQueue     *free_slots;
+    GAsyncQueue     *filled_slots;
+    Slot            *pending;
+
+    guint            n_threads;
+    GThreadPool     *pool;
+    GPtrArray       *jobs;
+    GHashTable      *running;
+    GMutex           jobs_lock;
+    GCond            jobs_cond;
+    gboolean         decode_stop;
+    guint            n_submitted;
+    guint            n_consumed;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
+static void stop_prefetch (UfoReadTaskPrivate *priv);
+static void stop_decoders (UfoReadTaskPrivate *priv);
 
 G_DEFINE_TYPE_WITH_CODE (UfoReadTask, ufo_read_task, UFO_TYPE_TASK_NODE,
                          G_IMPLEMENT_INTERFACE (UFO_TYPE_TASK,
@@ -119,7 +165,11 @@ enum {
     PROP_RAW_BITDEPTH,
     PROP_RAW_PRE_OFFSET,
     PROP_RAW_POST_OFFSET,
+    PROP_RAW_MMAP,
     PROP_TYPE,
+    PROP_PREFETCH,
+    PROP_PREFETCH_STALLS,
+    PROP_NUM_THREADS,
     N_PROPERTIES
 };
 
@@ -141,8 +191,10 @@ read_filenames (UfoReadTaskPrivate *priv)
     result = NULL;
 
 #ifdef WITH_HDF5
-    if (ufo_reader_can_open (UFO_READER (priv->hdf5_reader), priv->path) || priv->type == TYPE_HDF5)
+    if (ufo_reader_can_open (UFO_READER (priv->hdf5_reader), priv->path) || priv->type == TYPE_HDF5) {
+        priv->single = TRUE;
         return g_list_append (NULL, g_strdup (priv->path));
+    }
 #endif
 
     if (g_file_test (priv->path, G_FILE_TEST_IS_REGULAR)) {
@@ -163,14 +215,14 @@ read_filenames (UfoReadTaskPrivate *priv)
 
 #ifdef HAVE_TIFF
         if (ufo_reader_can_open (UFO_READER (priv->tiff_reader), filename) || priv->type == TYPE_TIFF)
-            result = g_list_append (result, g_strdup (filename));
+            result = g_list_prepend (result, g_strdup (filename));
 #endif
 
         if (ufo_reader_can_open (UFO_READER (priv->edf_reader), filename) || priv->type == TYPE_EDF)
-            result = g_list_append (result, g_strdup (filename));
+            result = g_list_prepend (result, g_strdup (filename));
 
         if (ufo_reader_can_open (UFO_READER (priv->raw_reader), filename) || priv->type == TYPE_RAW)
-            result = g_list_append (result, g_strdup (filename));
+            result = g_list_prepend (result, g_strdup (filename));
     }
 
     globfree (&filenames);
@@ -187,6 +239,20 @@ ufo_read_task_setup (UfoTask *task,
 
     priv = UFO_READ_TASK_GET_PRIVATE (task);
 
+    /* A previous run may have left its threads and open reader behind */
+    stop_prefetch (priv);
+    stop_decoders (priv);
+
+    if (priv->cursor.reader != NULL) {
+        ufo_reader_close (priv->cursor.reader);
+        priv->cursor.reader = NULL;
+    }
+
+    if (priv->filenames != NULL) {
+        g_list_free_full (priv->filenames, (GDestroyNotify) g_free);
+        priv->filenames = NULL;
+    }
+
     priv->filenames = read_filenames (priv);
 
     if (priv->filenames == NULL) {
@@ -198,17 +264,22 @@ ufo_read_task_setup (UfoTask *task,
     priv->filenames = g_list_sort (priv->filenames, (GCompareFunc) g_strcmp0);
 
     if (priv->single)
-        priv->current_element = g_list_first (priv->filenames);
+        priv->cursor.element = g_list_first (priv->filenames);
     else
-        priv->current_element = g_list_nth (priv->filenames, priv->start);
+        priv->cursor.element = g_list_nth (priv->filenames, priv->start);
 
-    if (priv->current_element == NULL) {
+    if (priv->cursor.element == NULL) {
         g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
                      "start=%i skips too many files", priv->start);
     }
 
-    priv->start = 0;
+    /* Within a single file start and step count frames instead of files */
+    priv->cursor.frame = priv->single ? priv->start : 0;
+    priv->cursor.roi_y = priv->roi_y;
+    priv->cursor.roi_height = priv->roi_height;
+    priv->cursor.depth = UFO_BUFFER_DEPTH_32F;
     priv->current = 0;
+    priv->done = FALSE;
 }
 
 static UfoReader *
@@ -233,61 +304,442 @@ get_reader (UfoReadTaskPrivate *priv, const gchar *filename)
     return NULL;
 }
 
-static void
-ufo_read_task_get_requisition (UfoTask *task,
-                               UfoBuffer **inputs,
-                               UfoRequisition *requisition)
+static gboolean
+prepare_next_frame (UfoReadTaskPrivate *priv,
+                    Cursor *cursor,
+                    UfoRequisition *requisition)
 {
-    UfoReadTaskPrivate *priv;
     gsize width;
     gsize height;
     const gchar *filename;
 
-    priv = UFO_READ_TASK_GET_PRIVATE (UFO_READ_TASK (task));
-
-    if (priv->reader == NULL) {
-        filename = (gchar *) priv->current_element->data;
-        priv->reader = get_reader (priv, filename);
-        ufo_reader_open (priv->reader, filename, priv->start);
-        priv->start = 0;
+    if (cursor->reader == NULL) {
+        filename = (gchar *) cursor->element->data;
+        cursor->reader = get_reader (priv, filename);
+        ufo_reader_open (cursor->reader, filename, cursor->frame);
     }
 
-    if (!ufo_reader_data_available (priv->reader)) {
-        ufo_reader_close (priv->reader);
-        priv->current_element = g_list_nth (priv->current_element, priv->step);
+    if (!ufo_reader_data_available (cursor->reader)) {
+        ufo_reader_close (cursor->reader);
+        cursor->element = g_list_nth (cursor->element, priv->step);
 
-        if (priv->current_element == NULL) {
-            priv->done = TRUE;
-            priv->reader = NULL;
-            return;
+        if (cursor->element == NULL) {
+            cursor->reader = NULL;
+            return FALSE;
         }
         else {
-            filename = (gchar *) priv->current_element->data;
-            priv->reader = get_reader (priv, filename);
-            ufo_reader_open (priv->reader, filename, 0);
+            filename = (gchar *) cursor->element->data;
+            cursor->reader = get_reader (priv, filename);
+            ufo_reader_open (cursor->reader, filename, 0);
         }
     }
 
-    ufo_reader_get_meta (priv->reader, &width, &height, &priv->depth);
+    ufo_reader_get_meta (cursor->reader, &width, &height, &cursor->depth);
 
-    if (priv->roi_y >= height) {
-        g_warning ("read: vertical ROI start %i >= height %zu", priv->roi_y, height);
-        priv->roi_y = 0;
+    if (cursor->roi_y >= height) {
+        g_warning ("read: vertical ROI start %i >= height %zu", cursor->roi_y, height);
+        cursor->roi_y = 0;
     }
 
-    if (!priv->roi_height) {
-        priv->roi_height = height - priv->roi_y;
+    if (!cursor->roi_height) {
+        cursor->roi_height = height - cursor->roi_y;
     }
     else {
-        if (priv->roi_y + priv->roi_height > height) {
-            g_warning ("read: vertical ROI height %i >= height %zu", priv->roi_height, height);
-            priv->roi_height = height - priv->roi_y;
+        if (cursor->roi_y + cursor->roi_height > height) {
+            g_warning ("read: vertical ROI height %i >= height %zu", cursor->roi_height, height);
+            cursor->roi_height = height - cursor->roi_y;
         }
     }
 
     requisition->n_dims = 2;
     requisition->dims[0] = width;
-    requisition->dims[1] = priv->roi_height / priv->roi_step;
+    requisition->dims[1] = cursor->roi_height / priv->roi_step;
+    return TRUE;
+}
+
+static void
+advance_cursor (UfoReadTaskPrivate *priv, Cursor *cursor)
+{
+    /* Readers seek to the start frame when opening, which skips frames of a
+     * stack without decoding them */
+    if (priv->single && priv->step > 1) {
+        ufo_reader_close (cursor->reader);
+        cursor->reader = NULL;
+        cursor->frame += priv->step;
+    }
+}
+
+static void
+free_slot (Slot *slot)
+{
+    if (slot->buffer != NULL)
+        g_object_unref (slot->buffer);
+
+    g_free (slot);
+}
+
+static gpointer
+prefetch_thread (UfoReadTaskPrivate *priv)
+{
+    Cursor cursor;
+    guint n_read = 0;
+
+    /*
+     * The consumer does not touch its cursor while we are running, so we
+     * continue from a private copy and only hand out frames through slots.
+     */
+    cursor = priv->cursor;
+
+    while (!g_atomic_int_get (&priv->prefetch_stop)) {
+        UfoRequisition requisition;
+        Slot *slot;
+
+        if (n_read == priv->number || !prepare_next_frame (priv, &cursor, &requisition)) {
+            slot = g_new0 (Slot, 1);
+            slot->last = TRUE;
+            g_async_queue_push (priv->filled_slots, slot);
+            break;
+        }
+
+        /* Blocks until the consumer has handed back a slot */
+        slot = g_async_queue_pop (priv->free_slots);
+
+        if (g_atomic_int_get (&priv->prefetch_stop)) {
+            free_slot (slot);
+            break;
+        }
+
+        if (slot->buffer == NULL)
+            slot->buffer = ufo_buffer_new (&requisition, NULL);
+        else if (ufo_buffer_cmp_dimensions (slot->buffer, &requisition) != 0)
+            ufo_buffer_resize (slot->buffer, &requisition);
+
+        slot->requisition = requisition;
+        ufo_reader_read (cursor.reader, slot->buffer, &requisition, cursor.roi_y, cursor.roi_height, priv->roi_step);
+
+        if ((cursor.depth != UFO_BUFFER_DEPTH_32F) && priv->convert)
+            ufo_buffer_convert (slot->buffer, cursor.depth);
+
+        advance_cursor (priv, &cursor);
+
+        g_async_queue_push (priv->filled_slots, slot);
+        n_read++;
+    }
+
+    if (cursor.reader != NULL)
+        ufo_reader_close (cursor.reader);
+
+    return NULL;
+}
+
+static void
+start_prefetch (UfoReadTaskPrivate *priv)
+{
+    priv->free_slots = g_async_queue_new_full ((GDestroyNotify) free_slot);
+    priv->filled_slots = g_async_queue_new_full ((GDestroyNotify) free_slot);
+
+    for (guint i = 0; i < priv->prefetch; i++)
+        g_async_queue_push (priv->free_slots, g_new0 (Slot, 1));
+
+    priv->prefetch_stalls = 0;
+    g_atomic_int_set (&priv->prefetch_stop, 0);
+    priv->prefetch_thread = g_thread_new ("read-prefetch", (GThreadFunc) prefetch_thread, priv);
+}
+
+static void
+stop_prefetch (UfoReadTaskPrivate *priv)
+{
+    if (priv->prefetch_thread == NULL)
+        return;
+
+    /* Wake up the thread in case it is waiting for a free slot */
+    g_atomic_int_set (&priv->prefetch_stop, 1);
+    g_async_queue_push (priv->free_slots, g_new0 (Slot, 1));
+    g_thread_join (priv->prefetch_thread);
+    priv->prefetch_thread = NULL;
+
+    if (priv->pending != NULL) {
+        free_slot (priv->pending);
+        priv->pending = NULL;
+    }
+
+    g_async_queue_unref (priv->free_slots);
+    g_async_queue_unref (priv->filled_slots);
+    priv->free_slots = NULL;
+    priv->filled_slots = NULL;
+}
+
+static UfoReader *
+copy_reader (UfoReader *reader)
+{
+    GObject *copy;
+    GParamSpec **pspecs;
+    guint n_pspecs;
+
+    copy = g_object_new (G_OBJECT_TYPE (reader), NULL);
+    pspecs = g_object_class_list_properties (G_OBJECT_GET_CLASS (reader), &n_pspecs);
+
+    for (guint i = 0; i < n_pspecs; i++) {
+        GValue value = G_VALUE_INIT;
+
+        if ((pspecs[i]->flags & G_PARAM_READWRITE) != G_PARAM_READWRITE)
+            continue;
+
+        g_value_init (&value, pspecs[i]->value_type);
+        g_object_get_property (G_OBJECT (reader), pspecs[i]->name, &value);
+        g_object_set_property (copy, pspecs[i]->name, &value);
+        g_value_unset (&value);
+    }
+
+    g_free (pspecs);
+    return UFO_READER (copy);
+}
+
+static void
+free_job (Job *job)
+{
+    g_queue_free_full (job->slots, (GDestroyNotify) free_slot);
+    g_object_unref (job->reader);
+    g_free (job);
+}
+
+static void
+decode_file (Job *job, UfoReadTaskPrivate *priv)
+{
+    gsize width;
+    gsize height;
+    UfoBufferDepth depth;
+    guint n_decoded = 0;
+
+    ufo_reader_open (job->reader, job->filename, 0);
+
+    /* No file can contribute more than number frames */
+    while (n_decoded < priv->number && ufo_reader_data_available (job->reader)) {
+        Slot *slot;
+        guint roi_y;
+        guint roi_height;
+        gboolean stop;
+
+        /* Bound the memory of multi-frame files by the consumer's pace */
+        g_mutex_lock (&priv->jobs_lock);
+
+        while (!priv->decode_stop && g_queue_get_length (job->slots) >= MAX_FRAMES_PER_JOB)
+            g_cond_wait (&priv->jobs_cond, &priv->jobs_lock);
+
+        stop = priv->decode_stop;
+        g_mutex_unlock (&priv->jobs_lock);
+
+        if (stop)
+            break;
+
+        ufo_reader_get_meta (job->reader, &width, &height, &depth);
+
+        /* Same clamping as prepare_next_frame but without touching the cursor */
+        roi_y = priv->roi_y < height ? priv->roi_y : 0;
+        roi_height = priv->roi_height;
+
+        if (!roi_height || roi_y + roi_height > height)
+            roi_height = height - roi_y;
+
+        slot = g_new0 (Slot, 1);
+        slot->requisition.n_dims = 2;
+        slot->requisition.dims[0] = width;
+        slot->requisition.dims[1] = roi_height / priv->roi_step;
+        slot->buffer = ufo_buffer_new (&slot->requisition, NULL);
+
+        ufo_reader_read (job->reader, slot->buffer, &slot->requisition, roi_y, roi_height, priv->roi_step);
+
+        if ((depth != UFO_BUFFER_DEPTH_32F) && priv->convert)
+            ufo_buffer_convert (slot->buffer, depth);
+
+        g_mutex_lock (&priv->jobs_lock);
+        g_queue_push_tail (job->slots, slot);
+        g_cond_broadcast (&priv->jobs_cond);
+        g_mutex_unlock (&priv->jobs_lock);
+        n_decoded++;
+    }
+
+    ufo_reader_close (job->reader);
+
+    g_mutex_lock (&priv->jobs_lock);
+    job->finished = TRUE;
+    g_cond_broadcast (&priv->jobs_cond);
+    g_mutex_unlock (&priv->jobs_lock);
+}
+
+static void
+submit_decode (UfoReadTaskPrivate *priv)
+{
+    Job *job;
+    const gchar *filename;
+
+    if (priv->n_submitted == priv->jobs->len)
+        return;
+
+    filename = g_ptr_array_index (priv->jobs, priv->n_submitted);
+    job = g_new0 (Job, 1);
+    job->index = priv->n_submitted++;
+    job->filename = (gchar *) filename;
+    job->reader = copy_reader (get_reader (priv, filename));
+    job->slots = g_queue_new ();
+    job->finished = FALSE;
+
+    g_mutex_lock (&priv->jobs_lock);
+    g_hash_table_insert (priv->running, GUINT_TO_POINTER (job->index), job);
+    g_mutex_unlock (&priv->jobs_lock);
+
+    g_thread_pool_push (priv->pool, job, NULL);
+}
+
+static void
+start_decoders (UfoReadTaskPrivate *priv)
+{
+    guint window;
+
+    priv->jobs = g_ptr_array_new ();
+
+    for (GList *it = priv->cursor.element; it != NULL; it = g_list_nth (it, priv->step))
+        g_ptr_array_add (priv->jobs, it->data);
+
+    priv->running = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) free_job);
+    priv->pool = g_thread_pool_new ((GFunc) decode_file, priv, priv->n_threads, FALSE, NULL);
+    priv->decode_stop = FALSE;
+    priv->n_submitted = 0;
+    priv->n_consumed = 0;
+    priv->prefetch_stalls = 0;
+
+    /*
+     * Bound the number of files being decoded or waiting to be emitted. Jobs
+     * start in submission order, so the file the consumer waits for is always
+     * being decoded even if all other workers wait for their files to drain.
+     */
+    window = MAX (priv->prefetch, 2 * priv->n_threads);
+
+    for (guint i = 0; i < window; i++)
+        submit_decode (priv);
+}
+
+static void
+stop_decoders (UfoReadTaskPrivate *priv)
+{
+    if (priv->pool == NULL)
+        return;
+
+    /* Queued jobs still run but return right after opening their file */
+    g_mutex_lock (&priv->jobs_lock);
+    priv->decode_stop = TRUE;
+    g_cond_broadcast (&priv->jobs_cond);
+    g_mutex_unlock (&priv->jobs_lock);
+
+    g_thread_pool_free (priv->pool, FALSE, TRUE);
+    priv->pool = NULL;
+
+    if (priv->pending != NULL) {
+        free_slot (priv->pending);
+        priv->pending = NULL;
+    }
+
+    g_hash_table_destroy (priv->running);
+    g_ptr_array_free (priv->jobs, TRUE);
+    priv->running = NULL;
+    priv->jobs = NULL;
+}
+
+static Slot *
+next_decoded_frame (UfoReadTaskPrivate *priv)
+{
+    while (priv->n_consumed < priv->jobs->len) {
+        Job *job;
+        Slot *slot;
+
+        g_mutex_lock (&priv->jobs_lock);
+
+        /* Files may finish out of order, frames are taken from the next one in line */
+        job = g_hash_table_lookup (priv->running, GUINT_TO_POINTER (priv->n_consumed));
+
+        if (g_queue_is_empty (job->slots) && !job->finished)
+            priv->prefetch_stalls++;
+
+        while (g_queue_is_empty (job->slots) && !job->finished)
+            g_cond_wait (&priv->jobs_cond, &priv->jobs_lock);
+
+        slot = g_queue_pop_head (job->slots);
+
+        if (slot != NULL) {
+            /* The decoder may wait for room */
+            g_cond_broadcast (&priv->jobs_cond);
+            g_mutex_unlock (&priv->jobs_lock);
+            return slot;
+        }
+
+        g_hash_table_remove (priv->running, GUINT_TO_POINTER (priv->n_consumed));
+        g_mutex_unlock (&priv->jobs_lock);
+
+        priv->n_consumed++;
+        submit_decode (priv);
+    }
+
+    return NULL;
+}
+
+static void
+ufo_read_task_get_requisition (UfoTask *task,
+                               UfoBuffer **inputs,
+                               UfoRequisition *requisition)
+{
+    UfoReadTaskPrivate *priv;
+
+    priv = UFO_READ_TASK_GET_PRIVATE (UFO_READ_TASK (task));
+
+    /* Decoding in parallel only pays off for many files */
+    if (priv->n_threads > 1 && priv->filenames->next != NULL) {
+        if (priv->current == priv->number) {
+            /* Do not decode any further than needed */
+            stop_decoders (priv);
+            priv->done = TRUE;
+            return;
+        }
+
+        if (priv->pool == NULL)
+            start_decoders (priv);
+
+        if (priv->pending == NULL)
+            priv->pending = next_decoded_frame (priv);
+
+        if (priv->pending == NULL) {
+            priv->done = TRUE;
+            return;
+        }
+
+        *requisition = priv->pending->requisition;
+        return;
+    }
+
+    if (priv->prefetch == 0) {
+        if (!prepare_next_frame (priv, &priv->cursor, requisition))
+            priv->done = TRUE;
+
+        return;
+    }
+
+    if (priv->prefetch_thread == NULL)
+        start_prefetch (priv);
+
+    if (priv->pending == NULL) {
+        priv->pending = g_async_queue_try_pop (priv->filled_slots);
+
+        if (priv->pending == NULL) {
+            priv->prefetch_stalls++;
+            priv->pending = g_async_queue_pop (priv->filled_slots);
+        }
+    }
+
+    if (priv->pending->last) {
+        priv->done = TRUE;
+        return;
+    }
+
+    *requisition = priv->pending->requisition;
 }
 
 static guint
@@ -321,10 +773,34 @@ ufo_read_task_generate (UfoTask *task,
     if (priv->current == priv->number || priv->done)
         return FALSE;
 
-    ufo_reader_read (priv->reader, output, requisition, priv->roi_y, priv->roi_height, priv->roi_step);
+    /*
+     * Frames are handed over by swapping the memory of the slot and the output
+     * buffer. Prefetch slots keep the old output memory for the next frame,
+     * decoded slots are freed together with it.
+     */
+    if (priv->pool != NULL) {
+        ufo_buffer_swap_data (priv->pending->buffer, output);
+        free_slot (priv->pending);
+        priv->pending = NULL;
+        priv->current++;
+        return TRUE;
+    }
+
+    if (priv->prefetch > 0) {
+        ufo_buffer_swap_data (priv->pending->buffer, output);
+        g_async_queue_push (priv->free_slots, priv->pending);
+        priv->pending = NULL;
+        priv->current++;
+        return TRUE;
+    }
+
+    ufo_reader_read (priv->cursor.reader, output, requisition,
+                     priv->cursor.roi_y, priv->cursor.roi_height, priv->roi_step);
 
-    if ((priv->depth != UFO_BUFFER_DEPTH_32F) && priv->convert)
-        ufo_buffer_convert (output, priv->depth);
+    if ((priv->cursor.depth != UFO_BUFFER_DEPTH_32F) && priv->convert)
+        ufo_buffer_convert (output, priv->cursor.depth);
+
+    advance_cursor (priv, &priv->cursor);
 
     priv->current++;
     return TRUE;
@@ -382,9 +858,18 @@ ufo_read_task_set_property (GObject *object,
         case PROP_RAW_POST_OFFSET:
             g_object_set (priv->raw_reader, "post-offset", g_value_get_ulong (value), NULL);
             break;
+        case PROP_RAW_MMAP:
+            g_object_set (priv->raw_reader, "mmap", g_value_get_boolean (value), NULL);
+            break;
         case PROP_TYPE:
             priv->type = g_value_get_enum (value);
             break;
+        case PROP_PREFETCH:
+            priv->prefetch = g_value_get_uint (value);
+            break;
+        case PROP_NUM_THREADS:
+            priv->n_threads = g_value_get_uint (value);
+            break;
 
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -454,9 +939,26 @@ ufo_read_task_get_property (GObject *object,
                 g_value_set_ulong (value, ulvalue);
             }
             break;
+        case PROP_RAW_MMAP:
+            {
+                gboolean bvalue;
+
+                g_object_get (priv->raw_reader, "mmap", &bvalue, NULL);
+                g_value_set_boolean (value, bvalue);
+            }
+            break;
         case PROP_TYPE:
             g_value_set_enum (value, priv->type);
             break;
+        case PROP_PREFETCH:
+            g_value_set_uint (value, priv->prefetch);
+            break;
+        case PROP_PREFETCH_STALLS:
+            g_value_set_uint (value, priv->prefetch_stalls);
+            break;
+        case PROP_NUM_THREADS:
+            g_value_set_uint (value, priv->n_threads);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -470,6 +972,9 @@ ufo_read_task_dispose (GObject *object)
 
     priv = UFO_READ_TASK_GET_PRIVATE (object);
 
+    stop_prefetch (priv);
+    stop_decoders (priv);
+
     g_object_unref (priv->edf_reader);
     g_object_unref (priv->raw_reader);
 
@@ -494,6 +999,9 @@ ufo_read_task_finalize (GObject *object)
     g_free (priv->path);
     priv->path = NULL;
 
+    g_mutex_clear (&priv->jobs_lock);
+    g_cond_clear (&priv->jobs_cond);
+
     if (priv->filenames != NULL) {
         g_list_free_full (priv->filenames, (GDestroyNotify) g_free);
         priv->filenames = NULL;
@@ -614,6 +1122,13 @@ ufo_read_task_class_init(UfoReadTaskClass *klass)
             0, G_MAXULONG, 0,
             G_PARAM_READWRITE);
 
+    properties[PROP_RAW_MMAP] =
+        g_param_spec_boolean ("raw-mmap",
+            "Map raw files into memory instead of reading them",
+            "Map raw files into memory instead of reading them",
+            FALSE,
+            G_PARAM_READWRITE);
+
     properties[PROP_TYPE] =
         g_param_spec_enum ("type",
             "Override type detection based on extension",
@@ -622,6 +1137,27 @@ ufo_read_task_class_init(UfoReadTaskClass *klass)
             TYPE_UNSPECIFIED,
             G_PARAM_READWRITE);
 
+    properties[PROP_PREFETCH] =
+        g_param_spec_uint ("prefetch",
+            "Number of frames read ahead in the background",
+            "Number of frames read ahead in the background, 0 disables read-ahead",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_PREFETCH_STALLS] =
+        g_param_spec_uint ("prefetch-stalls",
+            "Number of times no prefetched frame was ready",
+            "Number of times no prefetched frame was ready",
+            0, G_MAXUINT, 0,
+            G_PARAM_READABLE);
+
+    properties[PROP_NUM_THREADS] =
+        g_param_spec_uint ("num-threads",
+            "Number of files decoded in parallel",
+            "Number of files decoded in parallel",
+            1, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -642,7 +1178,6 @@ ufo_read_task_init(UfoReadTask *self)
     priv->convert = TRUE;
     priv->start = 0;
     priv->number = G_MAXUINT;
-    priv->depth = UFO_BUFFER_DEPTH_32F;
 
     priv->edf_reader = ufo_edf_reader_new ();
     priv->raw_reader = ufo_raw_reader_new ();
@@ -655,8 +1190,25 @@ ufo_read_task_init(UfoReadTask *self)
     priv->hdf5_reader = ufo_hdf5_reader_new ();
 #endif
 
-    priv->reader = NULL;
+    priv->cursor.element = NULL;
+    priv->cursor.reader = NULL;
+    priv->cursor.frame = 0;
+    priv->cursor.depth = UFO_BUFFER_DEPTH_32F;
     priv->done = FALSE;
     priv->single = FALSE;
     priv->type = TYPE_UNSPECIFIED;
+    priv->prefetch = 0;
+    priv->prefetch_stalls = 0;
+    priv->prefetch_stop = 0;
+    priv->prefetch_thread = NULL;
+    priv->free_slots = NULL;
+    priv->filled_slots = NULL;
+    priv->pending = NULL;
+    priv->n_threads = 1;
+    priv->pool = NULL;
+    priv->jobs = NULL;
+    priv->running = NULL;
+    priv->decode_stop = FALSE;
+    g_mutex_init (&priv->jobs_lock);
+    g_cond_init (&priv->jobs_cond);
 }
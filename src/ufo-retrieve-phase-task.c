@@ -57,8 +57,10 @@ struct _UfoRetrievePhaseTaskPrivate {
 
     gfloat prefac;
     gint normalize;
+    gboolean half_spectrum;
     cl_kernel *kernels;
     cl_kernel mult_by_value_kernel;
+    cl_kernel mult_by_value_half_kernel;
     cl_context context;
     UfoBuffer *filter_buffer;
 };
@@ -80,6 +82,7 @@ enum {
     PROP_PIXEL_SIZE,
     PROP_REGULARIZATION_RATE,
     PROP_BINARY_FILTER_THRESHOLDING,
+    PROP_HALF_SPECTRUM,
     N_PROPERTIES
 };
 
@@ -113,6 +116,7 @@ ufo_retrieve_phase_task_setup (UfoTask *task,
     priv->kernels[METHOD_QP2] = ufo_resources_get_kernel(resources, "phase-retrieval.cl", "qp2_method", error);
 
     priv->mult_by_value_kernel = ufo_resources_get_kernel(resources, "phase-retrieval.cl", "mult_by_value", error);
+    priv->mult_by_value_half_kernel = ufo_resources_get_kernel(resources, "phase-retrieval.cl", "mult_by_value_half", error);
 
     UFO_RESOURCES_CHECK_CLERR (clRetainContext(priv->context));
 
@@ -134,6 +138,18 @@ ufo_retrieve_phase_task_setup (UfoTask *task,
     if (priv->mult_by_value_kernel != NULL) {
         UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->mult_by_value_kernel));
     }
+
+    if (priv->mult_by_value_half_kernel != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->mult_by_value_half_kernel));
+    }
+}
+
+/* Width of the full spectrum, a half spectrum stems from an even-sized
+ * transform and keeps its first n / 2 + 1 complex values */
+static gsize
+get_full_width (UfoRetrievePhaseTaskPrivate *priv, UfoRequisition *requisition)
+{
+    return priv->half_spectrum ? 2 * (requisition->dims[0] - 2) : requisition->dims[0];
 }
 
 static void
@@ -141,9 +157,14 @@ ufo_retrieve_phase_task_get_requisition (UfoTask *task,
                                          UfoBuffer **inputs,
                                          UfoRequisition *requisition)
 {
+    UfoRetrievePhaseTaskPrivate *priv;
+    gsize width;
+
+    priv = UFO_RETRIEVE_PHASE_TASK_GET_PRIVATE (task);
     ufo_buffer_get_requisition (inputs[0], requisition);
+    width = get_full_width (priv, requisition);
 
-    if (!IS_POW_OF_2 (requisition->dims[0]) || !IS_POW_OF_2 (requisition->dims[1])) {
+    if (!IS_POW_OF_2 (width) || !IS_POW_OF_2 (requisition->dims[1])) {
         g_error("Please, perform zeropadding of your dataset along both directions (width, height) up to length of power of 2 (e.g. 256, 512, 1024, 2048, etc.)");
     }
 }
@@ -176,6 +197,7 @@ ufo_retrieve_phase_task_process (UfoTask *task,
     UfoRetrievePhaseTaskPrivate *priv;
     UfoGpuNode *node;
     UfoProfiler *profiler;
+    UfoRequisition filter_req;
 
     cl_mem in_mem, out_mem, filter_mem;
     cl_kernel method_kernel;
@@ -189,8 +211,12 @@ ufo_retrieve_phase_task_process (UfoTask *task,
     in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
     profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
 
-    if (ufo_buffer_cmp_dimensions (priv->filter_buffer, requisition) != 0) {
-        ufo_buffer_resize (priv->filter_buffer, requisition);
+    /* The filter is always computed for the full spectrum */
+    filter_req = *requisition;
+    filter_req.dims[0] = get_full_width (priv, requisition);
+
+    if (ufo_buffer_cmp_dimensions (priv->filter_buffer, &filter_req) != 0) {
+        ufo_buffer_resize (priv->filter_buffer, &filter_req);
         filter_mem = ufo_buffer_get_device_array (priv->filter_buffer, cmd_queue);
 
         method_kernel = priv->kernels[(gint)priv->method];
@@ -200,16 +226,27 @@ ufo_retrieve_phase_task_process (UfoTask *task,
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (method_kernel, 2, sizeof (gfloat), &priv->regularization_rate));
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (method_kernel, 3, sizeof (gfloat), &priv->binary_filter));
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (method_kernel, 4, sizeof (cl_mem), &filter_mem));
-        ufo_profiler_call (profiler, cmd_queue, method_kernel, requisition->n_dims, requisition->dims, NULL);
+        ufo_profiler_call (profiler, cmd_queue, method_kernel, filter_req.n_dims, filter_req.dims, NULL);
     }
     else {
         filter_mem = ufo_buffer_get_device_array (priv->filter_buffer, cmd_queue);
     }
 
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_kernel, 0, sizeof (cl_mem), &in_mem));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_kernel, 1, sizeof (cl_mem), &filter_mem));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_kernel, 2, sizeof (cl_mem), &out_mem));
-    ufo_profiler_call (profiler, cmd_queue, priv->mult_by_value_kernel, requisition->n_dims, requisition->dims, NULL);
+    if (priv->half_spectrum) {
+        cl_int filter_width = (cl_int) filter_req.dims[0];
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_half_kernel, 0, sizeof (cl_mem), &in_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_half_kernel, 1, sizeof (cl_mem), &filter_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_half_kernel, 2, sizeof (cl_mem), &out_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_half_kernel, 3, sizeof (cl_int), &filter_width));
+        ufo_profiler_call (profiler, cmd_queue, priv->mult_by_value_half_kernel, requisition->n_dims, requisition->dims, NULL);
+    }
+    else {
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_kernel, 0, sizeof (cl_mem), &in_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_kernel, 1, sizeof (cl_mem), &filter_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_kernel, 2, sizeof (cl_mem), &out_mem));
+        ufo_profiler_call (profiler, cmd_queue, priv->mult_by_value_kernel, requisition->n_dims, requisition->dims, NULL);
+    }
     
     return TRUE;
 }
@@ -241,6 +278,9 @@ ufo_retrieve_phase_task_get_property (GObject *object,
         case PROP_BINARY_FILTER_THRESHOLDING:
             g_value_set_float (value, priv->binary_filter);
             break;
+        case PROP_HALF_SPECTRUM:
+            g_value_set_boolean (value, priv->half_spectrum);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -274,6 +314,9 @@ ufo_retrieve_phase_task_set_property (GObject *object,
         case PROP_BINARY_FILTER_THRESHOLDING:
             priv->binary_filter = g_value_get_float (value);
             break;
+        case PROP_HALF_SPECTRUM:
+            priv->half_spectrum = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -302,6 +345,11 @@ ufo_retrieve_phase_task_finalize (GObject *object)
         priv->mult_by_value_kernel = NULL;
     }
 
+    if (priv->mult_by_value_half_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->mult_by_value_half_kernel));
+        priv->mult_by_value_half_kernel = NULL;
+    }
+
     if (priv->context) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
         priv->context = NULL;
@@ -377,6 +425,13 @@ ufo_retrieve_phase_task_class_init (UfoRetrievePhaseTaskClass *klass)
             0, G_MAXFLOAT, 0.1,
             G_PARAM_READWRITE);
 
+    properties[PROP_HALF_SPECTRUM] =
+        g_param_spec_boolean ("half-spectrum",
+            "Input is a half spectrum from a real-to-complex transform",
+            "Input is a half spectrum from a real-to-complex transform",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -395,6 +450,8 @@ ufo_retrieve_phase_task_init(UfoRetrievePhaseTask *self)
     priv->regularization_rate = 2.5f;
     priv->binary_filter = 0.1f;
     priv->normalize = 1;
+    priv->half_spectrum = FALSE;
+    priv->mult_by_value_half_kernel = NULL;
     priv->kernels = (cl_kernel *) g_malloc0(N_METHODS * sizeof(cl_kernel));
     priv->filter_buffer = NULL;
 }
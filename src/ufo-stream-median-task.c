@@ -0,0 +1,676 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gmodule.h>
+
+#include "ufo-stream-median-task.h"
+
+/*
+ * The first exact-frames values of every pixel are kept, which gives the exact
+ * percentile for short streams. With more frames, the kept values initialize a
+ * per-pixel estimator and are dropped, so that memory does not grow with the
+ * number of frames:
+ *
+ * - histogram: counts in a fixed number of bins spanning the range of the kept
+ *   values widened by half of it. Values outside of the range double it by
+ *   merging pairs of bins, the error is at most one bin width.
+ * - p2: the P-square algorithm of Jain and Chlamtac, which tracks five markers
+ *   whose middle one approximates the percentile.
+ */
+
+/* The histogram range is widened by this fraction of the initial range at both ends */
+#define HISTOGRAM_MARGIN 0.25f
+
+typedef enum {
+    ESTIMATOR_HISTOGRAM,
+    ESTIMATOR_P2
+} Estimator;
+
+static GEnumValue estimator_values[] = {
+    { ESTIMATOR_HISTOGRAM,  "ESTIMATOR_HISTOGRAM",  "histogram" },
+    { ESTIMATOR_P2,         "ESTIMATOR_P2",         "p2" },
+    { 0, NULL, NULL}
+};
+
+struct _UfoStreamMedianTaskPrivate {
+    gsize n_pixels;
+    guint counter;
+    guint n_generate;
+    gfloat percentile;
+    guint exact_frames;
+    Estimator estimator;
+    guint n_bins;
+
+    /* exact_frames values per pixel until the estimator takes over */
+    gfloat *values;
+    /* histogram: n_bins counts, start and bin width per pixel */
+    guint16 *counts;
+    gfloat *starts;
+    gfloat *widths;
+    /* p2: five heights and the positions of the three inner markers per pixel */
+    gfloat *markers;
+    gfloat *result;
+};
+
+enum {
+    PROP_0,
+    PROP_NUM_GENERATE,
+    PROP_PERCENTILE,
+    PROP_EXACT_FRAMES,
+    PROP_ESTIMATOR,
+    PROP_NUM_BINS,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES] = { NULL, };
+
+static void ufo_task_interface_init (UfoTaskIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (UfoStreamMedianTask, ufo_stream_median_task, UFO_TYPE_TASK_NODE,
+                         G_IMPLEMENT_INTERFACE (UFO_TYPE_TASK,
+                                                ufo_task_interface_init))
+
+#define UFO_STREAM_MEDIAN_TASK_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_STREAM_MEDIAN_TASK, UfoStreamMedianTaskPrivate))
+
+
+UfoNode *
+ufo_stream_median_task_new (void)
+{
+    return UFO_NODE (g_object_new (UFO_TYPE_STREAM_MEDIAN_TASK, NULL));
+}
+
+static void
+ufo_stream_median_task_setup (UfoTask *task,
+                              UfoResources *resources,
+                              GError **error)
+{
+    UfoStreamMedianTaskPrivate *priv;
+
+    priv = UFO_STREAM_MEDIAN_TASK_GET_PRIVATE (task);
+
+    if (priv->estimator == ESTIMATOR_HISTOGRAM && priv->exact_frames < 2) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "The histogram estimator needs at least 2 exact frames");
+        return;
+    }
+
+    if (priv->estimator == ESTIMATOR_P2 && priv->exact_frames < 5) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "The p2 estimator needs at least 5 exact frames");
+        return;
+    }
+}
+
+static void
+ufo_stream_median_task_get_requisition (UfoTask *task,
+                                        UfoBuffer **inputs,
+                                        UfoRequisition *requisition)
+{
+    UfoStreamMedianTaskPrivate *priv;
+
+    priv = UFO_STREAM_MEDIAN_TASK_GET_PRIVATE (UFO_STREAM_MEDIAN_TASK (task));
+    ufo_buffer_get_requisition (inputs[0], requisition);
+
+    if (priv->n_pixels == 0) {
+        priv->n_pixels = requisition->dims[0] * requisition->dims[1];
+        priv->values = g_malloc (priv->n_pixels * priv->exact_frames * sizeof (gfloat));
+    }
+}
+
+static guint
+ufo_stream_median_task_get_num_inputs (UfoTask *task)
+{
+    return 1;
+}
+
+static guint
+ufo_stream_median_task_get_num_dimensions (UfoTask *task,
+                                           guint input)
+{
+    g_return_val_if_fail (input == 0, 0);
+    return 2;
+}
+
+static UfoTaskMode
+ufo_stream_median_task_get_mode (UfoTask *task)
+{
+    return UFO_TASK_MODE_REDUCTOR | UFO_TASK_MODE_CPU;
+}
+
+static gint
+cmp_float (gconstpointer p1, gconstpointer p2)
+{
+    const gfloat a = *((const gfloat *) p1);
+    const gfloat b = *((const gfloat *) p2);
+
+    return (a > b) - (a < b);
+}
+
+static void
+sort_values (gfloat *values, guint n)
+{
+    if (n > 64) {
+        qsort (values, n, sizeof (gfloat), cmp_float);
+        return;
+    }
+
+    /* Insertion sort is faster for the few values usually kept */
+    for (guint i = 1; i < n; i++) {
+        gfloat value = values[i];
+        guint j = i;
+
+        for (; j > 0 && values[j - 1] > value; j--)
+            values[j] = values[j - 1];
+
+        values[j] = value;
+    }
+}
+
+static guint
+get_rank (gfloat percentile, guint n)
+{
+    return (guint) roundf (percentile / 100.0f * (n - 1));
+}
+
+static void
+histogram_init (UfoStreamMedianTaskPrivate *priv, gsize pixel, gfloat *sorted)
+{
+    guint16 *counts = priv->counts + pixel * priv->n_bins;
+    gfloat lower = sorted[0];
+    gfloat range = sorted[priv->exact_frames - 1] - lower;
+
+    if (range <= 0.0f)
+        range = MAX (fabsf (lower) * 1e-3f, 1e-6f);
+
+    priv->starts[pixel] = lower - HISTOGRAM_MARGIN * range;
+    priv->widths[pixel] = (1.0f + 2 * HISTOGRAM_MARGIN) * range / priv->n_bins;
+    memset (counts, 0, priv->n_bins * sizeof (guint16));
+}
+
+static guint
+get_merged_count (guint16 *counts, guint n_bins, guint shift, guint bin)
+{
+    guint count = 0;
+
+    /* Old bins 2 * bin - shift and the one after it form the new bin */
+    for (guint i = 2 * bin; i < 2 * bin + 2; i++) {
+        if (i >= shift && i - shift < n_bins)
+            count += counts[i - shift];
+    }
+
+    return count;
+}
+
+/*
+ * Double the bin width by merging pairs of bins. The old range becomes the
+ * lower half of the new one, or the upper half when extending @downwards.
+ */
+static void
+histogram_widen (UfoStreamMedianTaskPrivate *priv, gsize pixel, gboolean downwards)
+{
+    guint16 *counts = priv->counts + pixel * priv->n_bins;
+    const guint n_bins = priv->n_bins;
+    const guint shift = downwards ? n_bins : 0;
+    guint bin;
+
+    for (bin = 0; bin < n_bins; bin++) {
+        if (get_merged_count (counts, n_bins, shift, bin) > G_MAXUINT16)
+            break;
+    }
+
+    if (bin < n_bins) {
+        /* Keep the proportions if a merged count would overflow */
+        for (guint i = 0; i < n_bins; i++)
+            counts[i] = (counts[i] + 1) / 2;
+    }
+
+    /* New bins read only old bins at the same or a lower index when extending
+     * downwards and at the same or a higher index otherwise */
+    if (downwards) {
+        for (bin = n_bins; bin-- > 0;)
+            counts[bin] = MIN (get_merged_count (counts, n_bins, shift, bin), G_MAXUINT16);
+
+        priv->starts[pixel] -= n_bins * priv->widths[pixel];
+    }
+    else {
+        for (bin = 0; bin < n_bins; bin++)
+            counts[bin] = MIN (get_merged_count (counts, n_bins, shift, bin), G_MAXUINT16);
+    }
+
+    priv->widths[pixel] *= 2.0f;
+}
+
+static void
+histogram_add (UfoStreamMedianTaskPrivate *priv, gsize pixel, gfloat value)
+{
+    guint16 *counts = priv->counts + pixel * priv->n_bins;
+    gfloat position = (value - priv->starts[pixel]) / priv->widths[pixel];
+    guint bin;
+
+    while (isfinite (value) && isfinite (priv->widths[pixel]) &&
+           !(position >= 0.0f && position < priv->n_bins)) {
+        histogram_widen (priv, pixel, position < 0.0f);
+        position = (value - priv->starts[pixel]) / priv->widths[pixel];
+    }
+
+    /* Only non-finite values are counted in the first and last bins */
+    bin = !(position > 0.0f) ? 0 : (guint) MIN (position, priv->n_bins - 1);
+
+    if (counts[bin] == G_MAXUINT16) {
+        /* Keep the proportions if a count would overflow */
+        for (guint i = 0; i < priv->n_bins; i++)
+            counts[i] = (counts[i] + 1) / 2;
+    }
+
+    counts[bin]++;
+}
+
+static gfloat
+histogram_get (UfoStreamMedianTaskPrivate *priv, gsize pixel)
+{
+    guint16 *counts = priv->counts + pixel * priv->n_bins;
+    guint64 total = 0, cumulated = 0;
+    gdouble rank;
+    guint i;
+
+    for (i = 0; i < priv->n_bins; i++)
+        total += counts[i];
+
+    rank = priv->percentile / 100.0 * (total - 1);
+
+    for (i = 0; i < priv->n_bins - 1; i++) {
+        if (cumulated + counts[i] > rank)
+            break;
+
+        cumulated += counts[i];
+    }
+
+    /* Interpolate linearly within the bin */
+    return priv->starts[pixel] +
+           (i + (rank - cumulated + 0.5) / MAX (counts[i], 1)) * priv->widths[pixel];
+}
+
+static void
+p2_init (UfoStreamMedianTaskPrivate *priv, gsize pixel, gfloat *sorted)
+{
+    gfloat *heights = priv->markers + pixel * 8;
+    gfloat *positions = heights + 5;
+    const gfloat p = priv->percentile / 100.0f;
+    const gfloat increments[5] = {0.0f, p / 2, p, (1.0f + p) / 2, 1.0f};
+    const guint n = priv->exact_frames;
+
+    for (guint i = 0; i < 5; i++) {
+        guint position = (guint) roundf (increments[i] * (n - 1));
+
+        /* Inner markers must stay apart from each other */
+        if (i > 0 && i < 4)
+            position = CLAMP (position, i, n - 5 + i);
+
+        heights[i] = sorted[position];
+
+        if (i > 0 && i < 4)
+            positions[i - 1] = position;
+    }
+}
+
+static void
+p2_add (UfoStreamMedianTaskPrivate *priv, gsize pixel, gfloat value, const gfloat desired[5])
+{
+    gfloat *q = priv->markers + pixel * 8;
+    gfloat n[5];
+    guint k;
+
+    n[0] = 0.0f;
+    n[1] = q[5];
+    n[2] = q[6];
+    n[3] = q[7];
+    n[4] = desired[4];
+
+    if (value < q[0]) {
+        q[0] = value;
+        k = 0;
+    }
+    else if (value >= q[4]) {
+        q[4] = value;
+        k = 3;
+    }
+    else {
+        for (k = 0; k < 3 && value >= q[k + 1]; k++)
+            ;
+    }
+
+    for (guint i = k + 1; i < 4; i++)
+        n[i] += 1.0f;
+
+    for (guint i = 1; i < 4; i++) {
+        gfloat d = desired[i] - n[i];
+
+        if ((d >= 1.0f && n[i + 1] - n[i] > 1.0f) || (d <= -1.0f && n[i - 1] - n[i] < -1.0f)) {
+            gint s = d > 0.0f ? 1 : -1;
+            gfloat parabolic;
+
+            parabolic = q[i] + s / (n[i + 1] - n[i - 1]) *
+                        ((n[i] - n[i - 1] + s) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+                         (n[i + 1] - n[i] - s) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+
+            if (q[i - 1] < parabolic && parabolic < q[i + 1])
+                q[i] = parabolic;
+            else
+                q[i] += s * (q[i + s] - q[i]) / (n[i + s] - n[i]);
+
+            n[i] += s;
+        }
+    }
+
+    q[5] = n[1];
+    q[6] = n[2];
+    q[7] = n[3];
+}
+
+static void
+start_estimator (UfoStreamMedianTaskPrivate *priv)
+{
+    gint pixel;
+
+    if (priv->estimator == ESTIMATOR_HISTOGRAM) {
+        priv->counts = g_malloc (priv->n_pixels * priv->n_bins * sizeof (guint16));
+        priv->starts = g_malloc (priv->n_pixels * sizeof (gfloat));
+        priv->widths = g_malloc (priv->n_pixels * sizeof (gfloat));
+    }
+    else {
+        priv->markers = g_malloc (priv->n_pixels * 8 * sizeof (gfloat));
+    }
+
+#pragma omp parallel for
+    for (pixel = 0; pixel < (gint) priv->n_pixels; pixel++) {
+        gfloat *sorted = priv->values + (gsize) pixel * priv->exact_frames;
+
+        sort_values (sorted, priv->exact_frames);
+
+        if (priv->estimator == ESTIMATOR_HISTOGRAM) {
+            histogram_init (priv, pixel, sorted);
+
+            for (guint i = 0; i < priv->exact_frames; i++)
+                histogram_add (priv, pixel, sorted[i]);
+        }
+        else {
+            p2_init (priv, pixel, sorted);
+        }
+    }
+
+    g_free (priv->values);
+    priv->values = NULL;
+}
+
+static gboolean
+ufo_stream_median_task_process (UfoTask *task,
+                                UfoBuffer **inputs,
+                                UfoBuffer *output,
+                                UfoRequisition *requisition)
+{
+    UfoStreamMedianTaskPrivate *priv;
+    gfloat *in_array;
+    gfloat desired[5];
+    gint pixel;
+
+    priv = UFO_STREAM_MEDIAN_TASK_GET_PRIVATE (UFO_STREAM_MEDIAN_TASK (task));
+    in_array = ufo_buffer_get_host_array (inputs[0], NULL);
+
+    if (priv->counter < priv->exact_frames) {
+#pragma omp parallel for
+        for (pixel = 0; pixel < (gint) priv->n_pixels; pixel++)
+            priv->values[(gsize) pixel * priv->exact_frames + priv->counter] = in_array[pixel];
+
+        priv->counter++;
+        return TRUE;
+    }
+
+    if (priv->values != NULL)
+        start_estimator (priv);
+
+    if (priv->estimator == ESTIMATOR_HISTOGRAM) {
+#pragma omp parallel for
+        for (pixel = 0; pixel < (gint) priv->n_pixels; pixel++)
+            histogram_add (priv, pixel, in_array[pixel]);
+    }
+    else {
+        const gfloat p = priv->percentile / 100.0f;
+
+        /* Desired marker positions depend only on the number of values */
+        desired[0] = 0.0f;
+        desired[1] = priv->counter * p / 2;
+        desired[2] = priv->counter * p;
+        desired[3] = priv->counter * (1.0f + p) / 2;
+        desired[4] = priv->counter;
+
+#pragma omp parallel for
+        for (pixel = 0; pixel < (gint) priv->n_pixels; pixel++)
+            p2_add (priv, pixel, in_array[pixel], desired);
+    }
+
+    priv->counter++;
+    return TRUE;
+}
+
+static gboolean
+ufo_stream_median_task_generate (UfoTask *task,
+                                 UfoBuffer *output,
+                                 UfoRequisition *requisition)
+{
+    UfoStreamMedianTaskPrivate *priv;
+    gfloat *out_array;
+    gint pixel;
+
+    priv = UFO_STREAM_MEDIAN_TASK_GET_PRIVATE (UFO_STREAM_MEDIAN_TASK (task));
+
+    if (priv->n_generate == 0 || priv->counter == 0)
+        return FALSE;
+
+    out_array = ufo_buffer_get_host_array (output, NULL);
+
+    if (priv->result == NULL) {
+        priv->result = g_malloc (priv->n_pixels * sizeof (gfloat));
+
+#pragma omp parallel for
+        for (pixel = 0; pixel < (gint) priv->n_pixels; pixel++) {
+            if (priv->values != NULL) {
+                gfloat *sorted = priv->values + (gsize) pixel * priv->exact_frames;
+
+                sort_values (sorted, priv->counter);
+                priv->result[pixel] = sorted[get_rank (priv->percentile, priv->counter)];
+            }
+            else if (priv->estimator == ESTIMATOR_HISTOGRAM) {
+                priv->result[pixel] = histogram_get (priv, pixel);
+            }
+            else {
+                priv->result[pixel] = priv->markers[(gsize) pixel * 8 + 2];
+            }
+        }
+    }
+
+    memcpy (out_array, priv->result, priv->n_pixels * sizeof (gfloat));
+    priv->n_generate--;
+
+    return TRUE;
+}
+
+static void
+ufo_task_interface_init (UfoTaskIface *iface)
+{
+    iface->setup = ufo_stream_median_task_setup;
+    iface->get_num_inputs = ufo_stream_median_task_get_num_inputs;
+    iface->get_num_dimensions = ufo_stream_median_task_get_num_dimensions;
+    iface->get_mode = ufo_stream_median_task_get_mode;
+    iface->get_requisition = ufo_stream_median_task_get_requisition;
+    iface->process = ufo_stream_median_task_process;
+    iface->generate = ufo_stream_median_task_generate;
+}
+
+static void
+ufo_stream_median_task_finalize (GObject *object)
+{
+    UfoStreamMedianTaskPrivate *priv;
+
+    priv = UFO_STREAM_MEDIAN_TASK_GET_PRIVATE (object);
+
+    g_free (priv->values);
+    g_free (priv->counts);
+    g_free (priv->starts);
+    g_free (priv->widths);
+    g_free (priv->markers);
+    g_free (priv->result);
+
+    G_OBJECT_CLASS (ufo_stream_median_task_parent_class)->finalize (object);
+}
+
+static void
+ufo_stream_median_task_set_property (GObject *object,
+                                     guint property_id,
+                                     const GValue *value,
+                                     GParamSpec *pspec)
+{
+    UfoStreamMedianTaskPrivate *priv = UFO_STREAM_MEDIAN_TASK_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_NUM_GENERATE:
+            priv->n_generate = g_value_get_uint (value);
+            break;
+        case PROP_PERCENTILE:
+            priv->percentile = g_value_get_float (value);
+            break;
+        case PROP_EXACT_FRAMES:
+            priv->exact_frames = g_value_get_uint (value);
+            break;
+        case PROP_ESTIMATOR:
+            priv->estimator = g_value_get_enum (value);
+            break;
+        case PROP_NUM_BINS:
+            priv->n_bins = g_value_get_uint (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_stream_median_task_get_property (GObject *object,
+                                     guint property_id,
+                                     GValue *value,
+                                     GParamSpec *pspec)
+{
+    UfoStreamMedianTaskPrivate *priv = UFO_STREAM_MEDIAN_TASK_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_NUM_GENERATE:
+            g_value_set_uint (value, priv->n_generate);
+            break;
+        case PROP_PERCENTILE:
+            g_value_set_float (value, priv->percentile);
+            break;
+        case PROP_EXACT_FRAMES:
+            g_value_set_uint (value, priv->exact_frames);
+            break;
+        case PROP_ESTIMATOR:
+            g_value_set_enum (value, priv->estimator);
+            break;
+        case PROP_NUM_BINS:
+            g_value_set_uint (value, priv->n_bins);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_stream_median_task_class_init (UfoStreamMedianTaskClass *klass)
+{
+    GObjectClass *oclass;
+
+    oclass = G_OBJECT_CLASS (klass);
+
+    oclass->finalize = ufo_stream_median_task_finalize;
+    oclass->set_property = ufo_stream_median_task_set_property;
+    oclass->get_property = ufo_stream_median_task_get_property;
+
+    properties[PROP_NUM_GENERATE] =
+        g_param_spec_uint ("number",
+            "Number of images to generate",
+            "Number of images to generate",
+            1, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
+    properties[PROP_PERCENTILE] =
+        g_param_spec_float ("percentile",
+            "Percentile in percent, 50 is the median",
+            "Percentile in percent, 50 is the median",
+            0.0f, 100.0f, 50.0f,
+            G_PARAM_READWRITE);
+
+    properties[PROP_EXACT_FRAMES] =
+        g_param_spec_uint ("exact-frames",
+            "Number of frames for which the result is exact",
+            "Number of frames for which the result is exact, more frames are estimated",
+            1, G_MAXUINT, 32,
+            G_PARAM_READWRITE);
+
+    properties[PROP_ESTIMATOR] =
+        g_param_spec_enum ("estimator",
+            "Estimator used for more than exact-frames frames (\"histogram\", \"p2\")",
+            "Estimator used for more than exact-frames frames (\"histogram\", \"p2\")",
+            g_enum_register_static ("ufo_stream_median_estimator", estimator_values),
+            ESTIMATOR_HISTOGRAM,
+            G_PARAM_READWRITE);
+
+    properties[PROP_NUM_BINS] =
+        g_param_spec_uint ("bins",
+            "Number of histogram bins per pixel",
+            "Number of histogram bins per pixel, the error is at most the range of "
+            "the values divided by this number",
+            2, G_MAXUINT16, 64,
+            G_PARAM_READWRITE);
+
+    for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
+        g_object_class_install_property (oclass, i, properties[i]);
+
+    g_type_class_add_private (G_OBJECT_CLASS (klass), sizeof(UfoStreamMedianTaskPrivate));
+}
+
+static void
+ufo_stream_median_task_init(UfoStreamMedianTask *self)
+{
+    self->priv = UFO_STREAM_MEDIAN_TASK_GET_PRIVATE(self);
+    self->priv->n_pixels = 0;
+    self->priv->counter = 0;
+    self->priv->n_generate = 1;
+    self->priv->percentile = 50.0f;
+    self->priv->exact_frames = 32;
+    self->priv->estimator = ESTIMATOR_HISTOGRAM;
+    self->priv->n_bins = 64;
+    self->priv->values = NULL;
+    self->priv->counts = NULL;
+    self->priv->starts = NULL;
+    self->priv->widths = NULL;
+    self->priv->markers = NULL;
+    self->priv->result = NULL;
+}
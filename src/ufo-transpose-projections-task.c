@@ -17,24 +17,54 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #ifdef __APPLE__
 #include <OpenCL/cl.h>
 #else
 #include <CL/cl.h>
 #endif
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 #include "ufo-transpose-projections-task.h"
 
+/* Projections staged before they are scattered to the sinograms */
+#define MAX_STAGE_SIZE      32
+#define MAX_STAGE_MEMORY    (256 << 20)
 
+/*
+ * If all sinograms do not fit into the memory limit, projections are
+ * transposed in chunks of as many projections as fit. Each chunk is written
+ * to a scratch file with one large block per sinogram, so that the file holds
+ * the sinograms one after another and each one is read back at once.
+ */
 struct _UfoTransposeProjectionsTaskPrivate {
     guint n_projections;
+    /* all sinograms or, out-of-core, the sinograms of the current chunk */
     gfloat *sinograms;
     gsize projection;
     gsize sino_offset;
     guint current_sino;
     guint n_sinos;
     guint sino_width;
+    guint memory_limit;
+    gchar *scratch_dir;
+    /* projections held in memory and the first one of the current chunk */
+    guint chunk_size;
+    guint chunk_start;
+    gint fd;
+    /* consecutive projections copied before they are transposed at once */
+    gfloat *stage;
+    guint stage_size;
+    guint stage_fill;
+    gsize stage_start;
+    guint group_size;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -48,6 +78,9 @@ G_DEFINE_TYPE_WITH_CODE (UfoTransposeProjectionsTask, ufo_transpose_projections_
 enum {
     PROP_0,
     PROP_NUM_PROJECTIONS,
+    PROP_MEMORY_LIMIT,
+    PROP_SCRATCH_DIR,
+    PROP_GROUP_SIZE,
     N_PROPERTIES
 };
 
@@ -59,6 +92,157 @@ ufo_transpose_projections_task_new (void)
     return UFO_NODE (g_object_new (UFO_TYPE_TRANSPOSE_PROJECTIONS_TASK, NULL));
 }
 
+static gsize
+get_memory_limit (UfoTransposeProjectionsTaskPrivate *priv)
+{
+    if (priv->memory_limit > 0)
+        return (gsize) priv->memory_limit << 20;
+
+    /* Leave half of the physical memory to the rest of the pipeline */
+    return (gsize) sysconf (_SC_PHYS_PAGES) * (gsize) sysconf (_SC_PAGESIZE) / 2;
+}
+
+static void
+open_scratch_file (UfoTransposeProjectionsTaskPrivate *priv, gsize size)
+{
+    gchar *filename;
+
+    filename = g_build_filename (priv->scratch_dir != NULL ? priv->scratch_dir : g_get_tmp_dir (),
+                                 "ufo-transpose-XXXXXX", NULL);
+    priv->fd = g_mkstemp (filename);
+
+    if (priv->fd < 0)
+        g_error ("Could not create scratch file `%s': %s", filename, strerror (errno));
+
+    /* The space is given back as soon as the file is closed */
+    g_unlink (filename);
+
+    /* Sinograms of missing projections read back as zeros */
+    if (ftruncate (priv->fd, size) < 0)
+        g_error ("Could not resize scratch file to %" G_GSIZE_FORMAT " bytes: %s", size, strerror (errno));
+
+    g_free (filename);
+}
+
+static void
+write_block (gint fd, const gfloat *data, gsize size, goffset offset)
+{
+    const gchar *bytes = (const gchar *) data;
+
+    while (size > 0) {
+        gssize result = pwrite (fd, bytes, size, offset);
+
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+
+            g_error ("Could not write to scratch file: %s", strerror (errno));
+        }
+
+        bytes += result;
+        size -= (gsize) result;
+        offset += result;
+    }
+}
+
+static void
+read_block (gint fd, gfloat *data, gsize size, goffset offset)
+{
+    gchar *bytes = (gchar *) data;
+
+    while (size > 0) {
+        gssize result = pread (fd, bytes, size, offset);
+
+        if (result <= 0) {
+            if (result < 0 && errno == EINTR)
+                continue;
+
+            g_error ("Could not read from scratch file: %s", result < 0 ? strerror (errno) : "unexpected end");
+        }
+
+        bytes += result;
+        size -= (gsize) result;
+        offset += result;
+    }
+}
+
+static inline void
+copy_row (gfloat *dst, const gfloat *src, gsize n)
+{
+#ifdef __SSE__
+    /* Sinograms are not read again soon, do not pollute the cache with them */
+    if (((guintptr) dst & 15) == 0) {
+        gsize i;
+
+        for (i = 0; i + 4 <= n; i += 4)
+            _mm_stream_ps (dst + i, _mm_loadu_ps (src + i));
+
+        memcpy (dst + i, src + i, sizeof (gfloat) * (n - i));
+        return;
+    }
+#endif
+    memcpy (dst, src, sizeof (gfloat) * n);
+}
+
+/*
+ * Scatter the rows of @n_rows consecutive projections, the first one being
+ * @first, to the sinograms. Each thread fills the @n_rows adjacent rows of one
+ * sinogram at a time, so that writes are sequential instead of touching a new
+ * page for every row.
+ */
+static void
+transpose_rows (UfoTransposeProjectionsTaskPrivate *priv,
+                const gfloat *projections,
+                guint n_rows,
+                gsize first)
+{
+    const gsize width = priv->sino_width;
+    const gsize sino_mem_offset = width * priv->chunk_size;
+    gfloat *sinograms = priv->sinograms + (first - priv->chunk_start) * width;
+    guint i;
+
+#pragma omp parallel
+    {
+#pragma omp for
+        for (i = 0; i < priv->n_sinos; i++) {
+            for (guint k = 0; k < n_rows; k++) {
+                copy_row (sinograms + i * sino_mem_offset + k * width,
+                          projections + ((gsize) k * priv->n_sinos + i) * width,
+                          width);
+            }
+        }
+
+#ifdef __SSE__
+        /* Streaming stores of this thread must be visible to others */
+        _mm_sfence ();
+#endif
+    }
+}
+
+static void
+flush_stage (UfoTransposeProjectionsTaskPrivate *priv)
+{
+    if (priv->stage_fill > 0) {
+        transpose_rows (priv, priv->stage, priv->stage_fill, priv->stage_start);
+        priv->stage_fill = 0;
+    }
+}
+
+static void
+write_chunk (UfoTransposeProjectionsTaskPrivate *priv, guint n_rows)
+{
+    const gsize row_size = sizeof (gfloat) * priv->sino_width;
+
+    for (guint i = 0; i < priv->n_sinos; i++) {
+        write_block (priv->fd,
+                     priv->sinograms + (gsize) i * priv->chunk_size * priv->sino_width,
+                     n_rows * row_size,
+                     ((goffset) i * priv->n_projections + priv->chunk_start) * row_size);
+    }
+
+    priv->chunk_start += n_rows;
+}
+
 static gboolean
 ufo_transpose_projections_task_process (UfoTask *task,
                                  UfoBuffer **inputs,
@@ -66,31 +250,39 @@ ufo_transpose_projections_task_process (UfoTask *task,
                                  UfoRequisition *requisition)
 {
     UfoTransposeProjectionsTaskPrivate *priv;
-    gsize sino_index;
-    gsize row_mem_offset;
-    gsize sino_mem_offset;
+    gsize projection_size;
     gfloat *host_array;
-    guint i;
 
     priv = UFO_TRANSPOSE_PROJECTIONS_TASK_GET_PRIVATE (task);
 
     if (priv->projection > priv->n_projections)
         return FALSE;
 
-    sino_index = (priv->projection - 1) * priv->sino_width;
     host_array = ufo_buffer_get_host_array (inputs[0], NULL);
-    row_mem_offset = priv->sino_width;
-    sino_mem_offset = row_mem_offset * priv->n_projections;
 
-#pragma omp parallel
-    {
-#pragma omp for
-        for (i = 0; i < priv->n_sinos; i++) {
-            memcpy (priv->sinograms + sino_index + i * sino_mem_offset,
-                    host_array + i * row_mem_offset,
-                    sizeof (float) * priv->sino_width);
-        }
+    if (priv->stage_size > 1) {
+        /* The input is given back after processing, hence keep a copy */
+        projection_size = (gsize) priv->sino_width * priv->n_sinos;
+
+        if (priv->stage_fill == 0)
+            priv->stage_start = priv->projection - 1;
+
+        memcpy (priv->stage + priv->stage_fill * projection_size, host_array,
+                sizeof (gfloat) * projection_size);
+        priv->stage_fill++;
+
+        if (priv->stage_fill == priv->stage_size ||
+            priv->projection - priv->chunk_start == priv->chunk_size ||
+            priv->projection == priv->n_projections)
+            flush_stage (priv);
     }
+    else {
+        transpose_rows (priv, host_array, 1, priv->projection - 1);
+    }
+
+    if (priv->fd >= 0 && (priv->projection - priv->chunk_start == priv->chunk_size ||
+                          priv->projection == priv->n_projections))
+        write_chunk (priv, priv->projection - priv->chunk_start);
 
     priv->projection++;
     return TRUE;
@@ -103,16 +295,37 @@ ufo_transpose_projections_task_generate (UfoTask *task,
 {
     UfoTransposeProjectionsTaskPrivate *priv;
     gsize index;
+    guint n_sinos;
+    gfloat *host_array;
 
     priv = UFO_TRANSPOSE_PROJECTIONS_TASK_GET_PRIVATE (task);
 
-    if (priv->current_sino == priv->n_sinos)
+    if (priv->current_sino >= priv->n_sinos)
         return FALSE;
 
+    /* The stream may have ended before all projections arrived */
+    flush_stage (priv);
+
     index = priv->current_sino * priv->sino_offset;
-    ufo_buffer_set_host_array (output, priv->sinograms + index, FALSE);
+    n_sinos = MIN (priv->group_size, priv->n_sinos - priv->current_sino);
+
+    if (priv->fd >= 0) {
+        if (priv->projection - 1 > priv->chunk_start)
+            write_chunk (priv, priv->projection - 1 - priv->chunk_start);
+
+        /* Zero the sinograms missing in the last group */
+        host_array = ufo_buffer_get_host_array (output, NULL);
+        read_block (priv->fd, host_array, sizeof (gfloat) * priv->sino_offset * n_sinos,
+                    (goffset) index * sizeof (gfloat));
+        memset (host_array + priv->sino_offset * n_sinos, 0,
+                sizeof (gfloat) * priv->sino_offset * (priv->group_size - n_sinos));
+    }
+    else {
+        /* The memory is padded with zeros for the last group */
+        ufo_buffer_set_host_array (output, priv->sinograms + index, FALSE);
+    }
 
-    priv->current_sino++;
+    priv->current_sino += n_sinos;
     return TRUE;
 }
 
@@ -133,15 +346,41 @@ ufo_transpose_projections_task_get_requisition (UfoTask *task,
 
     priv = UFO_TRANSPOSE_PROJECTIONS_TASK_GET_PRIVATE (task);
     ufo_buffer_get_requisition (inputs[0], &in_req);
-    requisition->n_dims = 2;
+    requisition->n_dims = priv->group_size > 1 ? 3 : 2;
     requisition->dims[0] = in_req.dims[0];
     requisition->dims[1] = priv->n_projections;
+    requisition->dims[2] = priv->group_size;
 
     if (priv->sinograms == NULL) {
+        gsize projection_size, total_size, limit, padding = 0;
+
         priv->sino_width = (guint) in_req.dims[0];
         priv->n_sinos = (guint) in_req.dims[1];
-        priv->sinograms = g_malloc0 (sizeof (gfloat) * priv->n_projections * priv->sino_width * priv->n_sinos);
+        projection_size = sizeof (gfloat) * priv->sino_width * priv->n_sinos;
+        total_size = projection_size * priv->n_projections;
+        limit = get_memory_limit (priv);
+
+        if (total_size <= limit) {
+            priv->chunk_size = priv->n_projections;
+            padding = (priv->group_size - priv->n_sinos % priv->group_size) % priv->group_size;
+        }
+        else {
+            priv->chunk_size = MAX (limit / projection_size, 1);
+            open_scratch_file (priv, total_size);
+            g_debug ("Transposing %u projections out-of-core in chunks of %u",
+                     priv->n_projections, priv->chunk_size);
+        }
+
+        priv->stage_size = CLAMP (MAX_STAGE_MEMORY / projection_size, 1, MIN (MAX_STAGE_SIZE, priv->chunk_size));
+        priv->stage_fill = 0;
+
+        if (priv->stage_size > 1)
+            priv->stage = g_malloc (projection_size * priv->stage_size);
+
         priv->sino_offset = priv->sino_width * priv->n_projections;
+        priv->sinograms = g_malloc0 (projection_size * priv->chunk_size +
+                                     sizeof (gfloat) * priv->sino_offset * padding);
+        priv->chunk_start = 0;
         priv->current_sino = 0;
         priv->projection = 1;
     }
@@ -187,6 +426,18 @@ ufo_transpose_projections_task_finalize (GObject *object)
         g_free (priv->sinograms);
         priv->sinograms = NULL;
     }
+
+    if (priv->fd >= 0) {
+        close (priv->fd);
+        priv->fd = -1;
+    }
+
+    g_free (priv->stage);
+    priv->stage = NULL;
+    g_free (priv->scratch_dir);
+    priv->scratch_dir = NULL;
+
+    G_OBJECT_CLASS (ufo_transpose_projections_task_parent_class)->finalize (object);
 }
 
 static void
@@ -213,6 +464,16 @@ ufo_transpose_projections_task_set_property (GObject *object,
         case PROP_NUM_PROJECTIONS:
             priv->n_projections = g_value_get_uint (value);
             break;
+        case PROP_MEMORY_LIMIT:
+            priv->memory_limit = g_value_get_uint (value);
+            break;
+        case PROP_SCRATCH_DIR:
+            g_free (priv->scratch_dir);
+            priv->scratch_dir = g_value_dup_string (value);
+            break;
+        case PROP_GROUP_SIZE:
+            priv->group_size = g_value_get_uint (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -231,6 +492,15 @@ ufo_transpose_projections_task_get_property (GObject *object,
         case PROP_NUM_PROJECTIONS:
             g_value_set_uint (value, priv->n_projections);
             break;
+        case PROP_MEMORY_LIMIT:
+            g_value_set_uint (value, priv->memory_limit);
+            break;
+        case PROP_SCRATCH_DIR:
+            g_value_set_string (value, priv->scratch_dir);
+            break;
+        case PROP_GROUP_SIZE:
+            g_value_set_uint (value, priv->group_size);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -257,6 +527,28 @@ ufo_transpose_projections_task_class_init (UfoTransposeProjectionsTaskClass *kla
             1, G_MAXUINT, 1,
             G_PARAM_READWRITE);
 
+    properties[PROP_MEMORY_LIMIT] =
+        g_param_spec_uint ("memory-limit",
+            "Memory for sinograms in MiB",
+            "Memory for sinograms in MiB, if exceeded they are transposed "
+            "through a scratch file (0 means half of the physical memory)",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_SCRATCH_DIR] =
+        g_param_spec_string ("scratch-directory",
+            "Directory of the scratch file",
+            "Directory of the scratch file, the system temporary directory if not set",
+            NULL,
+            G_PARAM_READWRITE);
+
+    properties[PROP_GROUP_SIZE] =
+        g_param_spec_uint ("group-size",
+            "Number of adjacent sinograms in one output",
+            "Number of adjacent sinograms in one output, more than one are emitted as 3D buffer",
+            1, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -272,4 +564,13 @@ ufo_transpose_projections_task_init (UfoTransposeProjectionsTask *self)
     self->priv = priv = UFO_TRANSPOSE_PROJECTIONS_TASK_GET_PRIVATE (self);
     priv->sinograms = NULL;
     priv->n_projections = 1;
+    priv->memory_limit = 0;
+    priv->scratch_dir = NULL;
+    priv->chunk_size = 1;
+    priv->chunk_start = 0;
+    priv->fd = -1;
+    priv->stage = NULL;
+    priv->stage_size = 1;
+    priv->stage_fill = 0;
+    priv->group_size = 1;
 }
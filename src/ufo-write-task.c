@@ -40,6 +40,14 @@
 #include "writers/ufo-hdf5-writer.h"
 #endif
 
+typedef struct {
+    guint8         *data;
+    gsize           size;
+    UfoRequisition  requisition;
+    gchar          *filename;
+    gboolean        stop;
+} WriteItem;
+
 struct _UfoWriteTaskPrivate {
     gchar *filename;
     guint counter;
@@ -58,6 +66,8 @@ struct _UfoWriteTaskPrivate {
 
     UfoWriter     *writer;
     UfoRawWriter  *raw_writer;
+    gboolean       raw_direct;
+    guint          raw_preallocate;
 
 #ifdef HAVE_TIFF
     UfoTiffWriter *tiff_writer;
@@ -68,8 +78,19 @@ struct _UfoWriteTaskPrivate {
     gint           jpeg_quality;
 #endif
 
+    guint          queue_size;
+    guint          n_threads;
+    GAsyncQueue   *free_items;
+    GAsyncQueue   *pending_items;
+    GList         *threads;
+
 #ifdef WITH_HDF5
     UfoHdf5Writer *hdf5_writer;
+    guint          hdf5_chunk_shape[3];
+    UfoHdf5Compression hdf5_compression;
+    guint          hdf5_compression_level;
+    gboolean       hdf5_shuffle;
+    guint          hdf5_grow;
 #endif
 };
 
@@ -79,6 +100,16 @@ G_DEFINE_TYPE_WITH_CODE (UfoWriteTask, ufo_write_task, UFO_TYPE_TASK_NODE,
                          G_IMPLEMENT_INTERFACE (UFO_TYPE_TASK,
                                                 ufo_task_interface_init))
 
+#ifdef WITH_HDF5
+static GEnumValue compression_values[] = {
+    { UFO_HDF5_COMPRESSION_NONE,    "UFO_HDF5_COMPRESSION_NONE",    "none" },
+    { UFO_HDF5_COMPRESSION_DEFLATE, "UFO_HDF5_COMPRESSION_DEFLATE", "deflate" },
+    { UFO_HDF5_COMPRESSION_LZ4,     "UFO_HDF5_COMPRESSION_LZ4",     "lz4" },
+    { UFO_HDF5_COMPRESSION_BLOSC,   "UFO_HDF5_COMPRESSION_BLOSC",   "blosc" },
+    { 0, NULL, NULL}
+};
+#endif
+
 #define UFO_WRITE_TASK_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_WRITE_TASK, UfoWriteTaskPrivate))
 
 enum {
@@ -90,8 +121,21 @@ enum {
     PROP_BITS,
     PROP_MINIMUM,
     PROP_MAXIMUM,
+    PROP_QUEUE_SIZE,
+    PROP_NUM_THREADS,
+    PROP_RAW_DIRECT,
+    PROP_RAW_PREALLOCATE,
 #ifdef HAVE_JPEG
     PROP_JPEG_QUALITY,
+#endif
+#ifdef WITH_HDF5
+    PROP_HDF5_CHUNK_FRAMES,
+    PROP_HDF5_CHUNK_HEIGHT,
+    PROP_HDF5_CHUNK_WIDTH,
+    PROP_HDF5_COMPRESSION,
+    PROP_HDF5_COMPRESSION_LEVEL,
+    PROP_HDF5_SHUFFLE,
+    PROP_HDF5_GROW,
 #endif
     N_PROPERTIES
 };
@@ -140,6 +184,33 @@ can_be_written (const gchar *filename, GError **error)
     return TRUE;
 }
 
+/* Apply the writer specific properties, whatever the type of the writer is */
+static void
+configure_writer (UfoWriteTaskPrivate *priv, UfoWriter *writer)
+{
+    if (UFO_IS_RAW_WRITER (writer)) {
+        ufo_raw_writer_set_direct (UFO_RAW_WRITER (writer), priv->raw_direct);
+        ufo_raw_writer_set_preallocate (UFO_RAW_WRITER (writer), priv->raw_preallocate);
+    }
+#ifdef HAVE_JPEG
+    if (UFO_IS_JPEG_WRITER (writer))
+        ufo_jpeg_writer_set_quality (UFO_JPEG_WRITER (writer), priv->jpeg_quality);
+#endif
+#ifdef WITH_HDF5
+    if (UFO_IS_HDF5_WRITER (writer)) {
+        ufo_hdf5_writer_set_chunk_shape (UFO_HDF5_WRITER (writer),
+                                         priv->hdf5_chunk_shape[0],
+                                         priv->hdf5_chunk_shape[1],
+                                         priv->hdf5_chunk_shape[2]);
+        ufo_hdf5_writer_set_compression (UFO_HDF5_WRITER (writer),
+                                         priv->hdf5_compression,
+                                         priv->hdf5_compression_level,
+                                         priv->hdf5_shuffle);
+        ufo_hdf5_writer_set_grow (UFO_HDF5_WRITER (writer), priv->hdf5_grow);
+    }
+#endif
+}
+
 static void
 ufo_write_task_setup (UfoTask *task,
                       UfoResources *resources,
@@ -154,6 +225,7 @@ ufo_write_task_setup (UfoTask *task,
     /* If no filename has been specified we write to stdout */
     if (priv->filename == NULL) {
         priv->writer = UFO_WRITER (priv->raw_writer);
+        configure_writer (priv, priv->writer);
         return;
     }
 
@@ -211,6 +283,8 @@ ufo_write_task_setup (UfoTask *task,
         return;
     }
 
+    configure_writer (priv, priv->writer);
+
     if (!g_file_test (dirname, G_FILE_TEST_EXISTS)) {
         g_debug ("write: `%s' does not exist. Attempt to create it.", dirname);
 
@@ -267,6 +341,148 @@ ufo_write_task_get_mode (UfoTask *task)
     return UFO_TASK_MODE_SINK | UFO_TASK_MODE_CPU;
 }
 
+typedef struct {
+    UfoWriteTaskPrivate *priv;
+    UfoWriter           *writer;
+    GThread             *thread;
+} WriteThread;
+
+static void
+free_item (WriteItem *item)
+{
+    g_free (item->data);
+    g_free (item->filename);
+    g_free (item);
+}
+
+static gpointer
+write_thread (WriteThread *self)
+{
+    UfoWriteTaskPrivate *priv;
+    UfoWriterImage image;
+    WriteItem *item;
+
+    priv = self->priv;
+    image.depth = priv->depth;
+    image.min = priv->minimum;
+    image.max = priv->maximum;
+
+    while ((item = g_async_queue_pop (priv->pending_items))->stop == FALSE) {
+        /* Only items that start a new file carry a file name */
+        if (item->filename != NULL) {
+            ufo_writer_open (self->writer, item->filename);
+            g_free (item->filename);
+            item->filename = NULL;
+        }
+
+        image.data = item->data;
+        image.requisition = &item->requisition;
+        ufo_writer_write (self->writer, &image);
+
+        if (!priv->multi_file)
+            ufo_writer_close (self->writer);
+
+        g_async_queue_push (priv->free_items, item);
+    }
+
+    free_item (item);
+    return NULL;
+}
+
+static void
+start_writers (UfoWriteTaskPrivate *priv)
+{
+    guint n_threads;
+
+    priv->free_items = g_async_queue_new_full ((GDestroyNotify) free_item);
+    priv->pending_items = g_async_queue_new_full ((GDestroyNotify) free_item);
+
+    for (guint i = 0; i < priv->queue_size; i++)
+        g_async_queue_push (priv->free_items, g_new0 (WriteItem, 1));
+
+    /* Frames of a single file must be written in order by one thread */
+    n_threads = priv->multi_file ? 1 : priv->n_threads;
+
+    for (guint i = 0; i < n_threads; i++) {
+        WriteThread *thread = g_new0 (WriteThread, 1);
+
+        thread->priv = priv;
+
+        if (i == 0) {
+            thread->writer = g_object_ref (priv->writer);
+        }
+        else {
+            thread->writer = UFO_WRITER (g_object_new (G_OBJECT_TYPE (priv->writer), NULL));
+            configure_writer (priv, thread->writer);
+        }
+
+        thread->thread = g_thread_new ("write", (GThreadFunc) write_thread, thread);
+        priv->threads = g_list_append (priv->threads, thread);
+    }
+}
+
+static void
+stop_writers (UfoWriteTaskPrivate *priv)
+{
+    if (priv->threads == NULL)
+        return;
+
+    /* Everything queued before the stop items is written out first */
+    for (GList *it = g_list_first (priv->threads); it != NULL; it = g_list_next (it)) {
+        WriteItem *item = g_new0 (WriteItem, 1);
+
+        item->stop = TRUE;
+        g_async_queue_push (priv->pending_items, item);
+    }
+
+    for (GList *it = g_list_first (priv->threads); it != NULL; it = g_list_next (it)) {
+        WriteThread *thread = (WriteThread *) it->data;
+
+        g_thread_join (thread->thread);
+        g_object_unref (thread->writer);
+        g_free (thread);
+    }
+
+    g_list_free (priv->threads);
+    priv->threads = NULL;
+
+    g_async_queue_unref (priv->free_items);
+    g_async_queue_unref (priv->pending_items);
+    priv->free_items = NULL;
+    priv->pending_items = NULL;
+}
+
+/*
+ * Sinks are not told about the end of the stream. The scheduler runs each task
+ * in its own thread, which ends after the last input has been processed, so
+ * the writers are drained and joined when the thread that started them exits.
+ */
+static GPrivate stream_end = G_PRIVATE_INIT ((GDestroyNotify) stop_writers);
+
+static void
+queue_frame (UfoWriteTaskPrivate *priv,
+             guint8 *data,
+             gsize size,
+             UfoRequisition *requisition,
+             gchar *filename)
+{
+    WriteItem *item;
+
+    /* Blocks only if all items are waiting to be written */
+    item = g_async_queue_pop (priv->free_items);
+
+    if (item->size < size) {
+        g_free (item->data);
+        item->data = g_malloc (size);
+        item->size = size;
+    }
+
+    memcpy (item->data, data, size);
+    item->requisition = *requisition;
+    item->filename = filename;
+    g_async_queue_push (priv->pending_items, item);
+}
+
 static gboolean
 ufo_write_task_process (UfoTask *task,
                         UfoBuffer **inputs,
@@ -292,11 +508,19 @@ ufo_write_task_process (UfoTask *task,
     image.min = priv->minimum;
     image.max = priv->maximum;
 
+    if (priv->queue_size > 0 && priv->threads == NULL) {
+        start_writers (priv);
+        g_private_set (&stream_end, priv);
+    }
+
     for (guint i = 0; i < num_frames; i++) {
+        gchar *filename = NULL;
+
 retry:
         if (!priv->multi_file || !priv->opened) {
             GError *error = NULL;
-            gchar *filename = get_current_filename (priv);
+
+            filename = get_current_filename (priv);
 
             if (!can_be_written (filename, &error)) {
                 g_warning ("%s", error->message);
@@ -306,9 +530,20 @@ retry:
                 goto retry;
             }
 
+            priv->opened = TRUE;
+        }
+
+        if (priv->threads != NULL) {
+            /* The writer thread takes ownership of filename */
+            queue_frame (priv, data + i * offset, offset, &in_req, filename);
+            priv->opened = priv->multi_file;
+            priv->counter += priv->counter_step;
+            continue;
+        }
+
+        if (filename != NULL) {
             ufo_writer_open (priv->writer, filename);
             g_free (filename);
-            priv->opened = TRUE;
         }
 
         image.data = data + i * offset;
@@ -372,10 +607,44 @@ ufo_write_task_set_property (GObject *object,
         case PROP_MINIMUM:
             priv->minimum = g_value_get_float (value);
             break;
+        case PROP_QUEUE_SIZE:
+            priv->queue_size = g_value_get_uint (value);
+            break;
+        case PROP_NUM_THREADS:
+            priv->n_threads = g_value_get_uint (value);
+            break;
+        case PROP_RAW_DIRECT:
+            priv->raw_direct = g_value_get_boolean (value);
+            break;
+        case PROP_RAW_PREALLOCATE:
+            priv->raw_preallocate = g_value_get_uint (value);
+            break;
 #ifdef HAVE_JPEG
         case PROP_JPEG_QUALITY:
             priv->jpeg_quality = g_value_get_uint (value);
-            ufo_jpeg_writer_set_quality (priv->jpeg_writer, priv->jpeg_quality);
+            break;
+#endif
+#ifdef WITH_HDF5
+        case PROP_HDF5_CHUNK_FRAMES:
+            priv->hdf5_chunk_shape[0] = g_value_get_uint (value);
+            break;
+        case PROP_HDF5_CHUNK_HEIGHT:
+            priv->hdf5_chunk_shape[1] = g_value_get_uint (value);
+            break;
+        case PROP_HDF5_CHUNK_WIDTH:
+            priv->hdf5_chunk_shape[2] = g_value_get_uint (value);
+            break;
+        case PROP_HDF5_COMPRESSION:
+            priv->hdf5_compression = g_value_get_enum (value);
+            break;
+        case PROP_HDF5_COMPRESSION_LEVEL:
+            priv->hdf5_compression_level = g_value_get_uint (value);
+            break;
+        case PROP_HDF5_SHUFFLE:
+            priv->hdf5_shuffle = g_value_get_boolean (value);
+            break;
+        case PROP_HDF5_GROW:
+            priv->hdf5_grow = g_value_get_uint (value);
             break;
 #endif
         default:
@@ -421,10 +690,45 @@ ufo_write_task_get_property (GObject *object,
         case PROP_MINIMUM:
             g_value_set_float (value, priv->minimum);
             break;
+        case PROP_QUEUE_SIZE:
+            g_value_set_uint (value, priv->queue_size);
+            break;
+        case PROP_NUM_THREADS:
+            g_value_set_uint (value, priv->n_threads);
+            break;
+        case PROP_RAW_DIRECT:
+            g_value_set_boolean (value, priv->raw_direct);
+            break;
+        case PROP_RAW_PREALLOCATE:
+            g_value_set_uint (value, priv->raw_preallocate);
+            break;
 #ifdef HAVE_JPEG
         case PROP_JPEG_QUALITY:
             g_value_set_uint (value, priv->jpeg_quality);
             break;
+#endif
+#ifdef WITH_HDF5
+        case PROP_HDF5_CHUNK_FRAMES:
+            g_value_set_uint (value, priv->hdf5_chunk_shape[0]);
+            break;
+        case PROP_HDF5_CHUNK_HEIGHT:
+            g_value_set_uint (value, priv->hdf5_chunk_shape[1]);
+            break;
+        case PROP_HDF5_CHUNK_WIDTH:
+            g_value_set_uint (value, priv->hdf5_chunk_shape[2]);
+            break;
+        case PROP_HDF5_COMPRESSION:
+            g_value_set_enum (value, priv->hdf5_compression);
+            break;
+        case PROP_HDF5_COMPRESSION_LEVEL:
+            g_value_set_uint (value, priv->hdf5_compression_level);
+            break;
+        case PROP_HDF5_SHUFFLE:
+            g_value_set_boolean (value, priv->hdf5_shuffle);
+            break;
+        case PROP_HDF5_GROW:
+            g_value_set_uint (value, priv->hdf5_grow);
+            break;
 #endif
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -439,6 +743,12 @@ ufo_write_task_dispose (GObject *object)
 
     priv = UFO_WRITE_TASK_GET_PRIVATE (object);
 
+    /* Normally done at the end of the stream already */
+    stop_writers (priv);
+
+    if (g_private_get (&stream_end) == priv)
+        g_private_set (&stream_end, NULL);
+
     g_object_unref (priv->raw_writer);
 
 #ifdef HAVE_TIFF
@@ -542,6 +852,34 @@ ufo_write_task_class_init (UfoWriteTaskClass *klass)
             -G_MAXFLOAT, G_MAXFLOAT, -G_MAXFLOAT,
             G_PARAM_READWRITE);
 
+    properties[PROP_QUEUE_SIZE] =
+        g_param_spec_uint ("queue-size",
+            "Number of frames queued for background writing",
+            "Number of frames queued for background writing, 0 writes synchronously",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_NUM_THREADS] =
+        g_param_spec_uint ("num-threads",
+            "Number of background writer threads",
+            "Number of background writer threads, only used for one file per frame",
+            1, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
+    properties[PROP_RAW_DIRECT] =
+        g_param_spec_boolean ("raw-direct",
+            "Bypass the page cache when writing raw files",
+            "Bypass the page cache when writing raw files",
+            FALSE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_RAW_PREALLOCATE] =
+        g_param_spec_uint ("raw-preallocate",
+            "Number of frames to preallocate in raw files",
+            "Number of frames to preallocate in raw files",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
 #ifdef HAVE_JPEG
     properties[PROP_JPEG_QUALITY] =
         g_param_spec_uint ("jpeg-quality",
@@ -550,6 +888,51 @@ ufo_write_task_class_init (UfoWriteTaskClass *klass)
             0, 100, 95, G_PARAM_READWRITE);
 #endif
 
+#ifdef WITH_HDF5
+    properties[PROP_HDF5_CHUNK_FRAMES] =
+        g_param_spec_uint ("hdf5-chunk-frames",
+            "Number of frames in one HDF5 chunk",
+            "Number of frames in one HDF5 chunk",
+            1, G_MAXUINT, 1, G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_CHUNK_HEIGHT] =
+        g_param_spec_uint ("hdf5-chunk-height",
+            "Height of one HDF5 chunk",
+            "Height of one HDF5 chunk, 0 uses the full frame height",
+            0, G_MAXUINT, 0, G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_CHUNK_WIDTH] =
+        g_param_spec_uint ("hdf5-chunk-width",
+            "Width of one HDF5 chunk",
+            "Width of one HDF5 chunk, 0 uses the full frame width",
+            0, G_MAXUINT, 0, G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_COMPRESSION] =
+        g_param_spec_enum ("hdf5-compression",
+            "HDF5 compression filter",
+            "HDF5 compression filter (none, deflate, lz4, blosc)",
+            g_enum_register_static ("hdf5-compression", compression_values),
+            UFO_HDF5_COMPRESSION_NONE, G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_COMPRESSION_LEVEL] =
+        g_param_spec_uint ("hdf5-compression-level",
+            "HDF5 compression level",
+            "HDF5 compression level between 0 and 9",
+            0, 9, 4, G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_SHUFFLE] =
+        g_param_spec_boolean ("hdf5-shuffle",
+            "Shuffle bytes before compression",
+            "Shuffle bytes before compression",
+            FALSE, G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_GROW] =
+        g_param_spec_uint ("hdf5-grow",
+            "Number of frames the HDF5 dataset grows at once",
+            "Number of frames the HDF5 dataset grows at once",
+            1, G_MAXUINT, 64, G_PARAM_READWRITE);
+#endif
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -572,6 +955,13 @@ ufo_write_task_init(UfoWriteTask *self)
     self->priv->opened = FALSE;
     self->priv->filename = NULL;
     self->priv->raw_writer = ufo_raw_writer_new ();
+    self->priv->raw_direct = FALSE;
+    self->priv->raw_preallocate = 0;
+    self->priv->queue_size = 0;
+    self->priv->n_threads = 1;
+    self->priv->free_items = NULL;
+    self->priv->pending_items = NULL;
+    self->priv->threads = NULL;
 
 #ifdef HAVE_TIFF
     self->priv->tiff_writer = ufo_tiff_writer_new ();
@@ -584,5 +974,12 @@ ufo_write_task_init(UfoWriteTask *self)
 
 #ifdef WITH_HDF5
     self->priv->hdf5_writer = ufo_hdf5_writer_new ();
+    self->priv->hdf5_chunk_shape[0] = 1;
+    self->priv->hdf5_chunk_shape[1] = 0;
+    self->priv->hdf5_chunk_shape[2] = 0;
+    self->priv->hdf5_compression = UFO_HDF5_COMPRESSION_NONE;
+    self->priv->hdf5_compression_level = 4;
+    self->priv->hdf5_shuffle = FALSE;
+    self->priv->hdf5_grow = 64;
 #endif
 }
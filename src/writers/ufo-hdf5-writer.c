@@ -22,11 +22,24 @@
 #include "writers/ufo-hdf5-writer.h"
 
 
+/* Registered IDs of the dynamically loaded third-party filters */
+#define H5Z_FILTER_LZ4      32004
+#define H5Z_FILTER_BLOSC    32001
+
 struct _UfoHdf5WriterPrivate {
     gchar *dataset;
     hid_t file_id;
     hid_t dataset_id;
     guint current;
+
+    hsize_t extent[3];
+    hsize_t min_extent;
+
+    guint chunk_shape[3];
+    UfoHdf5Compression compression;
+    guint compression_level;
+    gboolean shuffle;
+    guint grow;
 };
 
 static void ufo_writer_interface_init (UfoWriterIface *iface);
@@ -43,6 +56,35 @@ ufo_hdf5_writer_new (void)
     return g_object_new (UFO_TYPE_HDF5_WRITER, NULL);
 }
 
+void
+ufo_hdf5_writer_set_chunk_shape (UfoHdf5Writer *writer,
+                                 guint frames,
+                                 guint height,
+                                 guint width)
+{
+    writer->priv->chunk_shape[0] = frames;
+    writer->priv->chunk_shape[1] = height;
+    writer->priv->chunk_shape[2] = width;
+}
+
+void
+ufo_hdf5_writer_set_compression (UfoHdf5Writer *writer,
+                                 UfoHdf5Compression compression,
+                                 guint level,
+                                 gboolean shuffle)
+{
+    writer->priv->compression = compression;
+    writer->priv->compression_level = level;
+    writer->priv->shuffle = shuffle;
+}
+
+void
+ufo_hdf5_writer_set_grow (UfoHdf5Writer *writer,
+                          guint frames)
+{
+    writer->priv->grow = MAX (frames, 1);
+}
+
 static gboolean
 ufo_hdf5_writer_can_open (UfoWriter *writer,
                           const gchar *filename)
@@ -76,6 +118,7 @@ ufo_hdf5_writer_open (UfoWriter *writer,
         priv->file_id = H5Fcreate (h5_filename, H5F_ACC_EXCL, H5P_DEFAULT, H5P_DEFAULT);
 
     g_strfreev (components);
+    priv->dataset_id = -1;
     priv->current = 0;
 }
 
@@ -85,8 +128,20 @@ ufo_hdf5_writer_close (UfoWriter *writer)
     UfoHdf5WriterPrivate *priv;
 
     priv = UFO_HDF5_WRITER_GET_PRIVATE (writer);
-    H5Dclose (priv->dataset_id);
+
+    if (priv->dataset_id >= 0) {
+        /* Cut off the frames that were allocated ahead but never written */
+        if (priv->extent[0] > MAX (priv->current, priv->min_extent)) {
+            priv->extent[0] = MAX (priv->current, priv->min_extent);
+            H5Dset_extent (priv->dataset_id, priv->extent);
+        }
+
+        H5Dclose (priv->dataset_id);
+        priv->dataset_id = -1;
+    }
+
     H5Fclose (priv->file_id);
+    priv->file_id = -1;
 }
 
 static hid_t
@@ -170,6 +225,65 @@ buffer_depth_to_hdf5_type (UfoBufferDepth depth)
     }
 }
 
+static void
+set_compression (UfoHdf5WriterPrivate *priv, hid_t dcpl)
+{
+    /* Blosc shuffles internally, doing it twice would undo the benefit */
+    if (priv->shuffle && priv->compression != UFO_HDF5_COMPRESSION_BLOSC)
+        H5Pset_shuffle (dcpl);
+
+    switch (priv->compression) {
+        case UFO_HDF5_COMPRESSION_DEFLATE:
+            H5Pset_deflate (dcpl, MIN (priv->compression_level, 9));
+            break;
+        case UFO_HDF5_COMPRESSION_LZ4:
+            if (H5Zfilter_avail (H5Z_FILTER_LZ4) > 0)
+                H5Pset_filter (dcpl, H5Z_FILTER_LZ4, H5Z_FLAG_OPTIONAL, 0, NULL);
+            else
+                g_warning ("hdf5: LZ4 filter plugin not found, writing uncompressed");
+            break;
+        case UFO_HDF5_COMPRESSION_BLOSC:
+            if (H5Zfilter_avail (H5Z_FILTER_BLOSC) > 0) {
+                /* The first four values are filled in by the filter itself */
+                const guint cd_values[7] = { 0, 0, 0, 0, MIN (priv->compression_level, 9), priv->shuffle ? 1 : 0, 0 };
+                H5Pset_filter (dcpl, H5Z_FILTER_BLOSC, H5Z_FLAG_OPTIONAL, 7, cd_values);
+            }
+            else
+                g_warning ("hdf5: Blosc filter plugin not found, writing uncompressed");
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+create_dataset (UfoHdf5WriterPrivate *priv, hid_t mem_type)
+{
+    hid_t group_id;
+    hid_t dataspace_id;
+    hid_t dcpl;
+    hsize_t chunk[3];
+    hsize_t max_dims[3] = { H5S_UNLIMITED, priv->extent[1], priv->extent[2] };
+
+    /* Zero means the whole extent, except for the unlimited dimension */
+    chunk[0] = priv->chunk_shape[0] > 0 ? priv->chunk_shape[0] : 1;
+
+    for (guint i = 1; i < 3; i++)
+        chunk[i] = priv->chunk_shape[i] > 0 ? MIN (priv->chunk_shape[i], priv->extent[i]) : priv->extent[i];
+
+    group_id = make_groups (priv->file_id, priv->dataset);
+    dataspace_id = H5Screate_simple (3, priv->extent, max_dims);
+    dcpl = H5Pcreate (H5P_DATASET_CREATE);
+    H5Pset_chunk (dcpl, 3, chunk);
+    set_compression (priv, dcpl);
+
+    priv->dataset_id = H5Dcreate (group_id, priv->dataset, mem_type, dataspace_id,
+                                  H5P_DEFAULT, dcpl, H5P_DEFAULT);
+
+    H5Pclose (dcpl);
+    H5Sclose (dataspace_id);
+}
+
 static void
 ufo_hdf5_writer_write (UfoWriter *writer,
                        UfoWriterImage *image)
@@ -183,33 +297,33 @@ ufo_hdf5_writer_write (UfoWriter *writer,
 
     hsize_t offset[3] = { priv->current, 0, 0 };
     hsize_t count[3] = { 1, image->requisition->dims[1], image->requisition->dims[0] };
-    hsize_t dims[3] = { priv->current + 1, image->requisition->dims[1], image->requisition->dims[0] };
     hsize_t src_dims[2] = { image->requisition->dims[0], image->requisition->dims[1] };
     mem_type = buffer_depth_to_hdf5_type (image->depth);
 
     if (priv->current == 0) {
+        priv->extent[1] = image->requisition->dims[1];
+        priv->extent[2] = image->requisition->dims[0];
+
         if (dataset_exists (priv->file_id, priv->dataset)) {
+            hid_t dataspace_id;
+
             priv->dataset_id = H5Dopen (priv->file_id, priv->dataset, H5P_DEFAULT);
+            dataspace_id = H5Dget_space (priv->dataset_id);
+            H5Sget_simple_extent_dims (dataspace_id, priv->extent, NULL);
+            H5Sclose (dataspace_id);
+            priv->min_extent = priv->extent[0];
         }
         else {
-            hid_t group_id;
-            hid_t dcpl;
-            hsize_t max_dims[3] = { H5S_UNLIMITED, image->requisition->dims[1], image->requisition->dims[0] };
-
-            group_id = make_groups (priv->file_id, priv->dataset);
-
-            dst_dataspace_id = H5Screate_simple (3, dims, max_dims);
-            dcpl = H5Pcreate (H5P_DATASET_CREATE);
-            H5Pset_chunk (dcpl, 3, dims);
-            priv->dataset_id = H5Dcreate (group_id, priv->dataset, mem_type, dst_dataspace_id,
-                                          H5P_DEFAULT, dcpl, H5P_DEFAULT);
-
-            H5Pclose (dcpl);
-            H5Sclose (dst_dataspace_id);
+            priv->extent[0] = priv->grow;
+            priv->min_extent = 0;
+            create_dataset (priv, mem_type);
         }
     }
-    else {
-        H5Dset_extent (priv->dataset_id, dims);
+
+    /* Grow in batches rather than once per frame */
+    if (priv->current >= priv->extent[0]) {
+        priv->extent[0] = priv->current + priv->grow;
+        H5Dset_extent (priv->dataset_id, priv->extent);
     }
 
     dst_dataspace_id = H5Dget_space (priv->dataset_id);
@@ -229,6 +343,11 @@ ufo_hdf5_writer_finalize (GObject *object)
     UfoHdf5WriterPrivate *priv;
 
     priv = UFO_HDF5_WRITER_GET_PRIVATE (object);
+
+    /* Multi-frame files are only closed once the writer goes away */
+    if (priv->file_id >= 0)
+        ufo_hdf5_writer_close (UFO_WRITER (object));
+
     g_free (priv->dataset);
 
     G_OBJECT_CLASS (ufo_hdf5_writer_parent_class)->finalize (object);
@@ -260,4 +379,13 @@ ufo_hdf5_writer_init (UfoHdf5Writer *self)
 
     self->priv = priv = UFO_HDF5_WRITER_GET_PRIVATE (self);
     priv->dataset = NULL;
+    priv->file_id = -1;
+    priv->dataset_id = -1;
+    priv->chunk_shape[0] = 1;
+    priv->chunk_shape[1] = 0;
+    priv->chunk_shape[2] = 0;
+    priv->compression = UFO_HDF5_COMPRESSION_NONE;
+    priv->compression_level = 4;
+    priv->shuffle = FALSE;
+    priv->grow = 64;
 }
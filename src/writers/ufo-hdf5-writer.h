@@ -32,6 +32,13 @@ G_BEGIN_DECLS
 #define UFO_HDF5_WRITER_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), UFO_TYPE_HDF5_WRITER, UfoHdf5WriterClass))
 
 
+typedef enum {
+    UFO_HDF5_COMPRESSION_NONE,
+    UFO_HDF5_COMPRESSION_DEFLATE,
+    UFO_HDF5_COMPRESSION_LZ4,
+    UFO_HDF5_COMPRESSION_BLOSC,
+} UfoHdf5Compression;
+
 typedef struct _UfoHdf5Writer           UfoHdf5Writer;
 typedef struct _UfoHdf5WriterClass      UfoHdf5WriterClass;
 typedef struct _UfoHdf5WriterPrivate    UfoHdf5WriterPrivate;
@@ -46,8 +53,18 @@ struct _UfoHdf5WriterClass {
     GObjectClass parent_class;
 };
 
-UfoHdf5Writer  *ufo_hdf5_writer_new       (void);
-GType           ufo_hdf5_writer_get_type  (void);
+UfoHdf5Writer  *ufo_hdf5_writer_new                 (void);
+void            ufo_hdf5_writer_set_chunk_shape     (UfoHdf5Writer      *writer,
+                                                     guint               frames,
+                                                     guint               height,
+                                                     guint               width);
+void            ufo_hdf5_writer_set_compression     (UfoHdf5Writer      *writer,
+                                                     UfoHdf5Compression  compression,
+                                                     guint               level,
+                                                     gboolean            shuffle);
+void            ufo_hdf5_writer_set_grow            (UfoHdf5Writer      *writer,
+                                                     guint               frames);
+GType           ufo_hdf5_writer_get_type            (void);
 
 G_END_DECLS
 
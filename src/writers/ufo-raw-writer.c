@@ -17,14 +17,36 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "writers/ufo-writer.h"
 #include "writers/ufo-raw-writer.h"
 
 
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+/* Alignment required by O_DIRECT and size of the coalesced writes */
+#define DIRECT_ALIGNMENT    4096
+#define DIRECT_BLOCK_SIZE   (16 * 1024 * 1024)
+
 struct _UfoRawWriterPrivate {
     FILE *fp;
+
+    gboolean direct;
+    guint n_preallocate;
+    gint fd;
+    guint8 *block;
+    gsize block_fill;
+    goffset written;
 };
 
 static void ufo_writer_interface_init (UfoWriterIface *iface);
@@ -42,6 +64,20 @@ ufo_raw_writer_new (void)
     return writer;
 }
 
+void
+ufo_raw_writer_set_direct (UfoRawWriter *writer,
+                           gboolean direct)
+{
+    writer->priv->direct = direct;
+}
+
+void
+ufo_raw_writer_set_preallocate (UfoRawWriter *writer,
+                                guint n_frames)
+{
+    writer->priv->n_preallocate = n_frames;
+}
+
 static gboolean
 ufo_raw_writer_can_open (UfoWriter *writer,
                          const gchar *filename)
@@ -56,15 +92,91 @@ ufo_raw_writer_open (UfoWriter *writer,
     UfoRawWriterPrivate *priv;
     
     priv = UFO_RAW_WRITER_GET_PRIVATE (writer);
+
+    if (priv->direct && filename != NULL) {
+        priv->fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+
+        /* Some file systems refuse O_DIRECT, we still coalesce large blocks */
+        if (priv->fd < 0 && errno == EINVAL) {
+            g_debug ("raw: `%s' does not support O_DIRECT", filename);
+            priv->fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+
+        if (priv->fd < 0) {
+            g_warning ("raw: cannot open `%s': %s", filename, strerror (errno));
+            return;
+        }
+
+        if (priv->block == NULL && posix_memalign ((gpointer *) &priv->block, DIRECT_ALIGNMENT, DIRECT_BLOCK_SIZE) != 0) {
+            g_warning ("raw: cannot allocate aligned buffer");
+            priv->block = NULL;
+        }
+
+        priv->block_fill = 0;
+        priv->written = 0;
+        return;
+    }
+
     priv->fp = filename == NULL ? stdout : fopen (filename, "wb");
 }
 
+static void
+write_block (UfoRawWriterPrivate *priv, gsize size)
+{
+    gsize offset = 0;
+
+    while (offset < size) {
+        gssize result = write (priv->fd, priv->block + offset, size - offset);
+
+        if (result < 0 && errno == EINVAL && (fcntl (priv->fd, F_GETFL) & O_DIRECT)) {
+            /* The file system accepted the flag but not the actual write */
+            fcntl (priv->fd, F_SETFL, fcntl (priv->fd, F_GETFL) & ~O_DIRECT);
+            continue;
+        }
+
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+
+            g_warning ("raw: write failed: %s", strerror (errno));
+            return;
+        }
+
+        offset += (gsize) result;
+    }
+}
+
+static void
+close_direct (UfoRawWriterPrivate *priv)
+{
+    if (priv->block_fill > 0) {
+        /* O_DIRECT needs aligned sizes, pad and cut the file afterwards */
+        gsize padded = (priv->block_fill + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+
+        memset (priv->block + priv->block_fill, 0, padded - priv->block_fill);
+        write_block (priv, padded);
+    }
+
+    if (ftruncate (priv->fd, priv->written) < 0)
+        g_warning ("raw: could not truncate file: %s", strerror (errno));
+
+    close (priv->fd);
+    priv->fd = -1;
+    priv->block_fill = 0;
+}
+
 static void
 ufo_raw_writer_close (UfoWriter *writer)
 {
     UfoRawWriterPrivate *priv;
     
     priv = UFO_RAW_WRITER_GET_PRIVATE (writer);
+
+    if (priv->fd >= 0) {
+        close_direct (priv);
+        return;
+    }
+
     g_assert (priv->fp != NULL);
     fclose (priv->fp);
     priv->fp = NULL;
@@ -84,6 +196,41 @@ bytes_per_pixel (UfoBufferDepth depth)
     }
 }
 
+static void
+write_direct (UfoRawWriterPrivate *priv, const guint8 *data, gsize size)
+{
+    /* Unlike posix_fallocate, this never falls back to writing zeros through
+     * the page cache, file systems without support are simply skipped */
+    if (priv->written == 0 && priv->n_preallocate > 0 &&
+        fallocate (priv->fd, 0, 0, (off_t) size * priv->n_preallocate) < 0 && errno != EOPNOTSUPP)
+        g_debug ("raw: could not preallocate: %s", strerror (errno));
+
+    priv->written += size;
+
+    if (priv->block == NULL) {
+        /* Could not get an aligned buffer, write unbuffered */
+        if (fcntl (priv->fd, F_SETFL, fcntl (priv->fd, F_GETFL) & ~O_DIRECT) < 0 ||
+            write (priv->fd, data, size) != (gssize) size)
+            g_warning ("raw: write failed: %s", strerror (errno));
+
+        return;
+    }
+
+    while (size > 0) {
+        gsize n_bytes = MIN (size, DIRECT_BLOCK_SIZE - priv->block_fill);
+
+        memcpy (priv->block + priv->block_fill, data, n_bytes);
+        priv->block_fill += n_bytes;
+        data += n_bytes;
+        size -= n_bytes;
+
+        if (priv->block_fill == DIRECT_BLOCK_SIZE) {
+            write_block (priv, DIRECT_BLOCK_SIZE);
+            priv->block_fill = 0;
+        }
+    }
+}
+
 static void
 ufo_raw_writer_write (UfoWriter *writer,
                       UfoWriterImage *image)
@@ -96,6 +243,11 @@ ufo_raw_writer_write (UfoWriter *writer,
     for (guint i = 0; i < image->requisition->n_dims; i++)
         size *= image->requisition->dims[i];
 
+    if (priv->fd >= 0) {
+        write_direct (priv, image->data, size);
+        return;
+    }
+
     fwrite (image->data, 1, size, priv->fp);
 }
 
@@ -106,9 +258,12 @@ ufo_raw_writer_finalize (GObject *object)
     
     priv = UFO_RAW_WRITER_GET_PRIVATE (object);
 
-    if (priv->fp != NULL)
+    if (priv->fp != NULL || priv->fd >= 0)
         ufo_raw_writer_close (UFO_WRITER (object));
 
+    free (priv->block);
+    priv->block = NULL;
+
     G_OBJECT_CLASS (ufo_raw_writer_parent_class)->finalize (object);
 }
 
@@ -138,4 +293,10 @@ ufo_raw_writer_init (UfoRawWriter *self)
 
     self->priv = priv = UFO_RAW_WRITER_GET_PRIVATE (self);
     priv->fp = NULL;
+    priv->direct = FALSE;
+    priv->n_preallocate = 0;
+    priv->fd = -1;
+    priv->block = NULL;
+    priv->block_fill = 0;
+    priv->written = 0;
 }
@@ -46,8 +46,12 @@ struct _UfoRawWriterClass {
     GObjectClass parent_class;
 };
 
-UfoRawWriter  *ufo_raw_writer_new       (void);
-GType          ufo_raw_writer_get_type  (void);
+UfoRawWriter  *ufo_raw_writer_new              (void);
+void           ufo_raw_writer_set_direct       (UfoRawWriter *writer,
+                                                gboolean      direct);
+void           ufo_raw_writer_set_preallocate  (UfoRawWriter *writer,
+                                                guint         n_frames);
+GType          ufo_raw_writer_get_type         (void);
 
 G_END_DECLS
 
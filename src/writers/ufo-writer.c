@@ -17,8 +17,15 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "ufo-writer.h"
 
+/* Number of elements converted by one thread at a time */
+#define BLOCK_SIZE  (256 * 1024)
+
 typedef UfoWriterIface UfoWriterInterface;
 
 G_DEFINE_INTERFACE (UfoWriter, ufo_writer, 0)
@@ -43,14 +50,21 @@ ufo_writer_close (UfoWriter *writer)
     UFO_WRITER_GET_IFACE (writer)->close (writer);
 }
 
-void
-ufo_writer_write (UfoWriter *writer,
-                  UfoWriterImage *image)
+typedef struct {
+    gpointer data;
+    gsize size;
+} Scratch;
+
+static void
+free_scratch (Scratch *scratch)
 {
-    ufo_writer_convert_inplace (image);
-    UFO_WRITER_GET_IFACE (writer)->write (writer, image);
+    g_free (scratch->data);
+    g_free (scratch);
 }
 
+/* Conversion target, one per writing thread */
+static GPrivate scratch_key = G_PRIVATE_INIT ((GDestroyNotify) free_scratch);
+
 static gsize
 get_num_elements (UfoRequisition *requisition)
 {
@@ -62,6 +76,90 @@ get_num_elements (UfoRequisition *requisition)
     return count;
 }
 
+static gpointer
+get_scratch (gsize size)
+{
+    Scratch *scratch = g_private_get (&scratch_key);
+
+    if (scratch == NULL) {
+        scratch = g_new0 (Scratch, 1);
+        g_private_set (&scratch_key, scratch);
+    }
+
+    if (scratch->size < size) {
+        g_free (scratch->data);
+        scratch->data = g_malloc (size);
+        scratch->size = size;
+    }
+
+    return scratch->data;
+}
+
+void
+ufo_writer_write (UfoWriter *writer,
+                  UfoWriterImage *image)
+{
+    UfoWriterImage converted;
+    gsize n_elements;
+
+    if (image->depth != UFO_BUFFER_DEPTH_8U && image->depth != UFO_BUFFER_DEPTH_16U &&
+        image->depth != UFO_BUFFER_DEPTH_16S) {
+        UFO_WRITER_GET_IFACE (writer)->write (writer, image);
+        return;
+    }
+
+    /* Converting out-of-place lets us split the work among threads */
+    n_elements = get_num_elements (image->requisition);
+    converted = *image;
+    converted.data = get_scratch (n_elements * (image->depth == UFO_BUFFER_DEPTH_8U ? 1 : 2));
+    ufo_writer_convert (image, converted.data);
+    UFO_WRITER_GET_IFACE (writer)->write (writer, &converted);
+}
+
+static void
+find_range (const gfloat *src, gsize n, gfloat *min, gfloat *max)
+{
+    gfloat cmin = G_MAXFLOAT;
+    gfloat cmax = -G_MAXFLOAT;
+    gsize i = 0;
+
+#ifdef __SSE2__
+    if (n >= 8) {
+        __m128 vmin0 = _mm_set1_ps (G_MAXFLOAT);
+        __m128 vmin1 = vmin0;
+        __m128 vmax0 = _mm_set1_ps (-G_MAXFLOAT);
+        __m128 vmax1 = vmax0;
+        gfloat tmp[4];
+
+        for (; i + 8 <= n; i += 8) {
+            __m128 a = _mm_loadu_ps (src + i);
+            __m128 b = _mm_loadu_ps (src + i + 4);
+
+            vmin0 = _mm_min_ps (vmin0, a);
+            vmin1 = _mm_min_ps (vmin1, b);
+            vmax0 = _mm_max_ps (vmax0, a);
+            vmax1 = _mm_max_ps (vmax1, b);
+        }
+
+        _mm_storeu_ps (tmp, _mm_min_ps (vmin0, vmin1));
+        cmin = MIN (MIN (tmp[0], tmp[1]), MIN (tmp[2], tmp[3]));
+        _mm_storeu_ps (tmp, _mm_max_ps (vmax0, vmax1));
+        cmax = MAX (MAX (tmp[0], tmp[1]), MAX (tmp[2], tmp[3]));
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (src[i] < cmin)
+            cmin = src[i];
+
+        if (src[i] > cmax)
+            cmax = src[i];
+    }
+
+    *min = cmin;
+    *max = cmax;
+}
+
 static void
 get_min_max (UfoWriterImage *image, gfloat *min, gfloat *max)
 {
@@ -75,95 +173,129 @@ get_min_max (UfoWriterImage *image, gfloat *min, gfloat *max)
      * user ... */
 
     gsize n_elements = get_num_elements (image->requisition);
+    gsize n_blocks = (n_elements + BLOCK_SIZE - 1) / BLOCK_SIZE;
     gfloat cmax = -G_MAXFLOAT;
     gfloat cmin = G_MAXFLOAT;
     gfloat *src = (gfloat *) image->data;
 
-    for (gsize i = 0; i < n_elements; i++) {
-        if (src[i] < cmin)
-            cmin = src[i];
+#pragma omp parallel for reduction(min:cmin) reduction(max:cmax) if (n_blocks > 1)
+    for (gsize b = 0; b < n_blocks; b++) {
+        gfloat bmin, bmax;
 
-        if (src[i] > cmax)
-            cmax = src[i];
+        find_range (src + b * BLOCK_SIZE, MIN (BLOCK_SIZE, n_elements - b * BLOCK_SIZE), &bmin, &bmax);
+        cmin = MIN (cmin, bmin);
+        cmax = MAX (cmax, bmax);
     }
 
     *max = cmax;
     *min = cmin;
 }
 
+/*
+ * The converters clip to [lo, hi] and scale in one sweep. They are safe to be
+ * used in-place as long as blocks are processed in order, because each vector
+ * is loaded before its narrower result is stored.
+ */
 static void
-convert_to_8bit (UfoWriterImage *image)
+convert_block_8bit (const gfloat *src, guint8 *dst, gsize n,
+                    gfloat lo, gfloat hi, gfloat min, gfloat scale)
 {
-    gfloat *src;
-    guint8 *dst;
-    gfloat max, min, scale;
-    gsize n_elements;
+    gsize i = 0;
 
-    src = (gfloat *) image->data;
-    get_min_max (image, &min, &max);
-    scale = 255.0f / (max - min);
+#ifdef __SSE2__
+    const __m128 vlo = _mm_set1_ps (lo);
+    const __m128 vhi = _mm_set1_ps (hi);
+    const __m128 vmin = _mm_set1_ps (min);
+    const __m128 vscale = _mm_set1_ps (scale);
 
-    n_elements = get_num_elements (image->requisition);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v[4];
 
-    /* first clip */
-    if (min < max) {
-        for (gsize i = 0; i < n_elements; i++) {
-            if (src[i] < min)
-                src[i] = min;
-            else if (src[i] > max)
-                src[i] = max;
+        for (guint j = 0; j < 4; j++) {
+            __m128 x = _mm_loadu_ps (src + i + 4 * j);
+            x = _mm_min_ps (_mm_max_ps (x, vlo), vhi);
+            v[j] = _mm_cvttps_epi32 (_mm_mul_ps (_mm_sub_ps (x, vmin), vscale));
         }
+
+        _mm_storeu_si128 ((__m128i *) (dst + i),
+                          _mm_packus_epi16 (_mm_packs_epi32 (v[0], v[1]),
+                                            _mm_packs_epi32 (v[2], v[3])));
     }
-    else {
-        for (gsize i = 0; i < n_elements; i++) {
-            if (src[i] < max)
-                src[i] = max;
-            else if (src[i] > min)
-                src[i] = min;
+#endif
+
+    for (; i < n; i++)
+        dst[i] = (guint8) ((CLAMP (src[i], lo, hi) - min) * scale);
+}
+
+static void
+convert_block_16bit (const gfloat *src, guint16 *dst, gsize n,
+                     gfloat lo, gfloat hi, gfloat min, gfloat scale)
+{
+    gsize i = 0;
+
+#ifdef __SSE2__
+    const __m128 vlo = _mm_set1_ps (lo);
+    const __m128 vhi = _mm_set1_ps (hi);
+    const __m128 vmin = _mm_set1_ps (min);
+    const __m128 vscale = _mm_set1_ps (scale);
+    const __m128i bias32 = _mm_set1_epi32 (32768);
+    const __m128i bias16 = _mm_set1_epi16 ((gint16) 0x8000);
+
+    /* SSE2 only packs with signed saturation, so shift into the signed range and back */
+    for (; i + 8 <= n; i += 8) {
+        __m128i v[2];
+
+        for (guint j = 0; j < 2; j++) {
+            __m128 x = _mm_loadu_ps (src + i + 4 * j);
+            x = _mm_min_ps (_mm_max_ps (x, vlo), vhi);
+            v[j] = _mm_sub_epi32 (_mm_cvttps_epi32 (_mm_mul_ps (_mm_sub_ps (x, vmin), vscale)), bias32);
         }
-    }
 
-    dst = (guint8 *) src;
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_xor_si128 (_mm_packs_epi32 (v[0], v[1]), bias16));
+    }
+#endif
 
-    /* then rescale */
-    for (gsize i = 0; i < n_elements; i++)
-        dst[i] = (guint8) ((src[i] - min) * scale);
+    for (; i < n; i++)
+        dst[i] = (guint16) ((CLAMP (src[i], lo, hi) - min) * scale);
 }
 
-static void
-convert_to_16bit (UfoWriterImage *image)
+void
+ufo_writer_convert (UfoWriterImage *image,
+                    gpointer dst)
 {
     gfloat *src;
-    guint16 *dst;
-    gfloat max, min, scale;
+    gfloat max, min, lo, hi, scale;
     gsize n_elements;
+    gsize n_blocks;
+    gboolean bits8;
 
+    if (image->depth != UFO_BUFFER_DEPTH_8U && image->depth != UFO_BUFFER_DEPTH_16U &&
+        image->depth != UFO_BUFFER_DEPTH_16S)
+        return;
+
+    bits8 = image->depth == UFO_BUFFER_DEPTH_8U;
     src = (gfloat *) image->data;
     get_min_max (image, &min, &max);
-    scale = 65535.0f / (max - min);
+
+    /* min > max is allowed and inverts the output */
+    lo = MIN (min, max);
+    hi = MAX (min, max);
+    scale = max != min ? (bits8 ? 255.0f : 65535.0f) / (max - min) : 0.0f;
+
     n_elements = get_num_elements (image->requisition);
-    dst = (guint16 *) src;
-
-    if (min < max) {
-        for (gsize i = 0; i < n_elements; i++) {
-            if (src[i] < min)
-                src[i] = min;
-            else if (src[i] > max)
-                src[i] = max;
-        }
-    }
-    else {
-        for (gsize i = 0; i < n_elements; i++) {
-            if (src[i] < max)
-                src[i] = max;
-            else if (src[i] > min)
-                src[i] = min;
-        }
-    }
+    n_blocks = (n_elements + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    /* In-place conversion must run front to back on a single thread */
+#pragma omp parallel for if (n_blocks > 1 && dst != image->data)
+    for (gsize b = 0; b < n_blocks; b++) {
+        gsize offset = b * BLOCK_SIZE;
+        gsize n = MIN (BLOCK_SIZE, n_elements - offset);
 
-    /* TODO: good opportunity for some SSE acceleration */
-    for (gsize i = 0; i < n_elements; i++)
-        dst[i] = (guint16) ((src[i] - min) * scale);
+        if (bits8)
+            convert_block_8bit (src + offset, ((guint8 *) dst) + offset, n, lo, hi, min, scale);
+        else
+            convert_block_16bit (src + offset, ((guint16 *) dst) + offset, n, lo, hi, min, scale);
+    }
 }
 
 void
@@ -173,17 +305,7 @@ ufo_writer_convert_inplace (UfoWriterImage *image)
      * Since we convert to data requiring less bytes per pixel than the native
      * float format, we can do everything in-place.
      */
-    switch (image->depth) {
-        case UFO_BUFFER_DEPTH_8U:
-            convert_to_8bit (image);
-            break;
-        case UFO_BUFFER_DEPTH_16U:
-        case UFO_BUFFER_DEPTH_16S:
-            convert_to_16bit (image);
-            break;
-        default:
-            break;
-    }
+    ufo_writer_convert (image, image->data);
 }
 
 static void
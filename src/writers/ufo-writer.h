@@ -61,6 +61,8 @@ void     ufo_writer_open     (UfoWriter      *writer,
 void     ufo_writer_close    (UfoWriter      *writer);
 void     ufo_writer_write    (UfoWriter      *writer,
                               UfoWriterImage *image);
+void     ufo_writer_convert  (UfoWriterImage *image,
+                              gpointer        dst);
 void     ufo_writer_convert_inplace
                              (UfoWriterImage *image);
 